@@ -43,6 +43,130 @@ Tcl_Config utf8procConfig[] = {
     {NULL, NULL}
 };
 
+/*
+ * Normalization modes accepted by the -mode option of the commands. The
+ * order of the names must match the NormalizationMode enum.
+ */
+static const char *normalizationForms[] = {
+    "nfc", "nfd", "nfkc", "nfkd", "nfkccasefold", NULL
+};
+typedef enum {
+    MODE_NFC,
+    MODE_NFD,
+    MODE_NFKC,
+    MODE_NFKD,
+    MODE_NFKC_CASEFOLD
+} NormalizationMode;
+
+/*
+ * NormalizationOptions --
+ *
+ *	Maps a normalization mode to the corresponding utf8proc options.
+ *
+ * Results:
+ *	The utf8proc option flags.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static utf8proc_option_t
+NormalizationOptions(
+    NormalizationMode mode)	/* Normalization mode */
+{
+    utf8proc_option_t options = UTF8PROC_STABLE;
+    switch (mode) {
+    case MODE_NFC:
+	options |= UTF8PROC_COMPOSE;
+	break;
+    case MODE_NFD:
+	options |= UTF8PROC_DECOMPOSE;
+	break;
+    case MODE_NFKC:
+	options |= UTF8PROC_COMPOSE|UTF8PROC_COMPAT;
+	break;
+    case MODE_NFKD:
+	options |= UTF8PROC_DECOMPOSE|UTF8PROC_COMPAT;
+	break;
+    case MODE_NFKC_CASEFOLD:
+	options |= UTF8PROC_COMPOSE | UTF8PROC_COMPAT | UTF8PROC_CASEFOLD
+		 | UTF8PROC_IGNORE;
+	break;
+    }
+    return options;
+}
+
+#ifdef UTF8PROC_STATS
+/*
+ * Counters for the stats command, shared by all threads and interpreters.
+ * They are updated with relaxed atomic additions, and are not compiled in
+ * unless UTF8PROC_STATS is defined.
+ */
+
+typedef Tcl_WideUInt StatsCounter;
+#if defined(__GNUC__)
+#define StatsAdd(counter, n) \
+    ((void)__atomic_fetch_add(&(counter), (StatsCounter)(n), __ATOMIC_RELAXED))
+#define StatsGet(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define StatsReset(counter) __atomic_store_n(&(counter), 0, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define StatsAdd(counter, n) \
+    ((void)InterlockedExchangeAdd64((volatile LONG64 *)&(counter), (LONG64)(n)))
+#define StatsGet(counter) \
+    ((StatsCounter)InterlockedCompareExchange64((volatile LONG64 *)&(counter), 0, 0))
+#define StatsReset(counter) \
+    ((void)InterlockedExchange64((volatile LONG64 *)&(counter), 0))
+#else
+#error "UTF8PROC_STATS requires atomic operations, which are only implemented for GCC, Clang and MSVC"
+#endif
+
+/*
+ * Command latencies are counted in buckets of powers of two microseconds.
+ * Bucket 0 counts calls of less than 1us and bucket i calls of 2^(i-1) to
+ * 2^i us. The last bucket also counts all longer calls.
+ */
+#define STATS_LATENCY_BUCKETS 24
+
+typedef struct {
+    StatsCounter calls;
+    StatsCounter errors;
+    StatsCounter latency[STATS_LATENCY_BUCKETS];
+} CommandStats;
+
+typedef struct {
+    StatsCounter calls;
+    StatsCounter bytesIn;	/* UTF-8 bytes of the passed strings */
+    StatsCounter bytesOut;	/* UTF-8 bytes of the normalized strings */
+} NormalizeStats;
+
+static NormalizeStats normalizeStats[sizeof(normalizationForms)/sizeof(normalizationForms[0]) - 1];
+#define NormalizeStatsAdd(mode, in, out) \
+    do { \
+	StatsAdd(normalizeStats[mode].calls, 1); \
+	StatsAdd(normalizeStats[mode].bytesIn, in); \
+	StatsAdd(normalizeStats[mode].bytesOut, out); \
+    } while (0)
+#else
+#define NormalizeStatsAdd(mode, in, out) ((void) 0)
+#endif /* UTF8PROC_STATS */
+
+/*
+ * Static tracepoints for perf, bpftrace or SystemTap, fired by the
+ * wrapper of each command with the name of the command. The command__entry
+ * probe has the number of arguments and the byte length of the last one as
+ * further arguments, the command__return probe the result code and the
+ * byte length of the result.
+ */
+#ifdef UTF8PROC_PROBES
+#include <sys/sdt.h>
+#endif
+
+#if defined(UTF8PROC_STATS) || defined(UTF8PROC_PROBES)
+#define WRAP_COMMANDS
+#endif
+
 /*
  * Tcl_UnicodeVersionObjCmd --
  *
@@ -67,6 +191,521 @@ Tcl_UnicodeVersionObjCmd(
     return TCL_OK;
 }
 
+/*
+ * Scratch memory for normalized strings, one arena per thread so that
+ * normalizing many short strings does not allocate memory for each of them.
+ * Memory above ARENA_LIMIT bytes, needed for a long string, is not kept.
+ */
+
+#define ARENA_LIMIT (1 << 20)
+
+typedef struct {
+    int initialized;
+    utf8proc_arena_t arena;
+} ThreadSpecificData;
+static Tcl_ThreadDataKey dataKey;
+
+/*
+ * ArenaThreadExitProc --
+ *
+ *	Releases the arena of a thread when the thread exits.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The arena memory is freed.
+ */
+
+static void
+ArenaThreadExitProc(
+    void *clientData)		/* ThreadSpecificData of the thread */
+{
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)clientData;
+    utf8proc_arena_release(&tsdPtr->arena);
+    tsdPtr->initialized = 0;
+}
+
+/*
+ * GetThreadArena --
+ *
+ *	Returns the arena of the current thread.
+ *
+ * Results:
+ *	Pointer to the arena.
+ *
+ * Side effects:
+ *	The arena is initialized on first use in the thread.
+ */
+
+static utf8proc_arena_t *
+GetThreadArena(void)
+{
+    ThreadSpecificData *tsdPtr = (ThreadSpecificData *)
+	Tcl_GetThreadData(&dataKey, sizeof(ThreadSpecificData));
+    if (!tsdPtr->initialized) {
+	utf8proc_arena_init(&tsdPtr->arena, ARENA_LIMIT);
+	Tcl_CreateThreadExitHandler(ArenaThreadExitProc, tsdPtr);
+	tsdPtr->initialized = 1;
+    }
+    return &tsdPtr->arena;
+}
+
+/*
+ * InvalidUtf8Error --
+ *
+ *	Sets the interpreter result to an error for the first invalid UTF-8
+ *	sequence in the passed bytes, in the form used by Tcl's encoding
+ *	commands with the strict profile.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Sets the interpreter result.
+ */
+
+static void
+InvalidUtf8Error(
+    Tcl_Interp *interp,		/* Current interpreter */
+    const utf8proc_uint8_t *bytes, /* Invalid UTF-8 */
+    Tcl_Size numBytes)		/* Length of bytes */
+{
+    Tcl_Size pos = utf8proc_valid_length(bytes, numBytes);
+    if (pos >= numBytes) {
+	/* Not an encoding error after all */
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(
+	    utf8proc_errmsg(UTF8PROC_ERROR_INVALIDUTF8), -1));
+	return;
+    }
+    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+	"unexpected byte sequence starting at index %" TCL_SIZE_MODIFIER
+	"d: '\\x%02X'", pos, bytes[pos]));
+    Tcl_SetErrorCode(interp, "TCL", "ENCODING", "ILLEGALSEQUENCE", NULL);
+}
+
+/*
+ * GetProfileFromObj --
+ *
+ *	Parses the value of a -profile option.
+ *
+ * Results:
+ *	A standard Tcl result. On success, *profilePtr is set to
+ *	TCL_ENCODING_PROFILE_STRICT or TCL_ENCODING_PROFILE_REPLACE.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static int
+GetProfileFromObj(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Obj *objPtr,		/* Value of the option */
+    int *profilePtr)		/* Receives the profile */
+{
+    const char *s = Tcl_GetString(objPtr);
+    if (!strcmp(s, "replace")) {
+	*profilePtr = TCL_ENCODING_PROFILE_REPLACE;
+    } else if (!strcmp(s, "strict")) {
+	*profilePtr = TCL_ENCODING_PROFILE_STRICT;
+    } else {
+	Tcl_SetObjResult(interp,
+	    Tcl_ObjPrintf("Invalid value \"%s\" supplied for option \"-profile\". Must be "
+			  "\"strict\" or \"replace\".",
+			  s));
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+static const char *newlineModes[] = {"lf", "ls", "ps", NULL};
+static const utf8proc_option_t newlineFlags[] = {
+    UTF8PROC_NLF2LF, UTF8PROC_NLF2LS, UTF8PROC_NLF2PS
+};
+
+/*
+ * Options of the fold command and normalizer objects, parsed by
+ * ParseFoldOptions. Each command has its own table of the options it
+ * accepts so that errors only list those.
+ */
+typedef enum {
+    FOLD_FLAG, FOLD_MAP, FOLD_MODE, FOLD_NEWLINES, FOLD_PROFILE
+} FoldOptionKind;
+
+typedef struct {
+    const char *name;		/* Option name, or NULL at the end */
+    FoldOptionKind kind;	/* Option value parsed */
+    utf8proc_option_t flag;	/* utf8proc option of a FOLD_FLAG */
+} FoldOption;
+
+static const FoldOption foldOptions[] = {
+    {"-casefold", FOLD_FLAG, UTF8PROC_CASEFOLD},
+    {"-lump", FOLD_FLAG, UTF8PROC_LUMP},
+    {"-stripcc", FOLD_FLAG, UTF8PROC_STRIPCC},
+    {"-stripmark", FOLD_FLAG, UTF8PROC_STRIPMARK},
+    {"-stripna", FOLD_FLAG, UTF8PROC_STRIPNA},
+    {"-mode", FOLD_MODE, 0},
+    {"-newlines", FOLD_NEWLINES, 0},
+    {NULL, FOLD_FLAG, 0}
+};
+
+static const FoldOption normalizerOptions[] = {
+    {"-casefold", FOLD_FLAG, UTF8PROC_CASEFOLD},
+    {"-lump", FOLD_FLAG, UTF8PROC_LUMP},
+    {"-stripcc", FOLD_FLAG, UTF8PROC_STRIPCC},
+    {"-stripmark", FOLD_FLAG, UTF8PROC_STRIPMARK},
+    {"-stripna", FOLD_FLAG, UTF8PROC_STRIPNA},
+    {"-map", FOLD_MAP, 0},
+    {"-mode", FOLD_MODE, 0},
+    {"-newlines", FOLD_NEWLINES, 0},
+    {"-profile", FOLD_PROFILE, 0},
+    {"-streamsafe", FOLD_FLAG, UTF8PROC_STREAMSAFE},
+    {NULL, FOLD_FLAG, 0}
+};
+
+/* Values of the options parsed by ParseFoldOptions */
+typedef struct {
+    NormalizationMode mode;	/* Normalization mode */
+    utf8proc_option_t flags;	/* utf8proc options besides the mode */
+    int profile;		/* Encoding profile */
+    Tcl_Obj *mapObj;		/* Value of -map, or NULL */
+} FoldSettings;
+
+/*
+ * ParseFoldOptions --
+ *
+ *	Parses the options of the fold command or of a normalizer object,
+ *	as listed in optTable.
+ *
+ * Results:
+ *	A standard Tcl result. On success, *setPtr holds the options, with
+ *	defaults for those not passed.
+ *
+ * Side effects:
+ *	Sets the interpreter result on errors.
+ */
+
+static int
+ParseFoldOptions(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Size objc,		/* Number of options and values */
+    Tcl_Obj *const objv[],	/* Options and values */
+    const FoldOption *optTable,	/* Options accepted */
+    FoldSettings *setPtr)	/* Receives the option values */
+{
+    Tcl_Size i;
+    int index, newlines;
+
+    setPtr->mode = MODE_NFC;
+    setPtr->flags = 0;
+    setPtr->profile = TCL_ENCODING_PROFILE_STRICT;
+    setPtr->mapObj = NULL;
+    for (i = 0; i < objc; ++i) {
+	if (Tcl_GetIndexFromObjStruct(interp, objv[i], optTable,
+		sizeof(FoldOption), "option", 0, &index) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	if (optTable[index].kind == FOLD_FLAG) {
+	    setPtr->flags |= optTable[index].flag;
+	    continue;
+	}
+	++i;
+	if (i == objc) {
+	    Tcl_SetObjResult(interp,
+			     Tcl_ObjPrintf("Missing value for option %s.",
+					   Tcl_GetString(objv[i - 1])));
+	    return TCL_ERROR;
+	}
+	switch (optTable[index].kind) {
+	case FOLD_MAP:
+	    setPtr->mapObj = objv[i];
+	    break;
+	case FOLD_MODE:
+	    if (Tcl_GetIndexFromObj(interp, objv[i], normalizationForms,
+		    "normalization mode", 0, &setPtr->mode) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    break;
+	case FOLD_NEWLINES:
+	    if (Tcl_GetIndexFromObj(interp, objv[i], newlineModes,
+		    "newline mode", 0, &newlines) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    setPtr->flags |= newlineFlags[newlines];
+	    break;
+	case FOLD_PROFILE:
+	    if (GetProfileFromObj(interp, objv[i], &setPtr->profile) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+    return TCL_OK;
+}
+
+/*
+ * Custom mappings passed to the -map option, compiled from a dictionary of
+ * characters to their replacement into a table searched for each character
+ * by CustomMapLookup. A dense table indexed by code point is used if the
+ * mapped characters are close enough together, and otherwise a sorted
+ * table searched by bisection. The table is kept as the internal
+ * representation of the dictionary so that it is compiled only once.
+ */
+
+/*
+ * Dense tables are used if they have at most as many entries as
+ * CUSTOM_MAP_DENSE_FACTOR times the number of mapped characters plus
+ * CUSTOM_MAP_DENSE_SLACK.
+ */
+#define CUSTOM_MAP_DENSE_FACTOR 4
+#define CUSTOM_MAP_DENSE_SLACK 256
+
+typedef struct {
+    utf8proc_int32_t from;	/* Mapped character */
+    utf8proc_int32_t to;	/* Replacement, or UTF8PROC_CUSTOM_REMOVE */
+} CustomMapEntry;
+
+typedef struct {
+    size_t refCount;		/* Number of objects sharing the table */
+    utf8proc_int32_t first;	/* Lowest mapped character */
+    utf8proc_int32_t last;	/* Highest mapped character */
+    Tcl_Size numEntries;	/* Number of mapped characters */
+    utf8proc_int32_t *dense;	/* Replacements of first to last, or NULL */
+    CustomMapEntry *entries;	/* Sorted entries if dense is NULL */
+} CustomMap;
+
+static void FreeCustomMapInternalRep(Tcl_Obj *objPtr);
+static void DupCustomMapInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+
+static const Tcl_ObjType customMapType = {
+    "utf8proc-map",
+    FreeCustomMapInternalRep,
+    DupCustomMapInternalRep,
+    NULL,
+    NULL,
+    TCL_OBJTYPE_V0
+};
+
+static void
+ReleaseCustomMap(
+    CustomMap *mapPtr)		/* Custom map no longer used */
+{
+    if (--mapPtr->refCount == 0) {
+	Tcl_Free(mapPtr->dense);
+	Tcl_Free(mapPtr->entries);
+	Tcl_Free(mapPtr);
+    }
+}
+
+static void
+FreeCustomMapInternalRep(
+    Tcl_Obj *objPtr)		/* Object holding a custom map */
+{
+    const Tcl_ObjInternalRep *irPtr =
+	Tcl_FetchInternalRep(objPtr, &customMapType);
+    ReleaseCustomMap((CustomMap *)irPtr->twoPtrValue.ptr1);
+}
+
+static void
+DupCustomMapInternalRep(
+    Tcl_Obj *srcPtr,		/* Object holding a custom map */
+    Tcl_Obj *dupPtr)		/* Its duplicate */
+{
+    const Tcl_ObjInternalRep *irPtr =
+	Tcl_FetchInternalRep(srcPtr, &customMapType);
+    CustomMap *mapPtr = (CustomMap *)irPtr->twoPtrValue.ptr1;
+    Tcl_ObjInternalRep ir;
+
+    mapPtr->refCount++;
+    ir.twoPtrValue.ptr1 = mapPtr;
+    ir.twoPtrValue.ptr2 = NULL;
+    Tcl_StoreInternalRep(dupPtr, &customMapType, &ir);
+}
+
+static int
+CompareCustomMapEntries(
+    const void *a,
+    const void *b)
+{
+    utf8proc_int32_t x = ((const CustomMapEntry *)a)->from;
+    utf8proc_int32_t y = ((const CustomMapEntry *)b)->from;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * CustomMapCharacter --
+ *
+ *	Gets the code point of a key or value of a custom mapping dictionary.
+ *
+ * Results:
+ *	The code point, UTF8PROC_CUSTOM_REMOVE for an empty value, or -2 if
+ *	the object is neither a single character nor, for values, empty.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static utf8proc_int32_t
+CustomMapCharacter(
+    Tcl_Obj *objPtr,		/* Key or value */
+    int isValue)		/* Whether an empty value is allowed */
+{
+    Tcl_Size length = Tcl_GetCharLength(objPtr);
+    int ch;
+
+    if (length == 0 && isValue) {
+	return UTF8PROC_CUSTOM_REMOVE;
+    }
+    if (length != 1) {
+	return -2;
+    }
+    ch = Tcl_GetUniChar(objPtr, 0);
+    if (ch < 0 || (ch >= 0xD800 && ch <= 0xDFFF)) {
+	return -2;
+    }
+    return ch;
+}
+
+/*
+ * GetCustomMapFromObj --
+ *
+ *	Gets the compiled custom mapping of a dictionary mapping single
+ *	characters to a single character or to the empty string to remove
+ *	them.
+ *
+ * Results:
+ *	A standard Tcl result. On success, *mapPtrPtr is set to the mapping,
+ *	to be released with ReleaseCustomMap, or to NULL if the dictionary is
+ *	empty.
+ *
+ * Side effects:
+ *	The compiled mapping becomes the internal representation of objPtr.
+ */
+
+static int
+GetCustomMapFromObj(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Obj *objPtr,		/* Mapping dictionary */
+    CustomMap **mapPtrPtr)	/* Receives the compiled mapping */
+{
+    const Tcl_ObjInternalRep *irPtr =
+	Tcl_FetchInternalRep(objPtr, &customMapType);
+    Tcl_DictSearch search;
+    Tcl_Obj *keyObj, *valueObj;
+    Tcl_Size size, n = 0;
+    CustomMapEntry *entries;
+    CustomMap *mapPtr;
+    Tcl_ObjInternalRep ir;
+    int done;
+
+    if (irPtr) {
+	mapPtr = (CustomMap *)irPtr->twoPtrValue.ptr1;
+	mapPtr->refCount++;
+	*mapPtrPtr = mapPtr;
+	return TCL_OK;
+    }
+    if (Tcl_DictObjSize(interp, objPtr, &size) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (size == 0) {
+	*mapPtrPtr = NULL;
+	return TCL_OK;
+    }
+
+    entries = (CustomMapEntry *)Tcl_Alloc(size * sizeof(CustomMapEntry));
+    Tcl_DictObjFirst(NULL, objPtr, &search, &keyObj, &valueObj, &done);
+    for (; !done; Tcl_DictObjNext(&search, &keyObj, &valueObj, &done)) {
+	entries[n].from = CustomMapCharacter(keyObj, 0);
+	entries[n].to = CustomMapCharacter(valueObj, 1);
+	if (entries[n].from < 0 || entries[n].to < -1) {
+	    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"Invalid mapping \"%s\" -> \"%s\" supplied for option "
+		"\"-map\". Keys must be single characters and values single "
+		"characters or empty.",
+		Tcl_GetString(keyObj), Tcl_GetString(valueObj)));
+	    Tcl_DictObjDone(&search);
+	    Tcl_Free(entries);
+	    return TCL_ERROR;
+	}
+	n++;
+    }
+    qsort(entries, n, sizeof(CustomMapEntry), CompareCustomMapEntries);
+
+    mapPtr = (CustomMap *)Tcl_Alloc(sizeof(CustomMap));
+    mapPtr->refCount = 2;	/* The object and the caller */
+    mapPtr->first = entries[0].from;
+    mapPtr->last = entries[n - 1].from;
+    mapPtr->numEntries = n;
+    if (mapPtr->last - mapPtr->first + 1
+	    <= CUSTOM_MAP_DENSE_FACTOR * n + CUSTOM_MAP_DENSE_SLACK) {
+	Tcl_Size i, range = mapPtr->last - mapPtr->first + 1;
+	mapPtr->dense = (utf8proc_int32_t *)Tcl_Alloc(
+	    range * sizeof(utf8proc_int32_t));
+	for (i = 0; i < range; i++) {
+	    mapPtr->dense[i] = mapPtr->first + (utf8proc_int32_t)i;
+	}
+	for (i = 0; i < n; i++) {
+	    mapPtr->dense[entries[i].from - mapPtr->first] = entries[i].to;
+	}
+	Tcl_Free(entries);
+	mapPtr->entries = NULL;
+    } else {
+	mapPtr->dense = NULL;
+	mapPtr->entries = entries;
+    }
+
+    /* The string representation is kept to regenerate the dictionary */
+    (void) Tcl_GetString(objPtr);
+    ir.twoPtrValue.ptr1 = mapPtr;
+    ir.twoPtrValue.ptr2 = NULL;
+    Tcl_StoreInternalRep(objPtr, &customMapType, &ir);
+    *mapPtrPtr = mapPtr;
+    return TCL_OK;
+}
+
+/*
+ * CustomMapLookup --
+ *
+ *	The utf8proc custom_func applying a compiled custom mapping.
+ *
+ * Results:
+ *	The replacement of the character, or UTF8PROC_CUSTOM_REMOVE.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static utf8proc_int32_t
+CustomMapLookup(
+    utf8proc_int32_t uc,	/* Character to map */
+    void *clientData)		/* CustomMap */
+{
+    const CustomMap *mapPtr = (const CustomMap *)clientData;
+    Tcl_Size low, high;
+
+    if (uc < mapPtr->first || uc > mapPtr->last) {
+	return uc;
+    }
+    if (mapPtr->dense) {
+	return mapPtr->dense[uc - mapPtr->first];
+    }
+    low = 0;
+    high = mapPtr->numEntries - 1;
+    while (low <= high) {
+	Tcl_Size mid = low + (high - low) / 2;
+	if (mapPtr->entries[mid].from < uc) {
+	    low = mid + 1;
+	} else if (mapPtr->entries[mid].from > uc) {
+	    high = mid - 1;
+	} else {
+	    return mapPtr->entries[mid].to;
+	}
+    }
+    return uc;
+}
+
 /*
  * Tcl_UnicodeNormalizeObjCmd --
  *
@@ -87,32 +726,34 @@ Tcl_UnicodeNormalizeObjCmd(
     Tcl_Obj *const objv[]	/* Argument strings */
     )
 {
-    static const char *normalizationForms[] = {
-        "nfc", "nfd", "nfkc", "nfkd", "nfkccasefold", NULL
-    };
-    typedef enum {
-        MODE_NFC,
-        MODE_NFD,
-        MODE_NFKC,
-        MODE_NFKD,
-        MODE_NFKC_CASEFOLD
-    } NormalizationMode;
-    static const char *optNames[] = {"-profile", "-mode", NULL};
-    enum { OPT_PROFILE, OPT_MODE } opt;
+    static const char *optNames[] = {"-binary", "-profile", "-mode", "-offsets", "-streamsafe", "-map", NULL};
+    enum { OPT_BINARY, OPT_PROFILE, OPT_MODE, OPT_OFFSETS, OPT_STREAMSAFE, OPT_MAP } opt;
 
     if (objc < 2) {
-	Tcl_WrongNumArgs(interp, 1, objv, "?-profile PROFILE? ?-mode MODE? STRING");
+	Tcl_WrongNumArgs(interp, 1, objv, "?-binary? ?-profile PROFILE? ?-mode MODE? ?-offsets VARNAME? ?-streamsafe? ?-map DICT? STRING");
 	return TCL_ERROR;
     }
 
     int i;
     int profile = TCL_ENCODING_PROFILE_STRICT;
+    int binary = 0;
+    int streamSafe = 0;
     NormalizationMode mode = MODE_NFC;
+    Tcl_Obj *offsetsVarObj = NULL;
+    Tcl_Obj *mapObj = NULL;
     for (i = 1; i < objc - 1; ++i) {
 	if (Tcl_GetIndexFromObj(
 		interp, objv[i], optNames, "option", 0, &opt) != TCL_OK) {
 	    return TCL_ERROR;
 	}
+	if (opt == OPT_BINARY) {
+	    binary = 1;
+	    continue;
+	}
+	if (opt == OPT_STREAMSAFE) {
+	    streamSafe = 1;
+	    continue;
+	}
 	++i;
 	if (i == (objc-1)) {
 	    Tcl_SetObjResult(interp,
@@ -120,152 +761,2234 @@ Tcl_UnicodeNormalizeObjCmd(
 					   Tcl_GetString(objv[i - 1])));
 	    return TCL_ERROR;
 	}
-	const char *s = Tcl_GetString(objv[i]);
 	switch (opt) {
 	case OPT_PROFILE:
-	    if (!strcmp(s, "replace")) {
-		profile = TCL_ENCODING_PROFILE_REPLACE;
-	    } else if (!strcmp(s, "strict")) {
-		profile = TCL_ENCODING_PROFILE_STRICT;
-            } else {
-                Tcl_SetObjResult(interp,
-		    Tcl_ObjPrintf("Invalid value \"%s\" supplied for option \"-profile\". Must be "
-				  "\"strict\" or \"replace\".",
-				  s));
+	    if (GetProfileFromObj(interp, objv[i], &profile) != TCL_OK) {
 		return TCL_ERROR;
-            }
-            break;
+	    }
+	    break;
 	case OPT_MODE:
 	    if (Tcl_GetIndexFromObj(interp, objv[i], normalizationForms, "normalization mode", 0, &mode) != TCL_OK) {
 		return TCL_ERROR;
 	    }
 	    break;
+	case OPT_OFFSETS:
+	    offsetsVarObj = objv[i];
+	    break;
+	case OPT_MAP:
+	    mapObj = objv[i];
+	    break;
 	default:
 	    TCL_UNREACHABLE();
 	}
     }
 
-    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
-    if (encoding == NULL) {
+    CustomMap *mapPtr = NULL;
+    if (mapObj && GetCustomMapFromObj(interp, mapObj, &mapPtr) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    Tcl_Encoding encoding = NULL;
+    int result;
+    Tcl_DString ds;
+    const utf8proc_uint8_t *srcStr;
+    Tcl_Size srcLength;
+
+    Tcl_DStringInit(&ds);
+    if (binary) {
+	/* The bytes are normalized as they are, without any conversion */
+	srcStr = Tcl_GetBytesFromObj(interp, objv[objc - 1], &srcLength);
+	result = srcStr ? TCL_OK : TCL_ERROR;
+    } else {
+	encoding = Tcl_GetEncoding(interp, "utf-8");
+	if (encoding == NULL) {
+	    if (mapPtr) {
+		ReleaseCustomMap(mapPtr);
+	    }
+	    return TCL_ERROR;
+	}
+	result = Tcl_UtfToExternalDStringEx(interp, encoding,
+		    Tcl_GetString(objv[objc - 1]), -1, profile, &ds, NULL);
+	srcStr = (utf8proc_uint8_t *) Tcl_DStringValue(&ds);
+	srcLength = Tcl_DStringLength(&ds);
+    }
+    /* !!! ds needs to be freed even in case of error returns */
+
+    if (result != TCL_OK) {
+        result = TCL_ERROR; /* Translate TCL_CONVERT_* errors to TCL_ERROR */
+    } else {
+        const utf8proc_uint8_t *normalizedUtf8;
+        utf8proc_ssize_t normalizedLength;
+        utf8proc_option_t options = NormalizationOptions(mode);
+        utf8proc_offset_t *offsets = NULL;
+        utf8proc_ssize_t numOffsets = 0;
+        if (binary && profile == TCL_ENCODING_PROFILE_REPLACE) {
+            /* Invalid bytes are replaced while decoding, in the same pass */
+            options |= UTF8PROC_REPLACE_INVALID;
+        }
+        if (streamSafe) {
+            options |= UTF8PROC_STREAMSAFE;
+        }
+        utf8proc_custom_func customFunc = mapPtr ? CustomMapLookup : NULL;
+        if (offsetsVarObj) {
+            normalizedLength = utf8proc_map_offsets(srcStr, srcLength,
+                &normalizedUtf8, options, customFunc, mapPtr, &offsets, &numOffsets);
+        } else {
+            normalizedLength = utf8proc_map_arena(srcStr, srcLength,
+                &normalizedUtf8, options, customFunc, mapPtr, GetThreadArena());
+        }
+
+        NormalizeStatsAdd(mode, srcLength, normalizedLength < 0 ? 0 : normalizedLength);
+        if (normalizedLength == UTF8PROC_ERROR_INVALIDUTF8 && binary) {
+            InvalidUtf8Error(interp, srcStr, srcLength);
+            result = TCL_ERROR;
+        } else if (normalizedLength < 0) {
+            const char *errorMsg = utf8proc_errmsg(normalizedLength);
+            Tcl_SetObjResult(
+                interp, Tcl_NewStringObj(
+                    errorMsg ? errorMsg : "Unicode normalization failed.", -1));
+            result = TCL_ERROR;
+        } else {
+            Tcl_Obj *resultObj = NULL;
+            assert(normalizedUtf8);
+            if (binary) {
+                resultObj = Tcl_NewByteArrayObj(normalizedUtf8, normalizedLength);
+            } else {
+                /* Convert standard UTF8 to internal UTF8 */
+                Tcl_DStringSetLength(&ds, 0);
+                result = Tcl_ExternalToUtfDStringEx(interp, encoding,
+                    (const char *)normalizedUtf8, normalizedLength, profile, &ds, NULL);
+            }
+            if (offsetsVarObj && binary) {
+                /*
+                 * Offsets are in codepoints, which are the character indices
+                 * of Tcl strings but not of byte arrays of UTF-8.
+                 */
+                utf8proc_offsets_bytes(srcStr, srcLength, normalizedUtf8,
+                    offsets, numOffsets, options);
+            }
+            if (offsetsVarObj) {
+                free((void *)normalizedUtf8);
+            }
+            if (result == TCL_OK && offsetsVarObj) {
+                Tcl_Obj *offsetsObj = Tcl_NewListObj(numOffsets, NULL);
+                utf8proc_ssize_t j;
+                for (j = 0; j < numOffsets; j++) {
+                    Tcl_Obj *elems[4];
+                    elems[0] = Tcl_NewWideIntObj(offsets[j].dst);
+                    elems[1] = Tcl_NewWideIntObj(offsets[j].dstlen);
+                    elems[2] = Tcl_NewWideIntObj(offsets[j].src);
+                    elems[3] = Tcl_NewWideIntObj(offsets[j].srclen);
+                    Tcl_ListObjAppendElement(NULL, offsetsObj, Tcl_NewListObj(4, elems));
+                }
+                if (Tcl_ObjSetVar2(interp, offsetsVarObj, NULL, offsetsObj,
+                        TCL_LEAVE_ERR_MSG) == NULL) {
+                    result = TCL_ERROR;
+                }
+            }
+	    if (result != TCL_OK) {
+		if (resultObj) {
+		    Tcl_BounceRefCount(resultObj);
+		}
+	    } else if (resultObj) {
+		Tcl_SetObjResult(interp, resultObj);
+	    } else {
+                Tcl_DStringResult(interp, &ds);
+            }
+        }
+        free(offsets);
+    }
+
+    Tcl_DStringFree(&ds);
+    if (encoding) {
+	Tcl_FreeEncoding(encoding);
+    }
+    if (mapPtr) {
+	ReleaseCustomMap(mapPtr);
+    }
+    /* Translate TCL_CONVERT* etc. codes to TCL_ERROR */
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * Tcl_UnicodeFoldObjCmd --
+ *
+ *	Implements the "fold" command normalizing a string and applying
+ *	the utf8proc folding options for searching in a single pass.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the folded string.
+ */
+
+static int
+Tcl_UnicodeFoldObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    FoldSettings settings;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-casefold? ?-lump? ?-stripcc? ?-stripmark? ?-stripna? ?-mode MODE? ?-newlines MODE? STRING");
+	return TCL_ERROR;
+    }
+    if (ParseFoldOptions(interp, objc - 2, objv + 1, foldOptions,
+	    &settings) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
+    Tcl_DString ds;
+    int result;
+
+    if (encoding == NULL) {
+	return TCL_ERROR;
+    }
+    Tcl_DStringInit(&ds);
+    result = Tcl_UtfToExternalDStringEx(interp, encoding,
+	Tcl_GetString(objv[objc - 1]), -1, TCL_ENCODING_PROFILE_STRICT, &ds,
+	NULL);
+    if (result == TCL_OK) {
+	const utf8proc_uint8_t *foldedUtf8;
+	utf8proc_ssize_t foldedLength = utf8proc_map_arena(
+	    (const utf8proc_uint8_t *)Tcl_DStringValue(&ds),
+	    Tcl_DStringLength(&ds), &foldedUtf8,
+	    NormalizationOptions(settings.mode) | settings.flags, NULL, NULL,
+	    GetThreadArena());
+	if (foldedLength < 0) {
+	    Tcl_SetObjResult(interp,
+		Tcl_NewStringObj(utf8proc_errmsg(foldedLength), -1));
+	    result = TCL_ERROR;
+	} else {
+	    Tcl_DStringSetLength(&ds, 0);
+	    result = Tcl_ExternalToUtfDStringEx(interp, encoding,
+		(const char *)foldedUtf8, foldedLength,
+		TCL_ENCODING_PROFILE_STRICT, &ds, NULL);
+	    if (result == TCL_OK) {
+		Tcl_DStringResult(interp, &ds);
+	    }
+	}
+    }
+    Tcl_DStringFree(&ds);
+    Tcl_FreeEncoding(encoding);
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * Normalizer objects created by the "normalizer create" command. The
+ * options are resolved when the object is created, and each object has its
+ * own arena, which keeps the memory needed for the longest string
+ * normalized so far.
+ */
+typedef struct {
+    NormalizationMode mode;	/* Normalization mode, for statistics */
+    utf8proc_option_t options;	/* utf8proc options */
+    int profile;		/* Encoding profile for invalid strings */
+    CustomMap *mapPtr;		/* Custom mapping, or NULL */
+    Tcl_Encoding encoding;	/* utf-8 encoding */
+    utf8proc_arena_t arena;	/* Scratch memory for normalized strings */
+    Tcl_Command token;		/* Command of the object */
+} Normalizer;
+
+#ifdef WRAP_COMMANDS
+static Tcl_ObjCmdProc NormalizerWrapperObjCmd;
+#endif
+
+/*
+ * NormalizerDeleteProc --
+ *
+ *	Frees a normalizer object when its command is deleted.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The memory of the normalizer is freed.
+ */
+
+static void
+NormalizerDeleteProc(
+    void *clientData)		/* Normalizer */
+{
+    Normalizer *normPtr = (Normalizer *)clientData;
+    if (normPtr->mapPtr) {
+	ReleaseCustomMap(normPtr->mapPtr);
+    }
+    Tcl_FreeEncoding(normPtr->encoding);
+    utf8proc_arena_release(&normPtr->arena);
+    Tcl_Free(normPtr);
+}
+
+/*
+ * NormalizerNormalize --
+ *
+ *	Normalizes a string with the options of a normalizer. Tcl strings
+ *	are UTF-8 but for NUL characters and surrogates, so the string
+ *	representation is normalized as it is, and only converted through
+ *	the utf-8 encoding if it is rejected.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the normalized string.
+ */
+
+static int
+NormalizerNormalize(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Normalizer *normPtr,	/* Normalizer */
+    Tcl_Obj *objPtr)		/* String to normalize */
+{
+    utf8proc_custom_func customFunc = normPtr->mapPtr ? CustomMapLookup : NULL;
+    const utf8proc_uint8_t *normalizedUtf8;
+    utf8proc_ssize_t normalizedLength;
+    Tcl_Size srcLength;
+    const char *srcStr = Tcl_GetStringFromObj(objPtr, &srcLength);
+    Tcl_DString ds;
+    int result = TCL_OK;
+
+    normalizedLength = utf8proc_map_arena((const utf8proc_uint8_t *)srcStr,
+	srcLength, &normalizedUtf8, normPtr->options, customFunc,
+	normPtr->mapPtr, &normPtr->arena);
+    if (normalizedLength >= 0 &&
+	    !memchr(normalizedUtf8, 0, (size_t) normalizedLength)) {
+	NormalizeStatsAdd(normPtr->mode, srcLength, normalizedLength);
+	Tcl_SetObjResult(interp, Tcl_NewStringObj(
+	    (const char *)normalizedUtf8, normalizedLength));
+	return TCL_OK;
+    }
+
+    Tcl_DStringInit(&ds);
+    if (normalizedLength == UTF8PROC_ERROR_INVALIDUTF8) {
+	result = Tcl_UtfToExternalDStringEx(interp, normPtr->encoding,
+	    srcStr, srcLength, normPtr->profile, &ds, NULL);
+	if (result == TCL_OK) {
+	    srcLength = Tcl_DStringLength(&ds);
+	    normalizedLength = utf8proc_map_arena(
+		(const utf8proc_uint8_t *)Tcl_DStringValue(&ds), srcLength,
+		&normalizedUtf8, normPtr->options, customFunc,
+		normPtr->mapPtr, &normPtr->arena);
+	}
+    }
+    if (result == TCL_OK) {
+	NormalizeStatsAdd(normPtr->mode, srcLength,
+	    normalizedLength < 0 ? 0 : normalizedLength);
+	if (normalizedLength < 0) {
+	    Tcl_SetObjResult(interp,
+		Tcl_NewStringObj(utf8proc_errmsg(normalizedLength), -1));
+	    result = TCL_ERROR;
+	} else {
+	    /* Convert NUL characters to the internal UTF-8 */
+	    Tcl_DStringFree(&ds);
+	    result = Tcl_ExternalToUtfDStringEx(interp, normPtr->encoding,
+		(const char *)normalizedUtf8, normalizedLength,
+		normPtr->profile, &ds, NULL);
+	    if (result == TCL_OK) {
+		Tcl_DStringResult(interp, &ds);
+	    }
+	}
+    }
+    Tcl_DStringFree(&ds);
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * NormalizerObjCmd --
+ *
+ *	Implements the command of a normalizer object.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Depends on the subcommand: "normalize" sets the interpreter result to
+ *	the normalized string and "destroy" deletes the object.
+ */
+
+static int
+NormalizerObjCmd(
+    void *clientData,		/* Normalizer */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *subcommands[] = {"destroy", "normalize", NULL};
+    enum { SUB_DESTROY, SUB_NORMALIZE } sub;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?arg ...?");
+	return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(
+	    interp, objv[1], subcommands, "subcommand", 0, &sub) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    switch (sub) {
+    case SUB_DESTROY:
+	if (objc != 2) {
+	    Tcl_WrongNumArgs(interp, 2, objv, NULL);
+	    return TCL_ERROR;
+	}
+	Tcl_DeleteCommandFromToken(interp, ((Normalizer *)clientData)->token);
+	return TCL_OK;
+    case SUB_NORMALIZE:
+	if (objc != 3) {
+	    Tcl_WrongNumArgs(interp, 2, objv, "STRING");
+	    return TCL_ERROR;
+	}
+	return NormalizerNormalize(interp, (Normalizer *)clientData, objv[2]);
+    default:
+	TCL_UNREACHABLE();
+    }
+}
+
+/*
+ * Tcl_UnicodeNormalizerObjCmd --
+ *
+ *	Implements the "normalizer" command creating normalizer objects.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Creates the command of the normalizer object and sets the interpreter
+ *	result to its fully qualified name.
+ */
+
+static int
+Tcl_UnicodeNormalizerObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *subcommands[] = {"create", NULL};
+    int sub;
+    FoldSettings settings;
+
+    if (objc < 3) {
+	Tcl_WrongNumArgs(interp, 1, objv, "create NAME ?options?");
+	return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(
+	    interp, objv[1], subcommands, "subcommand", 0, &sub) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (ParseFoldOptions(interp, objc - 3, objv + 3, normalizerOptions,
+	    &settings) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    /* Unqualified names are relative to the current namespace, as for proc */
+    const char *name = Tcl_GetString(objv[2]);
+    Tcl_DString ds;
+    Tcl_CmdInfo info;
+    Tcl_DStringInit(&ds);
+    if (name[0] != ':' || name[1] != ':') {
+	Tcl_Namespace *nsPtr = Tcl_GetCurrentNamespace(interp);
+	if (nsPtr != Tcl_GetGlobalNamespace(interp)) {
+	    Tcl_DStringAppend(&ds, nsPtr->fullName, -1);
+	}
+	Tcl_DStringAppend(&ds, "::", 2);
+    }
+    Tcl_DStringAppend(&ds, name, -1);
+    /* Existing commands are not replaced, as for oo::class create */
+    if (Tcl_GetCommandInfo(interp, Tcl_DStringValue(&ds), &info)) {
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+	    "can't create object \"%s\": command already exists with"
+	    " that name", name));
+	Tcl_DStringFree(&ds);
+	return TCL_ERROR;
+    }
+
+    CustomMap *mapPtr = NULL;
+    if (settings.mapObj &&
+	    GetCustomMapFromObj(interp, settings.mapObj, &mapPtr) != TCL_OK) {
+	Tcl_DStringFree(&ds);
+	return TCL_ERROR;
+    }
+    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
+    if (encoding == NULL) {
+	if (mapPtr) {
+	    ReleaseCustomMap(mapPtr);
+	}
+	Tcl_DStringFree(&ds);
+	return TCL_ERROR;
+    }
+
+    Normalizer *normPtr = (Normalizer *)Tcl_Alloc(sizeof(Normalizer));
+    normPtr->mode = settings.mode;
+    normPtr->options = NormalizationOptions(settings.mode) | settings.flags;
+    normPtr->profile = settings.profile;
+    normPtr->mapPtr = mapPtr;
+    normPtr->encoding = encoding;
+    /* No limit, the memory is kept until the object is destroyed */
+    utf8proc_arena_init(&normPtr->arena, 0);
+
+#ifdef WRAP_COMMANDS
+    normPtr->token = Tcl_CreateObjCommand(interp, Tcl_DStringValue(&ds),
+	NormalizerWrapperObjCmd, normPtr, NormalizerDeleteProc);
+#else
+    normPtr->token = Tcl_CreateObjCommand(interp, Tcl_DStringValue(&ds),
+	NormalizerObjCmd, normPtr, NormalizerDeleteProc);
+#endif
+    Tcl_DStringFree(&ds);
+    Tcl_Obj *nameObj = Tcl_NewObj();
+    Tcl_GetCommandFullName(interp, normPtr->token, nameObj);
+    Tcl_SetObjResult(interp, nameObj);
+    return TCL_OK;
+}
+
+/*
+ * Utf8ErrorKind --
+ *
+ *	Classifies the invalid UTF-8 sequence at the start of the passed
+ *	bytes.
+ *
+ * Results:
+ *	"truncated" for a sequence cut off by the end of the bytes,
+ *	"incomplete" for one followed by a byte that is not a continuation
+ *	byte, "overlong", "surrogate" or "range" for the encoding of a code
+ *	point with more bytes than needed, of a surrogate or of a value above
+ *	U+10FFFF, and "unexpected" for a byte that cannot start a sequence.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static const char *
+Utf8ErrorKind(
+    const unsigned char *bytes,	/* Invalid UTF-8 */
+    Tcl_Size numBytes)		/* Number of bytes, at least 1 */
+{
+    unsigned char lead = bytes[0];
+    Tcl_Size i, length;
+
+    if (lead < 0xC0 || lead > 0xF7) {
+	return "unexpected";
+    }
+    if (lead < 0xC2) {
+	return "overlong";
+    }
+    if (lead > 0xF4) {
+	return "range";
+    }
+    if (numBytes > 1) {
+	unsigned char second = bytes[1];
+	if ((lead == 0xE0 && second >= 0x80 && second < 0xA0)
+		|| (lead == 0xF0 && second >= 0x80 && second < 0x90)) {
+	    return "overlong";
+	}
+	if (lead == 0xED && second >= 0xA0 && second <= 0xBF) {
+	    return "surrogate";
+	}
+	if (lead == 0xF4 && second >= 0x90 && second <= 0xBF) {
+	    return "range";
+	}
+    }
+    length = lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+    for (i = 1; i < length; ++i) {
+	if (i >= numBytes) {
+	    return "truncated";
+	}
+	if ((bytes[i] & 0xC0) != 0x80) {
+	    break;
+	}
+    }
+    return "incomplete";
+}
+
+/*
+ * ValidateChannel --
+ *
+ *	Checks that the data read from a channel until its end is UTF-8,
+ *	reading it in blocks of VALIDATE_BLOCK_SIZE bytes. The bytes are read
+ *	raw, so that neither EOL translation nor the encoding of the channel
+ *	applies. A sequence cut off by the end of a block is carried over to
+ *	the next block.
+ *
+ * Results:
+ *	A standard Tcl result. On success, *offsetPtr is set to the offset of
+ *	the first invalid byte and *kindPtr to its kind as returned by
+ *	Utf8ErrorKind, or *kindPtr to NULL if all the data is valid.
+ *
+ * Side effects:
+ *	The data is read from the channel.
+ */
+
+#define VALIDATE_BLOCK_SIZE (1 << 20)
+
+static int
+ValidateChannel(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Channel chan,		/* Channel to read from */
+    Tcl_WideInt *offsetPtr,	/* Offset of the first invalid byte */
+    const char **kindPtr)	/* Kind of error */
+{
+    /* Room for a carried over sequence of at most 3 bytes */
+    char *buf = (char *)Tcl_Alloc(VALIDATE_BLOCK_SIZE + 3);
+    Tcl_WideInt offset = 0;
+    Tcl_Size carry = 0;
+    int result = TCL_OK;
+
+    *kindPtr = NULL;
+    while (1) {
+	Tcl_Size n = Tcl_ReadRaw(chan, buf + carry, VALIDATE_BLOCK_SIZE);
+	Tcl_Size length, valid;
+	int eof;
+	if (n < 0) {
+	    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"error reading \"%s\": %s", Tcl_GetChannelName(chan),
+		Tcl_PosixError(interp)));
+	    result = TCL_ERROR;
+	    break;
+	}
+	if (n == 0 && !Tcl_Eof(chan) && Tcl_InputBlocked(chan)) {
+	    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"channel \"%s\" is not blocking", Tcl_GetChannelName(chan)));
+	    result = TCL_ERROR;
+	    break;
+	}
+	eof = Tcl_Eof(chan);
+	length = carry + n;
+	valid = utf8proc_valid_length((const utf8proc_uint8_t *)buf, length);
+	if (valid < length) {
+	    const char *kind = Utf8ErrorKind(
+		(const unsigned char *)buf + valid, length - valid);
+	    if (!eof && !strcmp(kind, "truncated")) {
+		carry = length - valid;
+		memmove(buf, buf + valid, (size_t) carry);
+	    } else {
+		*offsetPtr = offset + valid;
+		*kindPtr = kind;
+		break;
+	    }
+	} else {
+	    carry = 0;
+	}
+	offset += valid;
+	if (eof) {
+	    break;
+	}
+    }
+    Tcl_Free(buf);
+    return result;
+}
+
+/*
+ * Tcl_UnicodeValidateObjCmd --
+ *
+ *	Implements the "validate" command checking that a byte array, the
+ *	data read from a channel or a string is well-formed UTF-8.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to 1 if the data is valid and otherwise
+ *	to a pair of the offset of the first error, in bytes or for a string
+ *	in characters, and of its kind. With -channel, the channel is read to
+ *	its end or to the first error.
+ */
+
+static int
+Tcl_UnicodeValidateObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *optNames[] = {"-binary", "-channel", NULL};
+    enum { OPT_BINARY, OPT_CHANNEL } opt;
+    int i, binary = 0, channel = 0;
+    Tcl_WideInt offset = 0;
+    const char *kind = NULL;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-binary? ?-channel? DATA");
+	return TCL_ERROR;
+    }
+    for (i = 1; i < objc - 1; ++i) {
+	if (Tcl_GetIndexFromObj(
+		interp, objv[i], optNames, "option", 0, &opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case OPT_BINARY:
+	    binary = 1;
+	    break;
+	case OPT_CHANNEL:
+	    channel = 1;
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+
+    if (channel) {
+	int mode;
+	Tcl_Channel chan = Tcl_GetChannel(
+	    interp, Tcl_GetString(objv[objc - 1]), &mode);
+	if (chan == NULL) {
+	    return TCL_ERROR;
+	}
+	if (!(mode & TCL_READABLE)) {
+	    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"channel \"%s\" wasn't opened for reading",
+		Tcl_GetString(objv[objc - 1])));
+	    return TCL_ERROR;
+	}
+	if (ValidateChannel(interp, chan, &offset, &kind) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+    } else if (binary) {
+	Tcl_Size numBytes;
+	const unsigned char *bytes = Tcl_GetBytesFromObj(
+	    interp, objv[objc - 1], &numBytes);
+	Tcl_Size valid;
+	if (bytes == NULL) {
+	    return TCL_ERROR;
+	}
+	valid = utf8proc_valid_length(bytes, numBytes);
+	if (valid < numBytes) {
+	    offset = valid;
+	    kind = Utf8ErrorKind(bytes + valid, numBytes - valid);
+	}
+    } else {
+	/*
+	 * A string is valid unless it holds a surrogate, which is the only
+	 * character that has no UTF-8 encoding.
+	 */
+	Tcl_Size numBytes, index = 0;
+	const char *src = Tcl_GetStringFromObj(objv[objc - 1], &numBytes);
+	const char *end = src + numBytes;
+	while (src < end) {
+	    Tcl_UniChar ch = 0;
+	    if (!(*src & 0x80)) {
+		++src;
+		++index;
+		continue;
+	    }
+	    src += Tcl_UtfToUniChar(src, &ch);
+	    if (ch >= 0xD800 && ch <= 0xDFFF) {
+		offset = index;
+		kind = "surrogate";
+		break;
+	    }
+	    ++index;
+	}
+    }
+
+    if (kind == NULL) {
+	Tcl_SetObjResult(interp, Tcl_NewBooleanObj(1));
+    } else {
+	Tcl_Obj *elems[2];
+	elems[0] = Tcl_NewWideIntObj(offset);
+	elems[1] = Tcl_NewStringObj(kind, -1);
+	Tcl_SetObjResult(interp, Tcl_NewListObj(2, elems));
+    }
+    return TCL_OK;
+}
+
+/*
+ * Tcl_UnicodeCategorizeObjCmd --
+ *
+ *	 Implements the "categorize" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to a list of Unicode categories.
+ */
+
+static int
+Tcl_UnicodeCategorizeObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "STRING");
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *categoryObjs[31]; /* 30 categories + one for out of range */
+    for (int i = 0; i < sizeof(categoryObjs)/sizeof(categoryObjs[0]); ++i) {
+        categoryObjs[i] = NULL;
+    }
+
+    Tcl_Obj *srcObj = objv[1];
+    Tcl_Size len = Tcl_GetCharLength(srcObj);
+    Tcl_Obj *resultList = Tcl_NewListObj(len, NULL);
+    for (int i = 0; i < len; ++i) {
+        Tcl_UniChar uc = Tcl_GetUniChar(srcObj, i);
+        utf8proc_category_t category;
+        if (uc < 0 || uc > 0x10FFFF) {
+            category = 30;
+            if (categoryObjs[30] == NULL) {
+                categoryObjs[30] = Tcl_NewStringObj("??", -1);
+            }
+        } else {
+            category = utf8proc_category(uc);
+            if (categoryObjs[category] == NULL) {
+                categoryObjs[category] =
+                    Tcl_NewStringObj(utf8proc_category_string(category), -1);
+            }
+        }
+        Tcl_ListObjAppendElement(interp, resultList, categoryObjs[category]);
+    }
+    for (int i = 0; i < sizeof(categoryObjs)/sizeof(categoryObjs[0]); ++i) {
+        if (categoryObjs[i] != NULL) {
+	    Tcl_BounceRefCount(categoryObjs[i]);
+	}
+    }
+    Tcl_SetObjResult(interp, resultList);
+    return TCL_OK;
+}
+
+/*
+ * Segment normalizer.
+ *
+ * Normalizes a stream of code points one segment at a time without
+ * materializing the normalized form of the whole string. A segment starts at
+ * a code point that normalization can never reorder with, or compose into,
+ * anything preceding it. Every code point in the output of a segment is
+ * attributed to the range of source character indices of its unit, a
+ * starter with the non-starters that follow it, or to those of the starters
+ * composed together into it, which is what allows mapping normalized offsets
+ * back to the source.
+ */
+
+#define SEGMENT_STATIC_SIZE 64
+
+/* Called for each normalized code point. Returns 0 to continue, 1 to stop. */
+typedef int (SegmentEmitProc)(void *clientData, utf8proc_int32_t cp,
+			      Tcl_Size srcFirst, Tcl_Size srcLast);
+
+typedef struct SegmentNormalizer {
+    utf8proc_option_t options;	/* Normalization options */
+    SegmentEmitProc *emitProc;	/* Receives normalized output */
+    void *clientData;		/* Passed to emitProc */
+    utf8proc_int32_t *buf;	/* Code points in current segment */
+    Tcl_Size *srcBuf;		/* Source index of each code point in buf */
+    utf8proc_ssize_t *posBuf;	/* Position in buf before normalization of
+				 * each normalized code point */
+    Tcl_Size len;		/* Number of code points in buf */
+    Tcl_Size size;		/* Capacity of buf, srcBuf and posBuf */
+    utf8proc_int32_t staticBuf[SEGMENT_STATIC_SIZE];
+    Tcl_Size staticSrcBuf[SEGMENT_STATIC_SIZE];
+    utf8proc_ssize_t staticPosBuf[SEGMENT_STATIC_SIZE];
+} SegmentNormalizer;
+
+static void
+SegmentNormalizerInit(
+    SegmentNormalizer *segPtr,	/* Normalizer to initialize */
+    utf8proc_option_t options,	/* Normalization options */
+    SegmentEmitProc *emitProc,	/* Output callback */
+    void *clientData)		/* Passed to emitProc */
+{
+    segPtr->options = options;
+    segPtr->emitProc = emitProc;
+    segPtr->clientData = clientData;
+    segPtr->buf = segPtr->staticBuf;
+    segPtr->srcBuf = segPtr->staticSrcBuf;
+    segPtr->posBuf = segPtr->staticPosBuf;
+    segPtr->len = 0;
+    segPtr->size = SEGMENT_STATIC_SIZE;
+}
+
+static void
+SegmentNormalizerFree(
+    SegmentNormalizer *segPtr)	/* Normalizer to clean up */
+{
+    if (segPtr->buf != segPtr->staticBuf) {
+	Tcl_Free(segPtr->buf);
+	Tcl_Free(segPtr->srcBuf);
+	Tcl_Free(segPtr->posBuf);
+    }
+    segPtr->buf = segPtr->staticBuf;
+    segPtr->srcBuf = segPtr->staticSrcBuf;
+    segPtr->posBuf = segPtr->staticPosBuf;
+    segPtr->len = 0;
+    segPtr->size = SEGMENT_STATIC_SIZE;
+}
+
+/*
+ * SegmentNormalizerGrow --
+ *
+ *	Doubles the capacity of the buffers of a segment normalizer.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The buffers are reallocated, keeping the pending segment.
+ */
+
+static void
+SegmentNormalizerGrow(
+    SegmentNormalizer *segPtr)	/* Normalizer with full buffers */
+{
+    Tcl_Size newSize = 2 * segPtr->size;
+    if (segPtr->buf == segPtr->staticBuf) {
+	segPtr->buf = (utf8proc_int32_t *)Tcl_Alloc(
+	    newSize * sizeof(utf8proc_int32_t));
+	memcpy(segPtr->buf, segPtr->staticBuf,
+	       segPtr->len * sizeof(utf8proc_int32_t));
+	segPtr->srcBuf = (Tcl_Size *)Tcl_Alloc(newSize * sizeof(Tcl_Size));
+	memcpy(segPtr->srcBuf, segPtr->staticSrcBuf,
+	       segPtr->len * sizeof(Tcl_Size));
+	segPtr->posBuf = (utf8proc_ssize_t *)Tcl_Alloc(
+	    newSize * sizeof(utf8proc_ssize_t));
+    } else {
+	segPtr->buf = (utf8proc_int32_t *)Tcl_Realloc(
+	    segPtr->buf, newSize * sizeof(utf8proc_int32_t));
+	segPtr->srcBuf = (Tcl_Size *)Tcl_Realloc(
+	    segPtr->srcBuf, newSize * sizeof(Tcl_Size));
+	segPtr->posBuf = (utf8proc_ssize_t *)Tcl_Realloc(
+	    segPtr->posBuf, newSize * sizeof(utf8proc_ssize_t));
+    }
+    segPtr->size = newSize;
+}
+
+/*
+ * SegmentIsBoundary --
+ *
+ *	Checks if a segment boundary may be placed before a decomposed code
+ *	point. Non-starters are always reordered with what precedes them. When
+ *	composing, starters that may be the second character of a composition
+ *	(including Hangul vowel and trailing jamo) also stay with the segment.
+ *
+ * Results:
+ *	Non-zero if a new segment may start at cp.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static int
+SegmentIsBoundary(
+    utf8proc_int32_t cp,	/* Decomposed code point */
+    utf8proc_option_t options)	/* Normalization options */
+{
+    const utf8proc_property_t *propPtr = utf8proc_get_property(cp);
+    if (propPtr->combining_class != 0) {
+	return 0;
+    }
+    if (options & UTF8PROC_COMPOSE) {
+	if (propPtr->comb_issecond) {
+	    return 0;
+	}
+	if ((cp >= 0x1161 && cp <= 0x1175) || (cp >= 0x11A8 && cp <= 0x11C2)) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/*
+ * SegmentNormalizerFlush --
+ *
+ *	Normalizes the pending segment and passes the result to the emit
+ *	callback. Canonical ordering only moves non-starters after the
+ *	starter they follow and composition only merges starters, so each
+ *	normalized starter and the non-starters up to the next one come from
+ *	the source characters between the positions in buf of their starter
+ *	and the next one.
+ *
+ * Results:
+ *	0 to continue, 1 if the callback asked to stop.
+ *
+ * Side effects:
+ *	The segment buffer is emptied.
+ */
+
+static int
+SegmentNormalizerFlush(
+    SegmentNormalizer *segPtr)	/* Normalizer with pending segment */
+{
+    utf8proc_int32_t *buf = segPtr->buf;
+    const Tcl_Size *srcBuf = segPtr->srcBuf;
+    utf8proc_ssize_t *posBuf = segPtr->posBuf;
+    Tcl_Size srcLen = segPtr->len, len = srcLen;
+    Tcl_Size i, unitFirst = 0, unitEnd = 0;
+
+    if (len == 0) {
+	return 0;
+    }
+    segPtr->len = 0;
+
+    for (i = 0; i < len; ++i) {
+	posBuf[i] = i;
+    }
+    /* Canonical ordering, in linear time however long the segment */
+    utf8proc_canonical_reorder(buf, len);
+    if (segPtr->options & UTF8PROC_COMPOSE) {
+	len = utf8proc_normalize_utf32_srcmap(buf, len, segPtr->options,
+					      posBuf);
+    }
+    for (i = 0; i < len; ++i) {
+	if (i == 0 ||
+		utf8proc_get_property(buf[i])->combining_class == 0) {
+	    /* A new unit, up to the next starter */
+	    unitEnd = i + 1;
+	    while (unitEnd < len &&
+		    utf8proc_get_property(buf[unitEnd])->combining_class != 0) {
+		unitEnd++;
+	    }
+	    if (i > 0) {
+		unitFirst = posBuf[i];
+	    }
+	}
+	if (segPtr->emitProc(segPtr->clientData, buf[i], srcBuf[unitFirst],
+		srcBuf[(unitEnd < len ? posBuf[unitEnd] : srcLen) - 1])) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * SegmentNormalizerAdd --
+ *
+ *	Adds a source character to the normalizer, flushing the pending
+ *	segment as boundaries are encountered.
+ *
+ * Results:
+ *	0 to continue, 1 if the emit callback asked to stop, or a negative
+ *	utf8proc error code.
+ *
+ * Side effects:
+ *	The emit callback may be invoked.
+ */
+
+static int
+SegmentNormalizerAdd(
+    SegmentNormalizer *segPtr,	/* Normalizer */
+    utf8proc_int32_t uc,	/* Source character */
+    Tcl_Size srcIndex)		/* Index of uc in the source */
+{
+    utf8proc_int32_t decomposed[32];
+    utf8proc_int32_t *dPtr = decomposed;
+    int boundclass = UTF8PROC_BOUNDCLASS_START;
+    utf8proc_ssize_t i, n;
+
+    n = utf8proc_decompose_char(uc, decomposed,
+				sizeof(decomposed) / sizeof(decomposed[0]),
+				segPtr->options, &boundclass);
+    if (n < 0) {
+	return (int)n;
+    }
+    if (n > (utf8proc_ssize_t)(sizeof(decomposed) / sizeof(decomposed[0]))) {
+	dPtr = (utf8proc_int32_t *)Tcl_Alloc(n * sizeof(utf8proc_int32_t));
+	utf8proc_decompose_char(uc, dPtr, n, segPtr->options, &boundclass);
+    }
+    for (i = 0; i < n; ++i) {
+	if (segPtr->len > 0 && SegmentIsBoundary(dPtr[i], segPtr->options)) {
+	    if (SegmentNormalizerFlush(segPtr)) {
+		if (dPtr != decomposed) {
+		    Tcl_Free(dPtr);
+		}
+		return 1;
+	    }
+	}
+	if (segPtr->len == segPtr->size) {
+	    SegmentNormalizerGrow(segPtr);
+	}
+	segPtr->srcBuf[segPtr->len] = srcIndex;
+	segPtr->buf[segPtr->len++] = dPtr[i];
+    }
+    if (dPtr != decomposed) {
+	Tcl_Free(dPtr);
+    }
+    return 0;
+}
+
+/*
+ * SegmentNormalizeObj --
+ *
+ *	Runs the characters of a Tcl string through a segment normalizer.
+ *	Characters are read directly from the Tcl string representation so
+ *	no copy of the source is made.
+ *
+ * Results:
+ *	0 on completion, 1 if the emit callback asked to stop, or a negative
+ *	utf8proc error code.
+ *
+ * Side effects:
+ *	The emit callback is invoked for each normalized code point.
+ */
+
+static int
+SegmentNormalizeObj(
+    SegmentNormalizer *segPtr,	/* Normalizer */
+    Tcl_Obj *objPtr)		/* Source string */
+{
+    Tcl_Size numBytes;
+    const char *src = Tcl_GetStringFromObj(objPtr, &numBytes);
+    const char *end = src + numBytes;
+    Tcl_Size srcIndex = 0;
+    int ret;
+
+    while (src < end) {
+	Tcl_UniChar ch = 0;
+	src += Tcl_UtfToUniChar(src, &ch);
+	ret = SegmentNormalizerAdd(segPtr, (utf8proc_int32_t)ch, srcIndex++);
+	if (ret != 0) {
+	    return ret;
+	}
+    }
+    return SegmentNormalizerFlush(segPtr);
+}
+
+/*
+ * Search state. Matching is done with Knuth-Morris-Pratt over the normalized
+ * code points so the haystack is consumed strictly left to right. Matches
+ * are only reported if they start and end on boundaries between source
+ * characters, and neither start nor are followed by a combining mark.
+ */
+typedef struct SearchState {
+    const utf8proc_int32_t *needle; /* Normalized needle */
+    Tcl_Size needleLen;		/* Number of code points in needle */
+    const Tcl_Size *failure;	/* KMP failure function for needle */
+    Tcl_Size *srcFirsts;	/* Ring buffer of source start index of the
+				 * last needleLen normalized code points, or
+				 * -1 for those a match may not start at */
+    Tcl_Size outPos;		/* Count of normalized code points seen */
+    Tcl_Size prevSrcLast;	/* Source end index of the previous
+				 * normalized code point, or -1 */
+    Tcl_Size matched;		/* Number of needle code points matched */
+    int pending;		/* A match is awaiting the next code point */
+    Tcl_Size pendingFirst;	/* Source range of the pending match */
+    Tcl_Size pendingLast;
+    int all;			/* Whether to collect all matches */
+    Tcl_Obj *resultObj;		/* List of matches */
+} SearchState;
+
+/*
+ * SearchAcceptPending --
+ *
+ *	Adds the pending match to the result.
+ *
+ * Results:
+ *	1 if searching should stop, 0 otherwise.
+ *
+ * Side effects:
+ *	Appends to the result list.
+ */
+
+static int
+SearchAcceptPending(
+    SearchState *statePtr)
+{
+    Tcl_Obj *range[2];
+    range[0] = Tcl_NewWideIntObj(statePtr->pendingFirst);
+    range[1] = Tcl_NewWideIntObj(statePtr->pendingLast);
+    statePtr->pending = 0;
+    if (statePtr->all) {
+	Tcl_ListObjAppendElement(NULL, statePtr->resultObj,
+				 Tcl_NewListObj(2, range));
+	return 0;
+    }
+    Tcl_ListObjReplace(NULL, statePtr->resultObj, 0, 0, 2, range);
+    return 1;
+}
+
+static int
+SearchEmitProc(
+    void *clientData,		/* SearchState */
+    utf8proc_int32_t cp,	/* Normalized haystack code point */
+    Tcl_Size srcFirst,		/* Source range cp is attributed to */
+    Tcl_Size srcLast)
+{
+    SearchState *statePtr = (SearchState *)clientData;
+    Tcl_Size q = statePtr->matched;
+    int isStarter = utf8proc_get_property(cp)->combining_class == 0;
+
+    if (statePtr->pending) {
+	/*
+	 * A match followed by a combining mark would split a base character
+	 * from its marks, and one followed by more of the decomposition of
+	 * its last source character would split that character. Neither is
+	 * reported.
+	 */
+	if (isStarter && srcFirst > statePtr->pendingLast) {
+	    if (SearchAcceptPending(statePtr)) {
+		return 1;
+	    }
+	    q = 0; /* Matches do not overlap */
+	} else {
+	    statePtr->pending = 0;
+	}
+    }
+
+    while (q > 0 && statePtr->needle[q] != cp) {
+	q = statePtr->failure[q - 1];
+    }
+    if (statePtr->needle[q] == cp) {
+	q++;
+    }
+    /*
+     * A match may only start on a starter that begins its source character,
+     * not on a combining mark or within the decomposition of a character.
+     */
+    statePtr->srcFirsts[statePtr->outPos % statePtr->needleLen] =
+	    (isStarter && srcFirst > statePtr->prevSrcLast) ? srcFirst : -1;
+    statePtr->outPos++;
+    statePtr->prevSrcLast = srcLast;
+    if (q == statePtr->needleLen) {
+	Tcl_Size first =
+	    statePtr->srcFirsts[statePtr->outPos % statePtr->needleLen];
+	if (first >= 0) {
+	    statePtr->pending = 1;
+	    statePtr->pendingFirst = first;
+	    statePtr->pendingLast = srcLast;
+	}
+	q = statePtr->failure[q - 1];
+    }
+    statePtr->matched = q;
+    return 0;
+}
+
+/* Collects the normalized needle */
+static int
+SearchNeedleEmitProc(
+    void *clientData,		/* Tcl_DString accumulating code points */
+    utf8proc_int32_t cp,	/* Normalized needle code point */
+    Tcl_Size srcFirst,		/* Not used */
+    Tcl_Size srcLast)		/* Not used */
+{
+    Tcl_DStringAppend((Tcl_DString *)clientData, (const char *)&cp,
+		      sizeof(cp));
+    return 0;
+}
+
+/*
+ * Tcl_UnicodeSearchObjCmd --
+ *
+ *	Implements the "search" command. Searches for a string within another
+ *	after normalizing both, reporting match positions as character indices
+ *	in the original (unnormalized) haystack.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the first and last index of the first
+ *	match, an empty list if there is none, or with -all, a list of
+ *	such index pairs.
+ */
+
+static int
+Tcl_UnicodeSearchObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *optNames[] = {"-all", "-mode", NULL};
+    enum { OPT_ALL, OPT_MODE } opt;
+    NormalizationMode mode = MODE_NFC;
+    SearchState state;
+    SegmentNormalizer seg;
+    Tcl_DString needleDs;
+    Tcl_Size *failure;
+    utf8proc_option_t options;
+    int i, ret;
+
+    if (objc < 3) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-mode MODE? ?-all? NEEDLE HAYSTACK");
+	return TCL_ERROR;
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.prevSrcLast = -1;
+    for (i = 1; i < objc - 2; ++i) {
+	if (Tcl_GetIndexFromObj(
+		interp, objv[i], optNames, "option", 0, &opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case OPT_ALL:
+	    state.all = 1;
+	    break;
+	case OPT_MODE:
+	    if (++i == (objc - 2)) {
+		Tcl_SetObjResult(interp,
+				 Tcl_ObjPrintf("Missing value for option %s.",
+					       Tcl_GetString(objv[i - 1])));
+		return TCL_ERROR;
+	    }
+	    if (Tcl_GetIndexFromObj(interp, objv[i], normalizationForms,
+				    "normalization mode", 0, &mode) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+    options = NormalizationOptions(mode);
+
+    /* Normalize the needle once, using the same segmenting as the haystack */
+    Tcl_DStringInit(&needleDs);
+    SegmentNormalizerInit(&seg, options, SearchNeedleEmitProc, &needleDs);
+    ret = SegmentNormalizeObj(&seg, objv[objc - 2]);
+    SegmentNormalizerFree(&seg);
+    if (ret < 0) {
+	Tcl_DStringFree(&needleDs);
+	Tcl_SetObjResult(interp,
+			 Tcl_NewStringObj(utf8proc_errmsg(ret), -1));
+	return TCL_ERROR;
+    }
+    state.needle = (const utf8proc_int32_t *)Tcl_DStringValue(&needleDs);
+    state.needleLen = Tcl_DStringLength(&needleDs) / sizeof(utf8proc_int32_t);
+    state.resultObj = Tcl_NewListObj(0, NULL);
+    if (state.needleLen == 0) {
+	Tcl_DStringFree(&needleDs);
+	Tcl_SetObjResult(interp, state.resultObj);
+	return TCL_OK;
+    }
+
+    /* KMP failure function */
+    failure = (Tcl_Size *)Tcl_Alloc(2 * state.needleLen * sizeof(Tcl_Size));
+    failure[0] = 0;
+    for (Tcl_Size q = 1, k = 0; q < state.needleLen; ++q) {
+	while (k > 0 && state.needle[k] != state.needle[q]) {
+	    k = failure[k - 1];
+	}
+	if (state.needle[k] == state.needle[q]) {
+	    k++;
+	}
+	failure[q] = k;
+    }
+    state.failure = failure;
+    state.srcFirsts = failure + state.needleLen;
+
+    SegmentNormalizerInit(&seg, options, SearchEmitProc, &state);
+    ret = SegmentNormalizeObj(&seg, objv[objc - 1]);
+    SegmentNormalizerFree(&seg);
+    if (ret == 0 && state.pending) {
+	SearchAcceptPending(&state); /* Match at end of haystack */
+    }
+
+    Tcl_Free(failure);
+    Tcl_DStringFree(&needleDs);
+    if (ret < 0) {
+	Tcl_BounceRefCount(state.resultObj);
+	Tcl_SetObjResult(interp,
+			 Tcl_NewStringObj(utf8proc_errmsg(ret), -1));
+	return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, state.resultObj);
+    return TCL_OK;
+}
+
+/*
+ * SkeletonOfObj --
+ *
+ *	Computes the UTS #39 confusable skeleton of the string in objPtr.
+ *	dsPtr is used as scratch space for the conversion to standard UTF-8
+ *	and must be freed by the caller.
+ *
+ * Results:
+ *	A standard Tcl result. On success, *skeletonPtr points to the
+ *	skeleton in standard UTF-8 and *lengthPtr holds its length. The
+ *	skeleton is kept in the arena of the thread and remains valid until
+ *	its next use.
+ *
+ * Side effects:
+ *	Sets the interpreter result on error.
+ */
+
+static int
+SkeletonOfObj(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Encoding encoding,	/* utf-8 encoding */
+    Tcl_Obj *objPtr,		/* String to compute skeleton of */
+    Tcl_DString *dsPtr,		/* Scratch space */
+    const utf8proc_uint8_t **skeletonPtr, /* Output skeleton */
+    utf8proc_ssize_t *lengthPtr)    /* Output skeleton length */
+{
+    if (Tcl_UtfToExternalDStringEx(interp, encoding, Tcl_GetString(objPtr),
+            -1, TCL_ENCODING_PROFILE_STRICT, dsPtr, NULL) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    utf8proc_ssize_t length = utf8proc_skeleton_arena(
+        (const utf8proc_uint8_t *)Tcl_DStringValue(dsPtr),
+        Tcl_DStringLength(dsPtr), skeletonPtr, GetThreadArena());
+    if (length < 0) {
+        Tcl_SetObjResult(interp,
+                         Tcl_NewStringObj(utf8proc_errmsg(length), -1));
+        return TCL_ERROR;
+    }
+    *lengthPtr = length;
+    return TCL_OK;
+}
+
+/*
+ * Tcl_UnicodeSkeletonObjCmd --
+ *
+ *	Implements the "skeleton" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the UTS #39 confusable skeleton of
+ *	the passed string.
+ */
+
+static int
+Tcl_UnicodeSkeletonObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    if (objc != 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "STRING");
+	return TCL_ERROR;
+    }
+
+    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
+    if (encoding == NULL) {
+        return TCL_ERROR;
+    }
+
+    Tcl_DString ds;
+    const utf8proc_uint8_t *skeleton;
+    utf8proc_ssize_t length;
+    int result = SkeletonOfObj(interp, encoding, objv[1], &ds, &skeleton, &length);
+    Tcl_DStringFree(&ds);
+    if (result == TCL_OK) {
+        result = Tcl_ExternalToUtfDStringEx(interp, encoding,
+            (const char *)skeleton, length, TCL_ENCODING_PROFILE_STRICT, &ds, NULL);
+        if (result == TCL_OK) {
+            Tcl_DStringResult(interp, &ds);
+        }
+        Tcl_DStringFree(&ds);
+    }
+    Tcl_FreeEncoding(encoding);
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * Tcl_UnicodeConfusableObjCmd --
+ *
+ *	Implements the "confusable" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to 1 if the two passed strings have the
+ *	same UTS #39 confusable skeleton and 0 otherwise.
+ */
+
+static int
+Tcl_UnicodeConfusableObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    if (objc != 3) {
+	Tcl_WrongNumArgs(interp, 1, objv, "STRING1 STRING2");
+	return TCL_ERROR;
+    }
+
+    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
+    if (encoding == NULL) {
+        return TCL_ERROR;
+    }
+
+    /*
+     * Both skeletons are computed in the arena of the thread, so the first
+     * is copied aside before computing the second.
+     */
+
+    Tcl_DString ds, first;
+    const utf8proc_uint8_t *skeleton;
+    utf8proc_ssize_t length;
+    Tcl_DStringInit(&first);
+    int result = SkeletonOfObj(interp, encoding, objv[1], &ds, &skeleton, &length);
+    Tcl_DStringFree(&ds);
+    if (result == TCL_OK) {
+        Tcl_DStringAppend(&first, (const char *)skeleton, length);
+        result = SkeletonOfObj(interp, encoding, objv[2], &ds, &skeleton, &length);
+        Tcl_DStringFree(&ds);
+        if (result == TCL_OK) {
+            Tcl_SetObjResult(interp, Tcl_NewBooleanObj(
+                length == Tcl_DStringLength(&first) &&
+                !memcmp(skeleton, Tcl_DStringValue(&first), length)));
+        }
+    }
+    Tcl_DStringFree(&first);
+    Tcl_FreeEncoding(encoding);
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * Signature of the utf8proc functions returning the offset of the next
+ * boundary of some kind following the boundary at offset pos.
+ */
+typedef utf8proc_ssize_t (BreakNextProc)(const utf8proc_uint8_t *str,
+	utf8proc_ssize_t strlen, utf8proc_ssize_t pos);
+
+/*
+ * Signature of filters selecting the segments returned by SegmentObj.
+ */
+typedef int (SegmentFilterProc)(const utf8proc_uint8_t *str,
+	utf8proc_ssize_t len);
+
+/*
+ * SegmentObj --
+ *
+ *	Splits a string into segments at the boundaries returned by
+ *	nextProc in a single pass.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to a list of the segments for which
+ *	filterProc, if not NULL, returns true. If wantOffsets is true, each
+ *	element is instead the pair of indices of the first and last
+ *	characters of the segment.
+ */
+
+static int
+SegmentObj(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Obj *objPtr,		/* String to split */
+    BreakNextProc *nextProc,	/* Boundary iterator */
+    SegmentFilterProc *filterProc, /* Segment filter or NULL */
+    int wantOffsets)		/* Return offsets instead of segments */
+{
+    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
+    if (encoding == NULL) {
+        return TCL_ERROR;
+    }
+
+    Tcl_DString ds;
+    int result = Tcl_UtfToExternalDStringEx(interp, encoding,
+        Tcl_GetString(objPtr), -1, TCL_ENCODING_PROFILE_STRICT, &ds, NULL);
+    if (result == TCL_OK) {
+        const utf8proc_uint8_t *str = (utf8proc_uint8_t *)Tcl_DStringValue(&ds);
+        utf8proc_ssize_t len = Tcl_DStringLength(&ds);
+        utf8proc_ssize_t pos = 0, next, i;
+        Tcl_Size first = 0, numChars;
+        Tcl_Obj *resultObj = Tcl_NewListObj(0, NULL);
+
+        while (pos < len) {
+            next = nextProc(str, len, pos);
+            if (next < 0) {
+                Tcl_BounceRefCount(resultObj);
+                Tcl_SetObjResult(interp,
+                                 Tcl_NewStringObj(utf8proc_errmsg(next), -1));
+                result = TCL_ERROR;
+                break;
+            }
+            /* Character indices are those of the codepoints */
+            for (i = pos, numChars = 0; i < next; i++) {
+                if ((str[i] & 0xC0) != 0x80) {
+                    numChars++;
+                }
+            }
+            if (filterProc == NULL || filterProc(str + pos, next - pos)) {
+                if (wantOffsets) {
+                    Tcl_Obj *elems[2];
+                    elems[0] = Tcl_NewWideIntObj(first);
+                    elems[1] = Tcl_NewWideIntObj(first + numChars - 1);
+                    Tcl_ListObjAppendElement(NULL, resultObj,
+                                             Tcl_NewListObj(2, elems));
+                } else {
+                    Tcl_ListObjAppendElement(NULL, resultObj,
+                        Tcl_GetRange(objPtr, first, first + numChars - 1));
+                }
+            }
+            first += numChars;
+            pos = next;
+        }
+        if (result == TCL_OK) {
+            Tcl_SetObjResult(interp, resultObj);
+        }
+    }
+    Tcl_DStringFree(&ds);
+    Tcl_FreeEncoding(encoding);
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * IsWordSegment --
+ *
+ *	Segment filter selecting word segments.
+ *
+ * Results:
+ *	Returns 1 if the segment contains a letter or number, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static int
+IsWordSegment(
+    const utf8proc_uint8_t *str,	/* Segment */
+    utf8proc_ssize_t len)		/* Length of segment in bytes */
+{
+    utf8proc_ssize_t pos = 0;
+    utf8proc_int32_t cp;
+    while (pos < len) {
+        pos += utf8proc_iterate(str + pos, len - pos, &cp);
+        switch (utf8proc_category(cp)) {
+        case UTF8PROC_CATEGORY_LU:
+        case UTF8PROC_CATEGORY_LL:
+        case UTF8PROC_CATEGORY_LT:
+        case UTF8PROC_CATEGORY_LM:
+        case UTF8PROC_CATEGORY_LO:
+        case UTF8PROC_CATEGORY_ND:
+        case UTF8PROC_CATEGORY_NL:
+        case UTF8PROC_CATEGORY_NO:
+            return 1;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Tcl_UnicodeWordsObjCmd --
+ *
+ *	Implements the "words" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the list of words in the passed
+ *	string, or their offsets, as delimited by UAX #29 word boundaries.
+ */
+
+static int
+Tcl_UnicodeWordsObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *optNames[] = {"-all", "-offsets", NULL};
+    enum { OPT_ALL, OPT_OFFSETS } opt;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-all? ?-offsets? STRING");
+	return TCL_ERROR;
+    }
+
+    int i;
+    int all = 0, wantOffsets = 0;
+    for (i = 1; i < objc - 1; ++i) {
+	if (Tcl_GetIndexFromObj(
+		interp, objv[i], optNames, "option", 0, &opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case OPT_ALL:
+	    all = 1;
+	    break;
+	case OPT_OFFSETS:
+	    wantOffsets = 1;
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+
+    return SegmentObj(interp, objv[objc - 1], utf8proc_word_break_next,
+                      all ? NULL : IsWordSegment, wantOffsets);
+}
+
+/*
+ * Tcl_UnicodeSentencesObjCmd --
+ *
+ *	Implements the "sentences" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the list of sentences in the passed
+ *	string, or their offsets, as delimited by UAX #29 sentence
+ *	boundaries.
+ */
+
+static int
+Tcl_UnicodeSentencesObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *optNames[] = {"-offsets", NULL};
+    enum { OPT_OFFSETS } opt;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-offsets? STRING");
+	return TCL_ERROR;
+    }
+
+    int i;
+    int wantOffsets = 0;
+    for (i = 1; i < objc - 1; ++i) {
+	if (Tcl_GetIndexFromObj(
+		interp, objv[i], optNames, "option", 0, &opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case OPT_OFFSETS:
+	    wantOffsets = 1;
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+
+    return SegmentObj(interp, objv[objc - 1], utf8proc_sentence_break_next,
+                      NULL, wantOffsets);
+}
+
+/*
+ * Tcl_UnicodeWrapObjCmd --
+ *
+ *	Implements the "wrap" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the list of lines obtained by breaking
+ *	the passed string at UAX #14 line break opportunities so that no line
+ *	is wider than the given number of columns. Widths are those of
+ *	utf8proc_charwidth, trailing spaces do not count and are dropped, as
+ *	are line terminators. Segments wider than a line are broken between
+ *	grapheme clusters.
+ */
+
+static int
+Tcl_UnicodeWrapObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    Tcl_WideInt columns;
+
+    if (objc != 3) {
+	Tcl_WrongNumArgs(interp, 1, objv, "STRING COLUMNS");
+	return TCL_ERROR;
+    }
+    if (Tcl_GetWideIntFromObj(interp, objv[2], &columns) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (columns < 1) {
+	Tcl_SetObjResult(interp,
+			 Tcl_ObjPrintf("Invalid column count %s.",
+				       Tcl_GetString(objv[2])));
+	return TCL_ERROR;
+    }
+
+    Tcl_Encoding encoding = Tcl_GetEncoding(interp, "utf-8");
+    if (encoding == NULL) {
+        return TCL_ERROR;
+    }
+
+    Tcl_DString ds;
+    int result = Tcl_UtfToExternalDStringEx(interp, encoding,
+        Tcl_GetString(objv[1]), -1, TCL_ENCODING_PROFILE_STRICT, &ds, NULL);
+    if (result == TCL_OK) {
+        const utf8proc_uint8_t *str = (utf8proc_uint8_t *)Tcl_DStringValue(&ds);
+        utf8proc_ssize_t len = Tcl_DStringLength(&ds);
+        utf8proc_ssize_t pos = 0, next, i, n;
+        utf8proc_int32_t cp, prevCp, state = 0;
+        utf8proc_bool mandatory;
+        Tcl_Size first = 0, index, lineFirst = 0, lineEnd = 0;
+        Tcl_Size numChars, contentChars;
+        Tcl_WideInt width, contentWidth, lineWidth = 0;
+        int lineUsed = 0;
+        Tcl_Obj *resultObj = Tcl_NewListObj(0, NULL);
+
+        while (pos < len) {
+            next = utf8proc_line_break_next(str, len, pos, &mandatory);
+            if (next < 0) {
+                Tcl_BounceRefCount(resultObj);
+                Tcl_SetObjResult(interp,
+                                 Tcl_NewStringObj(utf8proc_errmsg(next), -1));
+                result = TCL_ERROR;
+                break;
+            }
+            /*
+             * Measure the segment, up to its trailing spaces and line
+             * terminator, which hang past the end of the line.
+             */
+            numChars = contentChars = 0;
+            width = contentWidth = 0;
+            for (i = pos; i < next; i += n) {
+                n = utf8proc_iterate(str + i, next - i, &cp);
+                numChars++;
+                width += utf8proc_charwidth(cp);
+                switch (utf8proc_get_property(cp)->linebreak) {
+                case UTF8PROC_LINEBREAK_SP:
+                case UTF8PROC_LINEBREAK_BK:
+                case UTF8PROC_LINEBREAK_CR:
+                case UTF8PROC_LINEBREAK_LF:
+                case UTF8PROC_LINEBREAK_NL:
+                    break;
+                default:
+                    contentChars = numChars;
+                    contentWidth = width;
+                }
+            }
+            if (lineUsed && lineWidth + contentWidth > columns) {
+                Tcl_ListObjAppendElement(NULL, resultObj,
+                    Tcl_GetRange(objv[1], lineFirst, lineEnd - 1));
+                lineFirst = lineEnd = first;
+                lineWidth = 0;
+            }
+            if (lineWidth + contentWidth > columns) {
+                /*
+                 * The segment does not fit on a line of its own, break it
+                 * between grapheme clusters. The state of the clusters is
+                 * advanced by every character, even where the line cannot
+                 * be broken, so that runs such as regional indicators are
+                 * paired from the start of the segment.
+                 */
+                prevCp = -1;
+                for (i = pos, index = first; index < first + contentChars;
+                     i += n, index++) {
+                    utf8proc_bool graphemeBreak;
+                    n = utf8proc_iterate(str + i, next - i, &cp);
+                    graphemeBreak =
+                        utf8proc_grapheme_break_stateful(prevCp, cp, &state);
+                    if (graphemeBreak && index > lineFirst &&
+                        lineWidth + utf8proc_charwidth(cp) > columns) {
+                        Tcl_ListObjAppendElement(NULL, resultObj,
+                            Tcl_GetRange(objv[1], lineFirst, index - 1));
+                        lineFirst = index;
+                        lineWidth = 0;
+                    }
+                    lineWidth += utf8proc_charwidth(cp);
+                    prevCp = cp;
+                }
+                state = 0;
+                lineWidth += width - contentWidth;
+            } else {
+                lineWidth += width;
+            }
+            if (contentChars > 0) {
+                lineEnd = first + contentChars;
+            }
+            lineUsed = 1;
+            first += numChars;
+            pos = next;
+            if (mandatory) {
+                Tcl_ListObjAppendElement(NULL, resultObj,
+                    Tcl_GetRange(objv[1], lineFirst, lineEnd - 1));
+                lineFirst = lineEnd = first;
+                lineWidth = 0;
+                lineUsed = 0;
+            }
+        }
+        if (result == TCL_OK) {
+            Tcl_SetObjResult(interp, resultObj);
+        }
+    }
+    Tcl_DStringFree(&ds);
+    Tcl_FreeEncoding(encoding);
+    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+}
+
+/*
+ * Names of the bidirectional character classes, indexed by
+ * utf8proc_bidi_class_t.
+ */
+static const char *bidiClassNames[] = {
+    "", "L", "LRE", "LRO", "R", "AL", "RLE", "RLO", "PDF", "EN", "ES", "ET",
+    "AN", "CS", "NSM", "BN", "B", "S", "WS", "ON", "LRI", "RLI", "FSI", "PDI"
+};
+
+/*
+ * Paragraph directions accepted by the -direction option of the bidi
+ * commands, mapped to the level argument of utf8proc_bidi_levels.
+ */
+static const char *bidiDirections[] = {"ltr", "rtl", "auto", NULL};
+static const int bidiDirectionLevels[] = {0, 1, -1};
+
+/* Number of distinct embedding levels, 0 to the maximum depth of 125 + 1 */
+#define BIDI_LEVEL_OBJS 127
+
+/*
+ * GetBidiLevels --
+ *
+ *	Resolves the bidi embedding levels of the characters of a string.
+ *
+ * Results:
+ *	A standard Tcl result. On success, *bufferPtr points to the code
+ *	points of the string followed by their levels at *levelsPtr, all in
+ *	a single block that the caller must release with Tcl_Free, and
+ *	*lenPtr is the number of characters.
+ *
+ * Side effects:
+ *	Sets the interpreter result to an error message on failure.
+ */
+
+static int
+GetBidiLevels(
+    Tcl_Interp *interp,		/* Current interpreter */
+    Tcl_Obj *strObj,		/* String to resolve */
+    int level,			/* Paragraph level, -1 for auto */
+    utf8proc_int32_t **bufferPtr, /* Returned code points */
+    utf8proc_uint8_t **levelsPtr, /* Returned levels */
+    Tcl_Size *lenPtr)		/* Returned number of characters */
+{
+    Tcl_Size len = Tcl_GetCharLength(strObj);
+    utf8proc_int32_t *buffer = (utf8proc_int32_t *)Tcl_Alloc(
+        len * (sizeof(utf8proc_int32_t) + sizeof(utf8proc_uint8_t)) + 1);
+    utf8proc_uint8_t *levels = (utf8proc_uint8_t *)(buffer + len);
+
+    for (Tcl_Size i = 0; i < len; ++i) {
+        buffer[i] = Tcl_GetUniChar(strObj, i);
+    }
+    utf8proc_ssize_t ret = utf8proc_bidi_levels(buffer, len, level, levels);
+    if (ret < 0) {
+        Tcl_Free(buffer);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(utf8proc_errmsg(ret), -1));
+        return TCL_ERROR;
+    }
+    *bufferPtr = buffer;
+    *levelsPtr = levels;
+    *lenPtr = len;
+    return TCL_OK;
+}
+
+/*
+ * BidiClass --
+ *
+ *	Returns the bidirectional class of a code point.
+ *
+ * Results:
+ *	An index into bidiClassNames, L for unassigned code points.
+ *
+ * Side effects:
+ *	None.
+ */
+
+static int
+BidiClass(
+    int uc)			/* Code point */
+{
+    int bc = utf8proc_get_property(uc)->bidi_class;
+    return bc == 0 ? UTF8PROC_BIDI_CLASS_L : bc;
+}
+
+/*
+ * Tcl_UnicodeBidiClassesObjCmd --
+ *
+ *	Implements the "bidiclasses" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the list of the bidirectional classes
+ *	of the characters of the passed string or, with -runs, to a list of
+ *	{CLASS FIRST LAST} triples for the runs of characters of the same
+ *	class.
+ */
+
+static int
+Tcl_UnicodeBidiClassesObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *optNames[] = {"-runs", NULL};
+    enum { OPT_RUNS } opt;
+
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-runs? STRING");
+	return TCL_ERROR;
+    }
+
+    int i;
+    int runs = 0;
+    for (i = 1; i < objc - 1; ++i) {
+	if (Tcl_GetIndexFromObj(
+		interp, objv[i], optNames, "option", 0, &opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case OPT_RUNS:
+	    runs = 1;
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+
+    Tcl_Obj *classObjs[sizeof(bidiClassNames)/sizeof(bidiClassNames[0])];
+    for (i = 0; i < sizeof(classObjs)/sizeof(classObjs[0]); ++i) {
+        classObjs[i] = NULL;
+    }
+
+    Tcl_Obj *srcObj = objv[objc - 1];
+    Tcl_Size len = Tcl_GetCharLength(srcObj);
+    Tcl_Obj *resultList = Tcl_NewListObj(0, NULL);
+    Tcl_Size first = 0;
+    for (Tcl_Size index = 0; index < len; ++index) {
+        int bc = BidiClass(Tcl_GetUniChar(srcObj, index));
+        if (runs && index + 1 < len &&
+            BidiClass(Tcl_GetUniChar(srcObj, index + 1)) == bc) {
+            continue;
+        }
+        if (classObjs[bc] == NULL) {
+            classObjs[bc] = Tcl_NewStringObj(bidiClassNames[bc], -1);
+            Tcl_IncrRefCount(classObjs[bc]);
+        }
+        if (runs) {
+            Tcl_Obj *runObjs[3];
+            runObjs[0] = classObjs[bc];
+            runObjs[1] = Tcl_NewWideIntObj(first);
+            runObjs[2] = Tcl_NewWideIntObj(index);
+            Tcl_ListObjAppendElement(NULL, resultList,
+                                     Tcl_NewListObj(3, runObjs));
+            first = index + 1;
+        } else {
+            Tcl_ListObjAppendElement(NULL, resultList, classObjs[bc]);
+        }
+    }
+    for (i = 0; i < sizeof(classObjs)/sizeof(classObjs[0]); ++i) {
+        if (classObjs[i] != NULL) {
+            Tcl_DecrRefCount(classObjs[i]);
+        }
+    }
+    Tcl_SetObjResult(interp, resultList);
+    return TCL_OK;
+}
+
+/*
+ * ParseBidiOptions --
+ *
+ *	Parses the options of the "bidilevels" and "visualorder" commands,
+ *	all arguments but the last.
+ *
+ * Results:
+ *	A standard Tcl result. Stores the paragraph level selected by the
+ *	-direction option in *levelPtr and, if indicesPtr is not NULL, accepts
+ *	the -indices option and stores whether it was given in *indicesPtr.
+ *
+ * Side effects:
+ *	Sets the interpreter result to an error message on failure.
+ */
+
+static int
+ParseBidiOptions(
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[],	/* Argument strings */
+    int *levelPtr,		/* Returned paragraph level */
+    int *indicesPtr)		/* Returned -indices flag, may be NULL */
+{
+    static const char *levelsOptNames[] = {"-direction", NULL};
+    static const char *orderOptNames[] = {"-direction", "-indices", NULL};
+    enum { OPT_DIRECTION, OPT_INDICES } opt;
+    int i, direction;
+
+    *levelPtr = -1;
+    for (i = 1; i < objc - 1; ++i) {
+	if (Tcl_GetIndexFromObj(interp, objv[i],
+		indicesPtr ? orderOptNames : levelsOptNames, "option", 0,
+		&opt) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (opt) {
+	case OPT_DIRECTION:
+	    ++i;
+	    if (i == (objc-1)) {
+		Tcl_SetObjResult(interp,
+				 Tcl_ObjPrintf("Missing value for option %s.",
+					       Tcl_GetString(objv[i - 1])));
+		return TCL_ERROR;
+	    }
+	    if (Tcl_GetIndexFromObj(interp, objv[i], bidiDirections,
+				    "direction", 0, &direction) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    *levelPtr = bidiDirectionLevels[direction];
+	    break;
+	case OPT_INDICES:
+	    *indicesPtr = 1;
+	    break;
+	default:
+	    TCL_UNREACHABLE();
+	}
+    }
+    return TCL_OK;
+}
+
+/*
+ * Tcl_UnicodeBidiLevelsObjCmd --
+ *
+ *	Implements the "bidilevels" command.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the list of the embedding levels of
+ *	the characters of the passed string as resolved by the Unicode
+ *	Bidirectional Algorithm.
+ */
+
+static int
+Tcl_UnicodeBidiLevelsObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-direction DIRECTION? STRING");
+	return TCL_ERROR;
+    }
+
+    int level;
+    if (ParseBidiOptions(interp, objc, objv, &level, NULL) != TCL_OK) {
         return TCL_ERROR;
     }
 
-    int result;
-    Tcl_DString ds;
-    result = Tcl_UtfToExternalDStringEx(interp, encoding,
-                Tcl_GetString(objv[objc - 1]), -1, profile, &ds, NULL);
-    /* !!! dsIn needs to be freed even in case of error returns */
+    utf8proc_int32_t *buffer;
+    utf8proc_uint8_t *levels;
+    Tcl_Size len;
+    if (GetBidiLevels(interp, objv[objc - 1], level, &buffer, &levels,
+                      &len) != TCL_OK) {
+        return TCL_ERROR;
+    }
 
-    if (result != TCL_OK) {
-        result = TCL_ERROR; /* Translate TCL_CONVERT_* errors to TCL_ERROR */
-    } else {
-	Tcl_Size dsLength = Tcl_DStringLength(&ds);
-        const utf8proc_uint8_t *dsStr = (utf8proc_uint8_t *) Tcl_DStringValue(&ds);
-        const utf8proc_uint8_t *normalizedUtf8;
-        utf8proc_ssize_t normalizedLength;
-        utf8proc_option_t options = UTF8PROC_STABLE;
-        switch (mode) {
-        case MODE_NFC:
-            options |= UTF8PROC_COMPOSE;
-            break;
-        case MODE_NFD:
-            options |= UTF8PROC_DECOMPOSE;
-            break;
-        case MODE_NFKC:
-            options |= UTF8PROC_COMPOSE|UTF8PROC_COMPAT;
-            break;
-        case MODE_NFKD:
-            options |= UTF8PROC_DECOMPOSE|UTF8PROC_COMPAT;
-            break;
-        case MODE_NFKC_CASEFOLD:
-            options |= UTF8PROC_COMPOSE | UTF8PROC_COMPAT | UTF8PROC_CASEFOLD
-                     | UTF8PROC_IGNORE;
-            break;
+    Tcl_Obj *levelObjs[BIDI_LEVEL_OBJS];
+    int i;
+    for (i = 0; i < BIDI_LEVEL_OBJS; ++i) {
+        levelObjs[i] = NULL;
+    }
+    Tcl_Obj *resultList = Tcl_NewListObj(len, NULL);
+    for (Tcl_Size index = 0; index < len; ++index) {
+        i = levels[index];
+        if (levelObjs[i] == NULL) {
+            levelObjs[i] = Tcl_NewIntObj(i);
+            Tcl_IncrRefCount(levelObjs[i]);
         }
-        normalizedLength = utf8proc_map_custom( dsStr, dsLength,
-            &normalizedUtf8, options, NULL, NULL);
-
-        if (normalizedLength < 0) {
-            const char *errorMsg = utf8proc_errmsg(normalizedLength);
-            Tcl_SetObjResult(
-                interp, Tcl_NewStringObj(
-                    errorMsg ? errorMsg : "Unicode normalization failed.", -1));
-            result = TCL_ERROR;
-        } else {
-            /* Convert standard UTF8 to internal UTF8 */
-            assert(normalizedUtf8);
-            Tcl_DStringSetLength(&ds, 0);
-            result = Tcl_ExternalToUtfDStringEx(interp, encoding,
-                (const char *)normalizedUtf8, normalizedLength, profile, &ds, NULL);
-            free(normalizedUtf8);
-	    if (result == TCL_OK) {
-                Tcl_DStringResult(interp, &ds);
-            }
+        Tcl_ListObjAppendElement(NULL, resultList, levelObjs[i]);
+    }
+    for (i = 0; i < BIDI_LEVEL_OBJS; ++i) {
+        if (levelObjs[i] != NULL) {
+            Tcl_DecrRefCount(levelObjs[i]);
         }
     }
-
-    Tcl_DStringFree(&ds);
-    Tcl_FreeEncoding(encoding);
-    /* Translate TCL_CONVERT* etc. codes to TCL_ERROR */
-    return result == TCL_OK ? TCL_OK : TCL_ERROR;
+    Tcl_Free(buffer);
+    Tcl_SetObjResult(interp, resultList);
+    return TCL_OK;
 }
 
 /*
- * Tcl_UnicodeCategorizeObjCmd --
+ * Tcl_UnicodeVisualOrderObjCmd --
  *
- *	 Implements the "categorize" command.
+ *	Implements the "visualorder" command.
  *
  * Results:
  *	A standard Tcl result
  *
  * Side effects:
- *	Sets the interpreter result to a list of Unicode categories.
+ *	Sets the interpreter result to the passed string in visual order as
+ *	reordered by the Unicode Bidirectional Algorithm, with characters at
+ *	right-to-left levels replaced by their mirrored glyphs, or with
+ *	-indices to the list of the indices of the characters in visual
+ *	order. Each paragraph is reordered as a single line.
  */
 
 static int
-Tcl_UnicodeCategorizeObjCmd(
+Tcl_UnicodeVisualOrderObjCmd(
     void *dummy,		/* Not used. */
     Tcl_Interp *interp,		/* Current interpreter */
     int objc,			/* Number of arguments */
     Tcl_Obj *const objv[]	/* Argument strings */
     )
 {
-    if (objc != 2) {
-        Tcl_WrongNumArgs(interp, 1, objv, "STRING");
+    if (objc < 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-direction DIRECTION? ?-indices? STRING");
+	return TCL_ERROR;
+    }
+
+    int level, indices = 0;
+    if (ParseBidiOptions(interp, objc, objv, &level, &indices) != TCL_OK) {
         return TCL_ERROR;
     }
 
-    Tcl_Obj *categoryObjs[31]; /* 30 categories + one for out of range */
-    for (int i = 0; i < sizeof(categoryObjs)/sizeof(categoryObjs[0]); ++i) {
-        categoryObjs[i] = NULL;
+    utf8proc_int32_t *buffer;
+    utf8proc_uint8_t *levels;
+    Tcl_Size len;
+    if (GetBidiLevels(interp, objv[objc - 1], level, &buffer, &levels,
+                      &len) != TCL_OK) {
+        return TCL_ERROR;
     }
 
-    Tcl_Obj *srcObj = objv[1];
-    Tcl_Size len = Tcl_GetCharLength(srcObj);
-    Tcl_Obj *resultList = Tcl_NewListObj(len, NULL);
-    for (int i = 0; i < len; ++i) {
-        Tcl_UniChar uc = Tcl_GetUniChar(srcObj, i);
-        utf8proc_category_t category;
-        if (uc < 0 || uc > 0x10FFFF) {
-            category = 30;
-            if (categoryObjs[30] == NULL) {
-                categoryObjs[30] = Tcl_NewStringObj("??", -1);
-            }
-        } else {
-            category = utf8proc_category(uc);
-            if (categoryObjs[category] == NULL) {
-                categoryObjs[category] =
-                    Tcl_NewStringObj(utf8proc_category_string(category), -1);
+    utf8proc_ssize_t *order =
+        (utf8proc_ssize_t *)Tcl_Alloc(len * sizeof(utf8proc_ssize_t) + 1);
+    utf8proc_bidi_reorder(buffer, levels, len, order);
+
+    Tcl_Obj *resultObj;
+    if (indices) {
+        resultObj = Tcl_NewListObj(len, NULL);
+        for (Tcl_Size index = 0; index < len; ++index) {
+            Tcl_ListObjAppendElement(NULL, resultObj,
+                                     Tcl_NewWideIntObj(order[index]));
+        }
+    } else {
+        Tcl_DString ds;
+        char buf[TCL_UTF_MAX];
+        Tcl_DStringInit(&ds);
+        for (Tcl_Size index = 0; index < len; ++index) {
+            utf8proc_int32_t uc = buffer[order[index]];
+            if (levels[order[index]] % 2) {
+                uc = utf8proc_bidi_mirror(uc);
             }
+            Tcl_DStringAppend(&ds, buf, Tcl_UniCharToUtf(uc, buf));
         }
-        Tcl_ListObjAppendElement(interp, resultList, categoryObjs[category]);
-    }
-    for (int i = 0; i < sizeof(categoryObjs)/sizeof(categoryObjs[0]); ++i) {
-        if (categoryObjs[i] != NULL) {
-	    Tcl_BounceRefCount(categoryObjs[i]);
-	}
+        resultObj = Tcl_DStringToObj(&ds);
     }
-    Tcl_SetObjResult(interp, resultList);
+    Tcl_Free(order);
+    Tcl_Free(buffer);
+    Tcl_SetObjResult(interp, resultObj);
     return TCL_OK;
 }
 
@@ -328,6 +3051,472 @@ Tcl_UnicodeMakeRawObjCmd(
     return TCL_OK;
 }
 
+/*
+ * Tcl_UnicodeConformanceObjCmd --
+ *
+ *	Implements the "conformance" command. USE ONLY FOR TESTING. Checks
+ *	the normalization of the lines of a NormalizationTest.txt file from
+ *	the Unicode Character Database, as described in that file: the
+ *	conformance conditions of each of the NFC, NFD, NFKC and NFKD forms
+ *	for the five columns of each line, and the invariance under all
+ *	forms of the code points not listed in part 1.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	Sets the interpreter result to the list of failures, each a pair
+ *	of the line number, or of U+XXXX for a code point that is not
+ *	invariant, and of the normalization form.
+ */
+
+#define CONFORMANCE_COLUMNS 5
+#define CONFORMANCE_MAX_CHARS 64
+
+static int
+Tcl_UnicodeConformanceObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    /*
+     * For each form, the column whose normalization must be equal to the
+     * value of each column.
+     */
+    static const NormalizationMode modes[] = {
+	MODE_NFC, MODE_NFD, MODE_NFKC, MODE_NFKD
+    };
+    static const int expected[][CONFORMANCE_COLUMNS] = {
+	{1, 1, 1, 3, 3},	/* c2 == NFC(c1..c3), c4 == NFC(c4, c5) */
+	{2, 2, 2, 4, 4},	/* c3 == NFD(c1..c3), c5 == NFD(c4, c5) */
+	{3, 3, 3, 3, 3},	/* c4 == NFKC(c1..c5) */
+	{4, 4, 4, 4, 4}		/* c5 == NFKD(c1..c5) */
+    };
+    utf8proc_uint8_t columns[CONFORMANCE_COLUMNS][4 * CONFORMANCE_MAX_CHARS];
+    utf8proc_ssize_t columnLengths[CONFORMANCE_COLUMNS];
+    utf8proc_arena_t *arena = GetThreadArena();
+    unsigned char *listed;
+    Tcl_Channel chan;
+    Tcl_Obj *lineObj, *resultObj;
+    Tcl_Size lineno = 0;
+    int inPart1 = 0, result = TCL_OK;
+    size_t m;
+
+    if (objc != 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "FILE");
+	return TCL_ERROR;
+    }
+    chan = Tcl_FSOpenFileChannel(interp, objv[1], "r", 0);
+    if (chan == NULL) {
+	return TCL_ERROR;
+    }
+    if (Tcl_SetChannelOption(interp, chan, "-encoding", "utf-8") != TCL_OK) {
+	Tcl_Close(NULL, chan);
+	return TCL_ERROR;
+    }
+
+    /* Bitmap of the code points listed in part 1 */
+    listed = (unsigned char *)Tcl_Alloc(0x110000 / 8);
+    memset(listed, 0, 0x110000 / 8);
+    resultObj = Tcl_NewListObj(0, NULL);
+    lineObj = Tcl_NewObj();
+    Tcl_IncrRefCount(lineObj);
+
+    while (Tcl_SetObjLength(lineObj, 0), Tcl_GetsObj(chan, lineObj) >= 0) {
+	const char *p = Tcl_GetString(lineObj);
+	int col;
+
+	++lineno;
+	while (*p == ' ' || *p == '\t') {
+	    ++p;
+	}
+	if (*p == '\0' || *p == '#') {
+	    continue;
+	}
+	if (*p == '@') {
+	    inPart1 = !strncmp(p, "@Part1", 6);
+	    continue;
+	}
+	for (col = 0; col < CONFORMANCE_COLUMNS; ++col) {
+	    utf8proc_int32_t first = -1;
+	    int n = 0;
+	    columnLengths[col] = 0;
+	    while (*p != ';') {
+		char *end;
+		long uc = strtol(p, &end, 16);
+		if (end == p) {
+		    if (*p == ' ') {
+			++p;
+			continue;
+		    }
+		    goto badLine;
+		}
+		if (!utf8proc_codepoint_valid((utf8proc_int32_t) uc)
+			|| ++n > CONFORMANCE_MAX_CHARS) {
+		    goto badLine;
+		}
+		if (first < 0) {
+		    first = (utf8proc_int32_t) uc;
+		}
+		columnLengths[col] += utf8proc_encode_char(
+		    (utf8proc_int32_t) uc, columns[col] + columnLengths[col]);
+		p = end;
+	    }
+	    ++p;
+	    if (n == 0) {
+		goto badLine;
+	    }
+	    if (col == 0 && inPart1 && n == 1) {
+		listed[first >> 3] |= (unsigned char) (1 << (first & 7));
+	    }
+	}
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+	    utf8proc_option_t options = NormalizationOptions(modes[m]);
+	    for (col = 0; col < CONFORMANCE_COLUMNS; ++col) {
+		const utf8proc_uint8_t *normalized;
+		int e = expected[m][col];
+		utf8proc_ssize_t len = utf8proc_map_arena(columns[col],
+		    columnLengths[col], &normalized, options, NULL, NULL, arena);
+		if (len != columnLengths[e]
+			|| memcmp(normalized, columns[e], (size_t) len)) {
+		    Tcl_Obj *elems[2];
+		    elems[0] = Tcl_NewWideIntObj(lineno);
+		    elems[1] = Tcl_NewStringObj(normalizationForms[modes[m]], -1);
+		    Tcl_ListObjAppendElement(NULL, resultObj,
+					     Tcl_NewListObj(2, elems));
+		    break;
+		}
+	    }
+	}
+	continue;
+
+    badLine:
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+	    "Invalid line %" TCL_SIZE_MODIFIER "d in \"%s\".",
+	    lineno, Tcl_GetString(objv[1])));
+	result = TCL_ERROR;
+	break;
+    }
+
+    if (result == TCL_OK && !Tcl_Eof(chan)) {
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+	    "Error reading \"%s\": %s", Tcl_GetString(objv[1]),
+	    Tcl_PosixError(interp)));
+	result = TCL_ERROR;
+    }
+
+    if (result == TCL_OK) {
+	utf8proc_int32_t uc;
+	for (uc = 0; uc < 0x110000; ++uc) {
+	    utf8proc_uint8_t encoded[4];
+	    utf8proc_ssize_t encodedLength;
+	    if ((listed[uc >> 3] & (1 << (uc & 7)))
+		    || (uc >= 0xD800 && uc <= 0xDFFF)) {
+		continue;
+	    }
+	    encodedLength = utf8proc_encode_char(uc, encoded);
+	    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+		const utf8proc_uint8_t *normalized;
+		utf8proc_ssize_t len = utf8proc_map_arena(encoded,
+		    encodedLength, &normalized, NormalizationOptions(modes[m]),
+		    NULL, NULL, arena);
+		if (len != encodedLength
+			|| memcmp(normalized, encoded, (size_t) len)) {
+		    Tcl_Obj *elems[2];
+		    elems[0] = Tcl_ObjPrintf("U+%04X", (unsigned) uc);
+		    elems[1] = Tcl_NewStringObj(normalizationForms[modes[m]], -1);
+		    Tcl_ListObjAppendElement(NULL, resultObj,
+					     Tcl_NewListObj(2, elems));
+		}
+	    }
+	}
+    }
+
+    Tcl_DecrRefCount(lineObj);
+    Tcl_Free((char *) listed);
+    Tcl_Close(NULL, chan);
+    if (result == TCL_OK) {
+	Tcl_SetObjResult(interp, resultObj);
+    } else {
+	Tcl_DecrRefCount(resultObj);
+    }
+    return result;
+}
+
+/*
+ * Commands added by the package, in the namespace of the package.
+ */
+static const struct {
+    const char *name;
+    Tcl_ObjCmdProc *proc;
+} commands[] = {
+    {"unicodeversion", Tcl_UnicodeVersionObjCmd},
+    {"validate", Tcl_UnicodeValidateObjCmd},
+    {"build-info", BuildInfoObjCmd},
+    {"normalize", Tcl_UnicodeNormalizeObjCmd},
+    {"fold", Tcl_UnicodeFoldObjCmd},
+    {"normalizer", Tcl_UnicodeNormalizerObjCmd},
+    {"bidiclasses", Tcl_UnicodeBidiClassesObjCmd},
+    {"bidilevels", Tcl_UnicodeBidiLevelsObjCmd},
+    {"categorize", Tcl_UnicodeCategorizeObjCmd},
+    {"search", Tcl_UnicodeSearchObjCmd},
+    {"sentences", Tcl_UnicodeSentencesObjCmd},
+    {"skeleton", Tcl_UnicodeSkeletonObjCmd},
+    {"confusable", Tcl_UnicodeConfusableObjCmd},
+    {"visualorder", Tcl_UnicodeVisualOrderObjCmd},
+    {"words", Tcl_UnicodeWordsObjCmd},
+    {"wrap", Tcl_UnicodeWrapObjCmd},
+    {"test::makerawobj", Tcl_UnicodeMakeRawObjCmd},
+    {"test::conformance", Tcl_UnicodeConformanceObjCmd},
+};
+#define NUM_COMMANDS (sizeof(commands)/sizeof(commands[0]))
+
+#ifdef WRAP_COMMANDS
+
+/*
+ * Commands of the objects created by the commands above, which are counted
+ * and probed under these names, following the commands of the package.
+ */
+static const char *objectCommandNames[] = {
+    "normalizer object",
+};
+#define NUM_OBJECT_COMMANDS \
+    (sizeof(objectCommandNames)/sizeof(objectCommandNames[0]))
+#define NORMALIZER_OBJECT_INDEX NUM_COMMANDS
+
+/* Name of the command counted at index i of commandStats */
+#define CommandName(i) ((i) < NUM_COMMANDS ? commands[i].name \
+	: objectCommandNames[(i) - NUM_COMMANDS])
+
+#ifdef UTF8PROC_STATS
+static CommandStats commandStats[NUM_COMMANDS + NUM_OBJECT_COMMANDS];
+#endif
+
+/*
+ * Byte length of the string representation of an object for the probes,
+ * or -1 if it has none, so that probing does not generate one.
+ */
+#define ObjProbeLength(objPtr) ((objPtr)->bytes ? (long) (objPtr)->length : -1L)
+
+/*
+ * WrapperCall --
+ *
+ *	Calls a command, counting the call and its latency under the passed
+ *	index of commandStats if UTF8PROC_STATS is defined and firing the
+ *	command__entry and command__return probes if UTF8PROC_PROBES is
+ *	defined.
+ *
+ * Results:
+ *	The result of the command.
+ *
+ * Side effects:
+ *	Those of the command. The counters of the command are updated.
+ */
+
+static int
+WrapperCall(
+    size_t index,		/* Index of the command in commandStats */
+    Tcl_ObjCmdProc *proc,	/* Command to call */
+    void *clientData,		/* Client data of the command */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    int result;
+#ifdef UTF8PROC_STATS
+    CommandStats *statsPtr = &commandStats[index];
+    Tcl_Time start, end;
+    Tcl_WideInt usecs;
+    int bucket;
+
+    Tcl_GetTime(&start);
+#endif
+#ifdef UTF8PROC_PROBES
+    DTRACE_PROBE3(utf8proc, command__entry, CommandName(index), objc,
+		  ObjProbeLength(objv[objc - 1]));
+#endif
+    result = proc(clientData, interp, objc, objv);
+#ifdef UTF8PROC_PROBES
+    DTRACE_PROBE3(utf8proc, command__return, CommandName(index), result,
+		  ObjProbeLength(Tcl_GetObjResult(interp)));
+#endif
+#ifdef UTF8PROC_STATS
+    Tcl_GetTime(&end);
+    usecs = (Tcl_WideInt) (end.sec - start.sec) * 1000000
+	    + (end.usec - start.usec);
+    for (bucket = 0; usecs > 0 && bucket < STATS_LATENCY_BUCKETS - 1; ++bucket) {
+	usecs >>= 1;
+    }
+    StatsAdd(statsPtr->calls, 1);
+    if (result != TCL_OK) {
+	StatsAdd(statsPtr->errors, 1);
+    }
+    StatsAdd(statsPtr->latency[bucket], 1);
+#endif
+    return result;
+}
+
+/*
+ * WrapperObjCmd --
+ *
+ *	Calls the command of the commands table whose index is passed as
+ *	client data through WrapperCall.
+ *
+ * Results:
+ *	The result of the command.
+ *
+ * Side effects:
+ *	Those of the command. The counters of the command are updated.
+ */
+
+static int
+WrapperObjCmd(
+    void *clientData,		/* Index of the command in commands */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    size_t index = (size_t) clientData;
+    return WrapperCall(index, commands[index].proc, NULL, interp, objc, objv);
+}
+
+/*
+ * NormalizerWrapperObjCmd --
+ *
+ *	Calls the command of the normalizer object passed as client data
+ *	through WrapperCall.
+ *
+ * Results:
+ *	The result of the command.
+ *
+ * Side effects:
+ *	Those of the command. The counters of normalizer objects are updated.
+ */
+
+static int
+NormalizerWrapperObjCmd(
+    void *clientData,		/* Normalizer */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    return WrapperCall(NORMALIZER_OBJECT_INDEX, NormalizerObjCmd, clientData,
+		       interp, objc, objv);
+}
+#endif /* WRAP_COMMANDS */
+
+#ifdef UTF8PROC_STATS
+/*
+ * Tcl_UnicodeStatsObjCmd --
+ *
+ *	Implements the "stats" command returning the counters of the
+ *	commands and of the utf8proc library.
+ *
+ * Results:
+ *	A standard Tcl result
+ *
+ * Side effects:
+ *	The counters are reset to zero if the -reset option is passed.
+ */
+
+static int
+Tcl_UnicodeStatsObjCmd(
+    void *dummy,		/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter */
+    int objc,			/* Number of arguments */
+    Tcl_Obj *const objv[]	/* Argument strings */
+    )
+{
+    static const char *optNames[] = {"-reset", NULL};
+    int opt, i;
+    size_t j;
+    utf8proc_stats_t libStats;
+    Tcl_Obj *resultObj, *dictObj;
+
+    if (objc > 2) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?-reset?");
+	return TCL_ERROR;
+    }
+    if (objc == 2 && Tcl_GetIndexFromObj(
+	    interp, objv[1], optNames, "option", 0, &opt) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+#define StatsPut(dict, key, value) \
+    Tcl_DictObjPut(NULL, (dict), Tcl_NewStringObj((key), -1), \
+		   Tcl_NewWideIntObj((Tcl_WideInt) (value)))
+
+    resultObj = Tcl_NewDictObj();
+    dictObj = Tcl_NewDictObj();
+    for (j = 0; j < NUM_COMMANDS + NUM_OBJECT_COMMANDS; ++j) {
+	Tcl_Obj *commandObj = Tcl_NewDictObj();
+	Tcl_Obj *latencyObj = Tcl_NewDictObj();
+	StatsPut(commandObj, "calls", StatsGet(commandStats[j].calls));
+	StatsPut(commandObj, "errors", StatsGet(commandStats[j].errors));
+	for (i = 0; i < STATS_LATENCY_BUCKETS; ++i) {
+	    StatsCounter count = StatsGet(commandStats[j].latency[i]);
+	    if (count) {
+		Tcl_DictObjPut(NULL, latencyObj,
+		    Tcl_NewWideIntObj((Tcl_WideInt) 1 << i),
+		    Tcl_NewWideIntObj((Tcl_WideInt) count));
+	    }
+	}
+	Tcl_DictObjPut(NULL, commandObj, Tcl_NewStringObj("latency", -1),
+		       latencyObj);
+	Tcl_DictObjPut(NULL, dictObj, Tcl_NewStringObj(CommandName(j), -1),
+		       commandObj);
+    }
+    Tcl_DictObjPut(NULL, resultObj, Tcl_NewStringObj("commands", -1), dictObj);
+
+    dictObj = Tcl_NewDictObj();
+    for (i = 0; normalizationForms[i] != NULL; ++i) {
+	Tcl_Obj *modeObj = Tcl_NewDictObj();
+	StatsPut(modeObj, "calls", StatsGet(normalizeStats[i].calls));
+	StatsPut(modeObj, "bytesin", StatsGet(normalizeStats[i].bytesIn));
+	StatsPut(modeObj, "bytesout", StatsGet(normalizeStats[i].bytesOut));
+	Tcl_DictObjPut(NULL, dictObj,
+		       Tcl_NewStringObj(normalizationForms[i], -1), modeObj);
+    }
+    Tcl_DictObjPut(NULL, resultObj, Tcl_NewStringObj("normalize", -1), dictObj);
+
+    utf8proc_get_stats(&libStats);
+    dictObj = Tcl_NewDictObj();
+    StatsPut(dictObj, "calls", libStats.map_calls);
+    StatsPut(dictObj, "composedpath", libStats.composed_path);
+    StatsPut(dictObj, "decomposedpath", libStats.decomposed_path);
+    StatsPut(dictObj, "bytesin", libStats.bytes_in);
+    StatsPut(dictObj, "bytesout", libStats.bytes_out);
+    StatsPut(dictObj, "allocations", libStats.allocations);
+    Tcl_DictObjPut(NULL, resultObj, Tcl_NewStringObj("library", -1), dictObj);
+#undef StatsPut
+
+    if (objc == 2) {
+	for (j = 0; j < NUM_COMMANDS + NUM_OBJECT_COMMANDS; ++j) {
+	    StatsReset(commandStats[j].calls);
+	    StatsReset(commandStats[j].errors);
+	    for (i = 0; i < STATS_LATENCY_BUCKETS; ++i) {
+		StatsReset(commandStats[j].latency[i]);
+	    }
+	}
+	for (i = 0; normalizationForms[i] != NULL; ++i) {
+	    StatsReset(normalizeStats[i].calls);
+	    StatsReset(normalizeStats[i].bytesIn);
+	    StatsReset(normalizeStats[i].bytesOut);
+	}
+	utf8proc_reset_stats();
+    }
+
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+#endif /* UTF8PROC_STATS */
+
 /*
  * Utf8proc_Init --
  *
@@ -360,11 +3549,25 @@ Utf8proc_Init(
     /*
      * Register the commands added by the package.
      */
-    Tcl_CreateObjCommand(interp, PACKAGE_NAME "::" "unicodeversion", Tcl_UnicodeVersionObjCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, PACKAGE_NAME "::" "build-info", BuildInfoObjCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, PACKAGE_NAME "::" "normalize", Tcl_UnicodeNormalizeObjCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, PACKAGE_NAME "::" "categorize", Tcl_UnicodeCategorizeObjCmd, NULL, NULL);
-    Tcl_CreateObjCommand(interp, PACKAGE_NAME "::" "test::makerawobj", Tcl_UnicodeMakeRawObjCmd, NULL, NULL);
+    size_t i;
+    Tcl_DString ds;
+    Tcl_DStringInit(&ds);
+    for (i = 0; i < NUM_COMMANDS; ++i) {
+	Tcl_DStringSetLength(&ds, 0);
+	Tcl_DStringAppend(&ds, PACKAGE_NAME "::", -1);
+	Tcl_DStringAppend(&ds, commands[i].name, -1);
+#ifdef WRAP_COMMANDS
+	Tcl_CreateObjCommand(interp, Tcl_DStringValue(&ds), WrapperObjCmd,
+			     (void *) i, NULL);
+#else
+	Tcl_CreateObjCommand(interp, Tcl_DStringValue(&ds), commands[i].proc,
+			     NULL, NULL);
+#endif
+    }
+    Tcl_DStringFree(&ds);
+#ifdef UTF8PROC_STATS
+    Tcl_CreateObjCommand(interp, PACKAGE_NAME "::" "stats", Tcl_UnicodeStatsObjCmd, NULL, NULL);
+#endif
 
 
     /* Register feature configuration  */
@@ -18,6 +18,15 @@
 
 static const char *buildData =
 		    PACKAGE_VERSION "+" STRINGIFY(TCLUTF8PROC_VERSION_UUID)
+#ifdef UTF8PROC_BMP_INDEX
+			    ".bmpindex"
+#endif
+#ifdef UTF8PROC_PROBES
+			    ".probes"
+#endif
+#ifdef UTF8PROC_STATS
+			    ".stats"
+#endif
 #if defined(__clang__) && defined(__clang_major__)
 			    ".clang-" STRINGIFY(__clang_major__)
 #if __clang_minor__ < 10
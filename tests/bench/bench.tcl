@@ -0,0 +1,246 @@
+# bench.tcl --
+#
+#	Runs the benchmarks of the utf8proc package. Each benchmark file
+#	*.bench in this directory registers benchmarks with the bench command
+#	which are run over synthetic corpora generated locally.
+#
+#	Options:
+#	    -match PATTERN	Only run benchmarks whose name matches PATTERN
+#	    -corpus PATTERN	Only use the corpora whose name matches PATTERN
+#	    -file PATTERN	Only source benchmark files matching PATTERN
+#	    -size N		Number of characters of each corpus (10000)
+#	    -load SCRIPT	Script to evaluate to make the package available
+#
+# See the file LICENSE for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+namespace eval utf8proc::bench {
+    variable options [dict create -match * -corpus * -file *.bench \
+                          -size 10000 -load {}]
+    variable corpora [dict create]
+    variable seed 1
+
+    # Characters the corpora are built from
+    variable latinLetters {
+        \u00e0 \u00e1 \u00e2 \u00e4 \u00e7 \u00e8 \u00e9 \u00ea \u00ee \u00ef
+        \u00f1 \u00f4 \u00f6 \u00f9 \u00fa \u00fc \u00df \u0103 \u01a1 \u01b0
+        \u1ea1 \u1ebf \u1ec7 \u1ecd
+    }
+    variable combiningMarks {
+        \u0300 \u0301 \u0302 \u0303 \u0308 \u030a \u0323 \u0327 \u0328
+        \u0331 \u0345
+    }
+}
+
+# utf8proc::bench::Random --
+#
+#	Returns a pseudo-random integer in [0, N) from a fixed seed so that the
+#	corpora are identical across runs.
+
+proc utf8proc::bench::Random {n} {
+    variable seed
+    set seed [expr {($seed * 1103515245 + 12345) % 2147483648}]
+    return [expr {($seed >> 8) % $n}]
+}
+
+proc utf8proc::bench::Pick {list} {
+    return [lindex $list [Random [llength $list]]]
+}
+
+# utf8proc::bench::Words --
+#
+#	Returns a string of about SIZE characters made of words produced by
+#	the WORDCMD command prefix, separated by spaces and punctuation.
+
+proc utf8proc::bench::Words {size wordCmd} {
+    set text ""
+    while {[string length $text] < $size} {
+        append text [{*}$wordCmd]
+        switch [Random 8] {
+            0 {append text ". "}
+            1 {append text ", "}
+            default {append text " "}
+        }
+    }
+    return [string range $text 0 $size-1]
+}
+
+proc utf8proc::bench::AsciiWord {} {
+    set word ""
+    for {set i [expr {2 + [Random 7]}]} {$i > 0} {incr i -1} {
+        append word [format %c [expr {0x61 + [Random 26]}]]
+    }
+    return $word
+}
+
+proc utf8proc::bench::LatinWord {} {
+    variable latinLetters
+    set word ""
+    for {set i [expr {2 + [Random 7]}]} {$i > 0} {incr i -1} {
+        if {[Random 4] == 0} {
+            append word [Pick $latinLetters]
+        } else {
+            append word [format %c [expr {0x61 + [Random 26]}]]
+        }
+    }
+    return $word
+}
+
+proc utf8proc::bench::CjkWord {} {
+    set word ""
+    for {set i [expr {1 + [Random 12]}]} {$i > 0} {incr i -1} {
+        if {[Random 3] == 0} {
+            # Hiragana
+            append word [format %c [expr {0x3041 + [Random 0x56]}]]
+        } else {
+            append word [format %c [expr {0x4E00 + [Random 0x5200]}]]
+        }
+    }
+    return $word\u3002
+}
+
+proc utf8proc::bench::HangulWord {} {
+    set word ""
+    for {set i [expr {1 + [Random 4]}]} {$i > 0} {incr i -1} {
+        append word [format %c [expr {0xAC00 + [Random 11172]}]]
+    }
+    return $word
+}
+
+proc utf8proc::bench::EmojiWord {} {
+    switch [Random 4] {
+        0 {
+            # Emoji with skin tone modifier
+            return [format %c%c [expr {0x1F466 + [Random 4]}] \
+                        [expr {0x1F3FB + [Random 5]}]]
+        }
+        1 {
+            # ZWJ sequence
+            return [format %c\u200d%c\u200d%c 0x1F468 0x1F469 \
+                        [expr {0x1F466 + [Random 2]}]]
+        }
+        2 {
+            # Flag
+            return [format %c%c [expr {0x1F1E6 + [Random 26]}] \
+                        [expr {0x1F1E6 + [Random 26]}]]
+        }
+        default {
+            return [format %c [expr {0x1F600 + [Random 0x50]}]]
+        }
+    }
+}
+
+proc utf8proc::bench::CombiningWord {} {
+    variable combiningMarks
+    set word ""
+    for {set i [expr {2 + [Random 5]}]} {$i > 0} {incr i -1} {
+        append word [format %c [expr {0x61 + [Random 26]}]]
+        # Marks in arbitrary, not canonical, order
+        for {set j [Random 5]} {$j > 0} {incr j -1} {
+            append word [Pick $combiningMarks]
+        }
+    }
+    return $word
+}
+
+# utf8proc::bench::corpus --
+#
+#	Returns the text of the named corpus, generating it on first use.
+
+proc utf8proc::bench::corpus {name} {
+    variable corpora
+    variable options
+    variable seed
+    if {![dict exists $corpora $name]} {
+        set seed [string length $name]
+        set wordCmd [dict get {
+            ascii AsciiWord latin LatinWord cjk CjkWord
+            hangul HangulWord emoji EmojiWord combining CombiningWord
+        } $name]
+        dict set corpora $name [Words [dict get $options -size] $wordCmd]
+    }
+    return [dict get $corpora $name]
+}
+
+# utf8proc::bench::Allocations --
+#
+#	Returns the number of Tcl memory allocations so far, or the empty
+#	string if Tcl was not built with memory debugging.
+
+proc utf8proc::bench::Allocations {} {
+    if {[llength [info commands ::memory]] == 0} {
+        return ""
+    }
+    regexp {total mallocs\s+(\d+)} [memory info] -> mallocs
+    return $mallocs
+}
+
+# utf8proc::bench::bench --
+#
+#	Runs SCRIPT, in which the variable text holds the corpus, over each
+#	of the corpora CORPORA and reports the time per character and the
+#	Tcl memory allocations per call.
+
+proc utf8proc::bench::bench {name script {corpusNames {ascii latin cjk hangul emoji combining}}} {
+    variable options
+    if {![string match [dict get $options -match] $name]} {
+        return
+    }
+    proc Body {text} $script
+    foreach corpusName $corpusNames {
+        if {![string match [dict get $options -corpus] $corpusName]} {
+            continue
+        }
+        set text [corpus $corpusName]
+        # Grow the iteration count until a round takes at least 20 ms and
+        # keep the best of 5 rounds.
+        Body $text
+        set count 1
+        while {[lindex [time {Body $text} $count] 0] * $count < 20000} {
+            set count [expr {$count * 2}]
+        }
+        set best Inf
+        for {set round 0} {$round < 5} {incr round} {
+            set us [lindex [time {Body $text} $count] 0]
+            if {$us < $best} {
+                set best $us
+            }
+        }
+        # Allocations of the call, less those of Allocations itself
+        set before [Allocations]
+        set after [Allocations]
+        set overhead [expr {$before eq "" ? 0 : $after - $before}]
+        set before [Allocations]
+        Body $text
+        set after [Allocations]
+        set allocs [expr {$before eq "" ? "-" : $after - $before - $overhead}]
+        puts [format "%-28s %-10s %10.2f %12s" $name $corpusName \
+                  [expr {$best * 1000.0 / [string length $text]}] $allocs]
+    }
+}
+
+namespace eval utf8proc::bench {
+    namespace export bench corpus
+
+    foreach {option value} $argv {
+        if {![dict exists $options $option]} {
+            puts stderr "Unknown option \"$option\", must be one of\
+                [join [dict keys $options] {, }]."
+            exit 1
+        }
+        dict set options $option $value
+    }
+    uplevel #0 [dict get $options -load]
+    package require utf8proc
+
+    puts "utf8proc [package present utf8proc]\
+        (library [utf8proc::pkgconfig get libversion]),\
+        Tcl [info patchlevel],\
+        [dict get $options -size] characters per corpus"
+    puts [format "%-28s %-10s %10s %12s" BENCHMARK CORPUS ns/char allocs/call]
+    set benchDir [file dirname [file normalize [info script]]]
+    foreach file [lsort [glob -nocomplain -directory $benchDir \
+                             [dict get $options -file]]] {
+        uplevel #0 [list source $file]
+    }
+}
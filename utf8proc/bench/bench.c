@@ -5,11 +5,82 @@
 #include "utf8proc.h"
 #include "util.h"
 
+/* Times the operations below over each file, printing one CSV line per
+   file and operation with the median and 99th percentile time of an
+   iteration in seconds and the throughput at the median in MB/s. */
+
+enum { OP_MAP, OP_ITERATE, OP_DECOMPOSE, OP_COMPOSE, OP_CASEFOLD, OP_GRAPHEMES, OP_CHARWIDTH, NUM_OPS };
+static const char *opnames[NUM_OPS] = {
+	 "map", "iterate", "decompose", "compose", "casefold", "graphemes", "charwidth"
+};
+
+/* keeps the compiler from optimizing the loops away */
+static volatile utf8proc_ssize_t sink;
+
+static int compare_times(const void *a, const void *b)
+{
+	 double x = *(const double *) a, y = *(const double *) b;
+	 return x < y ? -1 : x > y;
+}
+
+/* runs one iteration of op over src, returning its time in seconds */
+static double run(int op, const uint8_t *src, size_t len, int options,
+				      utf8proc_int32_t *buffer, utf8proc_int32_t *decomposed, utf8proc_ssize_t ndecomposed)
+{
+	 utf8proc_ssize_t pos = 0, n = 0;
+	 utf8proc_int32_t uc;
+	 uint8_t *dest;
+	 int state = 0;
+	 utf8proc_int32_t prev = -1;
+	 mytime start;
+	 if (op == OP_COMPOSE) memcpy(buffer, decomposed, (size_t) ndecomposed * sizeof(utf8proc_int32_t));
+	 start = gettime();
+	 switch (op) {
+	 case OP_MAP:
+		  n = utf8proc_map(src, (utf8proc_ssize_t) len, &dest, (utf8proc_option_t) options);
+		  free(dest);
+		  break;
+	 case OP_ITERATE:
+		  while (pos < (utf8proc_ssize_t) len) {
+			   pos += utf8proc_iterate(src + pos, (utf8proc_ssize_t) len - pos, &uc);
+			   n += uc;
+		  }
+		  break;
+	 case OP_DECOMPOSE:
+		  n = utf8proc_decompose(src, (utf8proc_ssize_t) len, buffer, ndecomposed,
+								  UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | (options & (UTF8PROC_COMPAT|UTF8PROC_STREAMSAFE)));
+		  break;
+	 case OP_COMPOSE:
+		  n = utf8proc_normalize_utf32(buffer, ndecomposed, UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+		  break;
+	 case OP_CASEFOLD:
+		  n = utf8proc_decompose(src, (utf8proc_ssize_t) len, buffer, 4 * ndecomposed, UTF8PROC_CASEFOLD);
+		  break;
+	 case OP_GRAPHEMES:
+		  while (pos < (utf8proc_ssize_t) len) {
+			   pos += utf8proc_iterate(src + pos, (utf8proc_ssize_t) len - pos, &uc);
+			   if (prev >= 0) n += utf8proc_grapheme_break_stateful(prev, uc, &state);
+			   prev = uc;
+		  }
+		  break;
+	 case OP_CHARWIDTH:
+		  while (pos < (utf8proc_ssize_t) len) {
+			   pos += utf8proc_iterate(src + pos, (utf8proc_ssize_t) len - pos, &uc);
+			   n += utf8proc_charwidth(uc);
+		  }
+		  break;
+	 }
+	 sink = n;
+	 return elapsed(gettime(), start);
+}
+
 int main(int argc, char **argv)
 {
-	 int i, j;
-	 int options = 0;
-	 
+	 int i, j, op;
+	 int options = 0, iterations = 50, warmup = 3;
+	 int ops[NUM_OPS] = {0}, anyop = 0;
+
+	 printf("file,op,bytes,iterations,median_s,p99_s,mb_per_s\n");
 	 for (i = 1; i < argc; ++i) {
 		  if (!strcmp(argv[i], "-nfkc")) {
 			   options |= UTF8PROC_STABLE|UTF8PROC_COMPOSE|UTF8PROC_COMPAT;
@@ -27,10 +98,33 @@ int main(int argc, char **argv)
 			   options |= UTF8PROC_STABLE|UTF8PROC_DECOMPOSE;
 			   continue;
 		  }
+		  if (!strcmp(argv[i], "-streamsafe")) {
+			   options |= UTF8PROC_STREAMSAFE;
+			   continue;
+		  }
 		  if (!strcmp(argv[i], "-casefold")) {
 			   options |= UTF8PROC_CASEFOLD;
 			   continue;
 		  }
+		  if (!strcmp(argv[i], "-iterations") && i + 1 < argc) {
+			   iterations = atoi(argv[++i]);
+			   if (iterations < 1) iterations = 1;
+			   continue;
+		  }
+		  if (!strcmp(argv[i], "-warmup") && i + 1 < argc) {
+			   warmup = atoi(argv[++i]);
+			   continue;
+		  }
+		  if (!strcmp(argv[i], "-op") && i + 1 < argc) {
+			   ++i;
+			   for (op = 0; op < NUM_OPS && strcmp(argv[i], opnames[op]); ++op) ;
+			   if (op == NUM_OPS) {
+				    fprintf(stderr, "unrecognized operation: %s\n", argv[i]);
+				    return EXIT_FAILURE;
+			   }
+			   ops[op] = anyop = 1;
+			   continue;
+		  }
 		  if (argv[i][0] == '-') {
 			   fprintf(stderr, "unrecognized option: %s\n", argv[i]);
 			   return EXIT_FAILURE;
@@ -42,13 +136,41 @@ int main(int argc, char **argv)
 			   fprintf(stderr, "error reading %s\n", argv[i]);
 			   return EXIT_FAILURE;
 		  }
-		  uint8_t *dest;
-		  mytime start = gettime();
-		  for (j = 0; j < 100; ++j) {
-			   utf8proc_map(src, len, &dest, options);
-			   free(dest);
+		  /* buffers for the decompose, compose and casefold operations, the
+		     casefolded string being at most 4 times the NFD one */
+		  utf8proc_ssize_t ndecomposed = utf8proc_decompose(src, (utf8proc_ssize_t) len, NULL, 0,
+			   UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | (options & (UTF8PROC_COMPAT|UTF8PROC_STREAMSAFE)));
+		  if (ndecomposed < 0) {
+			   fprintf(stderr, "error decomposing %s: %s\n", argv[i], utf8proc_errmsg(ndecomposed));
+			   return EXIT_FAILURE;
+		  }
+		  utf8proc_int32_t *buffer = (utf8proc_int32_t *) malloc(((size_t) ndecomposed * 4 + 1) * sizeof(utf8proc_int32_t));
+		  utf8proc_int32_t *decomposed = (utf8proc_int32_t *) malloc(((size_t) ndecomposed + 1) * sizeof(utf8proc_int32_t));
+		  double *times = (double *) malloc((size_t) iterations * sizeof(double));
+		  if (!buffer || !decomposed || !times) {
+			   fprintf(stderr, "out of memory\n");
+			   return EXIT_FAILURE;
+		  }
+		  utf8proc_decompose(src, (utf8proc_ssize_t) len, decomposed, ndecomposed,
+							 UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | (options & (UTF8PROC_COMPAT|UTF8PROC_STREAMSAFE)));
+
+		  for (op = 0; op < NUM_OPS; ++op) {
+			   if (anyop ? !ops[op] : op == OP_MAP && !options) continue;
+			   for (j = 0; j < warmup; ++j) {
+				    run(op, src, len, options, buffer, decomposed, ndecomposed);
+			   }
+			   for (j = 0; j < iterations; ++j) {
+				    times[j] = run(op, src, len, options, buffer, decomposed, ndecomposed);
+			   }
+			   qsort(times, (size_t) iterations, sizeof(double), compare_times);
+			   double median = times[iterations / 2];
+			   double p99 = times[(iterations * 99 + 99) / 100 - 1];
+			   printf("%s,%s,%lu,%d,%g,%g,%g\n", argv[i], opnames[op], (unsigned long) len,
+				       iterations, median, p99, median > 0 ? len / median * 1e-6 : 0);
 		  }
-		  printf("%s: %g\n", argv[i], elapsed(gettime(), start) / 100);
+		  free(times);
+		  free(decomposed);
+		  free(buffer);
 		  free(src);
 	 }
 
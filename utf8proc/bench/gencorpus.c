@@ -0,0 +1,180 @@
+/* Generates the synthetic corpora of the benchmarks, so that they can be
+   run without network access. The corpora are pseudo-random text of the
+   given size in UTF-8, identical for a given name, size and seed. Each
+   corpus models a script or stresses a part of the normalization. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8proc.h"
+
+static utf8proc_uint32_t seed;
+
+/* xorshift32, good enough for text and identical on every platform */
+static utf8proc_int32_t rnd(utf8proc_int32_t n)
+{
+	 seed ^= seed << 13;
+	 seed ^= seed >> 17;
+	 seed ^= seed << 5;
+	 return (utf8proc_int32_t) (seed % (utf8proc_uint32_t) n);
+}
+
+static utf8proc_int32_t pick(const utf8proc_int32_t *chars, size_t n)
+{
+	 return chars[rnd((utf8proc_int32_t) n)];
+}
+
+#define PICK(chars) pick(chars, sizeof(chars) / sizeof(chars[0]))
+
+static const utf8proc_int32_t german[] = {
+	 0xE4, 0xF6, 0xFC, 0xDF, 0xC4, 0xD6, 0xDC, 0xE9
+};
+static const utf8proc_int32_t vietnamese[] = {
+	 0xE0, 0xE1, 0xE2, 0xE3, 0xE8, 0xE9, 0xEA, 0xEC, 0xED, 0xF2, 0xF3, 0xF4,
+	 0xF5, 0xF9, 0xFA, 0xFD, 0x103, 0x111, 0x129, 0x169, 0x1A1, 0x1B0
+};
+static const utf8proc_int32_t marks[] = {
+	 0x300, 0x301, 0x302, 0x303, 0x308, 0x30A, 0x31B, 0x323, 0x327, 0x328,
+	 0x331, 0x345, 0x5B0, 0x5BC, 0x5C1, 0x64E, 0x651, 0x93C, 0x94D, 0x3099
+};
+/* marks in decreasing canonical combining class */
+static const utf8proc_int32_t descending[] = {
+	 0x345, 0x301, 0x323, 0x328, 0x5B0, 0x94D, 0x3099
+};
+static const utf8proc_int32_t composable[] = {
+	 0x300, 0x301, 0x302, 0x303, 0x308, 0x30A, 0x30C, 0x323, 0x327
+};
+static const utf8proc_int32_t compat[] = {
+	 0xA0, 0xB2, 0xB5, 0xBD, 0x132, 0x1C6, 0x2002, 0x2026, 0x2122, 0x2160,
+	 0x2460, 0x2474, 0x3000, 0x3300, 0x33A1, 0xFB00, 0xFB01, 0xFB03, 0xFDFA,
+	 0xFE30, 0xFF21, 0xFF41, 0xFF10, 0xFF66, 0xFF76, 0xFF9E, 0x1D400, 0x1F100
+};
+
+/* writes uc to out, returning the number of bytes written */
+static size_t put(FILE *out, utf8proc_int32_t uc)
+{
+	 utf8proc_uint8_t buf[4];
+	 utf8proc_ssize_t n = utf8proc_encode_char(uc, buf);
+	 fwrite(buf, 1, (size_t) n, out);
+	 return (size_t) n;
+}
+
+static utf8proc_int32_t letter(void)
+{
+	 return 'a' + rnd(26);
+}
+
+/* writes a word of the named corpus, returning the number of bytes */
+static size_t word(FILE *out, const char *name)
+{
+	 size_t n = 0;
+	 int i, j, len = 1 + rnd(8);
+	 for (i = 0; i < len; i++) {
+		  if (!strcmp(name, "ascii")) {
+			   n += put(out, letter());
+		  } else if (!strcmp(name, "deutsch")) {
+			   n += put(out, rnd(16) ? letter() : PICK(german));
+		  } else if (!strcmp(name, "vietnamese")) {
+			   /* precomposed letters with one or two diacritics */
+			   n += put(out, rnd(5) > 1 ? letter() : rnd(2) ? PICK(vietnamese) : 0x1EA0 + rnd(0x5A));
+		  } else if (!strcmp(name, "japanese")) {
+			   n += put(out, rnd(3) ? 0x4E00 + rnd(0x5200) : 0x3041 + rnd(0x56));
+		  } else if (!strcmp(name, "korean")) {
+			   n += put(out, 0xAC00 + rnd(11172));
+		  } else if (!strcmp(name, "jamo")) {
+			   /* conjoining jamo composing to syllables */
+			   n += put(out, 0x1100 + rnd(19));
+			   n += put(out, 0x1161 + rnd(21));
+			   if (rnd(2)) n += put(out, 0x11A8 + rnd(27));
+		  } else if (!strcmp(name, "emoji")) {
+			   switch (rnd(4)) {
+			   case 0:
+				    n += put(out, 0x1F466 + rnd(4));
+				    n += put(out, 0x1F3FB + rnd(5));
+				    break;
+			   case 1:
+				    n += put(out, 0x1F468);
+				    n += put(out, 0x200D);
+				    n += put(out, 0x1F469);
+				    n += put(out, 0x200D);
+				    n += put(out, 0x1F466 + rnd(2));
+				    break;
+			   case 2:
+				    n += put(out, 0x1F1E6 + rnd(26));
+				    n += put(out, 0x1F1E6 + rnd(26));
+				    break;
+			   default:
+				    n += put(out, 0x1F600 + rnd(0x50));
+			   }
+		  } else if (!strcmp(name, "combining")) {
+			   /* runs of marks in arbitrary order to be reordered */
+			   n += put(out, letter());
+			   for (j = rnd(7); j > 0; j--) n += put(out, PICK(marks));
+		  } else if (!strcmp(name, "decomposed")) {
+			   /* NFD text to be composed */
+			   n += put(out, letter());
+			   for (j = rnd(3); j > 0; j--) n += put(out, PICK(composable));
+		  } else if (!strcmp(name, "compat")) {
+			   n += put(out, rnd(3) ? letter() : PICK(compat));
+		  } else if (!strcmp(name, "pathological")) {
+			   /* long runs of marks mostly out of canonical order, which
+			      take quadratic time to sort by swapping neighbours */
+			   n += put(out, letter());
+			   for (j = 0; j < 1000; j++) n += put(out, descending[j % 7]);
+		  }
+	 }
+	 return n;
+}
+
+static const char *names[] = {
+	 "ascii", "deutsch", "vietnamese", "japanese", "korean", "jamo",
+	 "emoji", "combining", "decomposed", "compat", "pathological"
+};
+
+int main(int argc, char **argv)
+{
+	 size_t size = 400000, n = 0;
+	 unsigned long seedarg = 1;
+	 const char *name = NULL;
+	 int i;
+	 for (i = 1; i < argc; ++i) {
+		  if (!strcmp(argv[i], "-size") && i + 1 < argc) {
+			   size = strtoul(argv[++i], NULL, 10);
+		  } else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+			   seedarg = strtoul(argv[++i], NULL, 10);
+		  } else if (argv[i][0] == '-' || name) {
+			   fprintf(stderr, "usage: gencorpus ?-size BYTES? ?-seed N? NAME\n");
+			   return EXIT_FAILURE;
+		  } else {
+			   name = argv[i];
+		  }
+	 }
+	 for (i = 0; name && i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+		  if (!strcmp(name, names[i])) break;
+	 }
+	 if (!name || i == (int) (sizeof(names) / sizeof(names[0]))) {
+		  fprintf(stderr, "corpus must be one of");
+		  for (i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) fprintf(stderr, " %s", names[i]);
+		  fprintf(stderr, "\n");
+		  return EXIT_FAILURE;
+	 }
+	 /* a different sequence for each corpus, never the zero state */
+	 seed = (utf8proc_uint32_t) (seedarg * 2654435761u + (unsigned long) i + 1);
+	 if (!seed) seed = 1;
+	 while (n < size) {
+		  n += word(stdout, name);
+		  switch (rnd(12)) {
+		  case 0:
+			   n += put(stdout, '\n');
+			   break;
+		  case 1:
+			   n += put(stdout, !strcmp(name, "japanese") ? 0x3002 : '.');
+			   n += put(stdout, !strcmp(name, "japanese") ? 0x3000 : ' ');
+			   break;
+		  default:
+			   n += put(stdout, !strcmp(name, "japanese") ? 0x3001 : ' ');
+		  }
+	 }
+	 return EXIT_SUCCESS;
+}
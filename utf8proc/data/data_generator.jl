@@ -79,6 +79,59 @@ let grapheme_boundclasses = read_grapheme_boundclasses("GraphemeBreakProperty.tx
     end
 end
 
+#-------------------------------------------------------------------------------
+function read_word_breaks(filename)
+    word_breaks = Dict{UInt32, String}()
+    for (r,desc) in read_hex_ranges(filename)
+        set_all!(word_breaks, r, Base.uppercase(desc))
+    end
+    return word_breaks
+end
+
+let word_breaks = read_word_breaks("WordBreakProperty.txt")
+    global function get_word_break(code)
+        get(word_breaks, code, "OTHER")
+    end
+end
+
+#-------------------------------------------------------------------------------
+function read_sentence_breaks(filename)
+    sentence_breaks = Dict{UInt32, String}()
+    for (r,desc) in read_hex_ranges(filename)
+        set_all!(sentence_breaks, r, Base.uppercase(desc))
+    end
+    return sentence_breaks
+end
+
+let sentence_breaks = read_sentence_breaks("SentenceBreakProperty.txt")
+    global function get_sentence_break(code)
+        get(sentence_breaks, code, "OTHER")
+    end
+end
+
+#-------------------------------------------------------------------------------
+function read_line_breaks(filename)
+    line_breaks = Dict{UInt32, String}()
+    # Unlisted code points have the default values of the @missing lines,
+    # e.g. ID for those reserved in the CJK and pictographic blocks
+    for line in readlines(filename)
+        m = match(r"^# @missing: ([0-9A-F]+)\.\.([0-9A-F]+) *; *(\w+)", line)
+        if !isnothing(m) && m[3] != "XX"
+            set_all!(line_breaks, parsehex(m[1]):parsehex(m[2]), m[3])
+        end
+    end
+    for (r,desc) in read_hex_ranges(filename)
+        set_all!(line_breaks, r, desc)
+    end
+    return line_breaks
+end
+
+let line_breaks = read_line_breaks("LineBreak.txt")
+    global function get_line_break(code)
+        get(line_breaks, code, "XX")
+    end
+end
+
 #-------------------------------------------------------------------------------
 function read_composition_exclusions(pattern)
     section = match(pattern, read("CompositionExclusions.txt",String)).match
@@ -112,6 +165,47 @@ let case_folding = read_case_folding("CaseFolding.txt")
     end
 end
 
+#-------------------------------------------------------------------------------
+# Confusable prototypes from UTS #39: Unicode Security Mechanisms
+function read_confusables(filename)
+    confusables = Dict{UInt32,Vector{UInt32}}()
+    for line in readlines(filename)
+        m = match(r"^([0-9A-F]+) ;\t([0-9A-F ]+) ;\tMA"i, line)
+        !isnothing(m) || continue
+        confusables[parsehex(m[1])] = parsehex.(split(m[2]))
+    end
+    confusables
+end
+
+confusables = read_confusables("confusables.txt")
+
+#-------------------------------------------------------------------------------
+# Bidi_Mirroring_Glyph and Bidi_Paired_Bracket_Type from UAX #9
+function read_bidi_mirroring(filename)
+    mirroring = Dict{UInt32,UInt32}()
+    for line in readlines(filename)
+        m = match(r"^([0-9A-F]+); ([0-9A-F]+)"i, line)
+        !isnothing(m) || continue
+        mirroring[parsehex(m[1])] = parsehex(m[2])
+    end
+    mirroring
+end
+
+function read_bidi_brackets(filename, mirroring)
+    brackets = Dict{UInt32,Int}()
+    for line in readlines(filename)
+        m = match(r"^([0-9A-F]+); ([0-9A-F]+); ([oc])"i, line)
+        !isnothing(m) || continue
+        # the paired bracket is always the mirroring glyph
+        @assert get(mirroring, parsehex(m[1]), nothing) == parsehex(m[2])
+        brackets[parsehex(m[1])] = m[3] == "o" ? 1 : 2
+    end
+    brackets
+end
+
+bidi_mirroring = read_bidi_mirroring("BidiMirroring.txt")
+bidi_brackets = read_bidi_brackets("BidiBrackets.txt", bidi_mirroring)
+
 #-------------------------------------------------------------------------------
 # Utilities for reading per-char properties from UnicodeData.txt
 function split_unicode_data_line(line)
@@ -286,6 +380,33 @@ let
     end
 end
 
+# Full canonical, or with compat also compatibility, decomposition of a
+# character in canonical order, including that of Hangul syllables.
+function full_decomposition(code, compat)
+    sindex = code - 0xAC00
+    if 0 <= sindex < 11172
+        seq = [0x1100 + sindex ÷ 588, 0x1161 + (sindex % 588) ÷ 28]
+        sindex % 28 != 0 && push!(seq, 0x11A7 + sindex % 28)
+        return seq
+    end
+    char = get(char_hash, code, nothing)
+    if isnothing(char) || isnothing(char.decomp_mapping) ||
+            (!compat && !isnothing(char.decomp_type))
+        return [code]
+    end
+    seq = reduce(vcat, [full_decomposition(c, compat) for c in char.decomp_mapping])
+    ccc(c) = haskey(char_hash, c) ? char_hash[c].combining_class : 0
+    # Stable sort of each run of non-starters by combining class
+    for i in 2:length(seq)
+        j = i
+        while j > 1 && ccc(seq[j]) != 0 && ccc(seq[j-1]) > ccc(seq[j])
+            seq[j-1], seq[j] = seq[j], seq[j-1]
+            j -= 1
+        end
+    end
+    return seq
+end
+
 utf16_encode(utf32_seq) = transcode(UInt16, transcode(String, utf32_seq))
 
 # Utility for packing all UTF-16 encoded sequences into one big array
@@ -341,6 +462,10 @@ function char_table_properties!(sequences, char)
         bidi_class           = char.bidi_class,
         decomp_type          = char.decomp_type,
         decomp_seqindex      = encode_sequence!(sequences, char.decomp_mapping),
+        canonical_decomp     = isnothing(char.decomp_mapping) || !isnothing(char.decomp_type) ?
+                               nothing : full_decomposition(code, false),
+        compat_decomp        = isnothing(char.decomp_mapping) ?
+                               nothing : full_decomposition(code, true),
         casefold_seqindex    = encode_sequence!(sequences, get_case_folding(code)),
         uppercase_seqindex   = encode_sequence!(sequences, char.uppercase_mapping),
         lowercase_seqindex   = encode_sequence!(sequences, char.lowercase_mapping),
@@ -357,25 +482,68 @@ function char_table_properties!(sequences, char)
         ambiguous_width      = is_ambiguous_width(code),
         boundclass           = get_grapheme_boundclass(code),
         indic_conjunct_break = get_indic_conjunct_break(code),
+        wordbreak            = get_word_break(code),
+        linebreak            = get_line_break(code),
+        sentencebreak        = get_sentence_break(code),
     )
 end
 
+# Unassigned code points share the properties at index 0, except for those
+# with a Line_Break other than XX or that are Extended_Pictographic, which
+# UAX #14 needs (LB1, LB30b).  These get rows that differ from index 0 only
+# in these properties.
+function unassigned_table_properties(code)
+    return (
+        category             = "Cn",
+        combining_class      = 0,
+        bidi_class           = nothing,
+        decomp_type          = nothing,
+        decomp_seqindex      = typemax(UInt16),
+        canonical_decomp     = nothing,
+        compat_decomp        = nothing,
+        casefold_seqindex    = typemax(UInt16),
+        uppercase_seqindex   = typemax(UInt16),
+        lowercase_seqindex   = typemax(UInt16),
+        titlecase_seqindex   = typemax(UInt16),
+        comb_index           = 0x3FF,
+        comb_length          = 0,
+        comb_issecond        = false,
+        bidi_mirrored        = false,
+        comp_exclusion       = false,
+        ignorable            = false,
+        control_boundary     = false,
+        charwidth            = 1,
+        ambiguous_width      = false,
+        boundclass           = get_grapheme_boundclass(code),
+        indic_conjunct_break = "NONE",
+        wordbreak            = "OTHER",
+        linebreak            = get_line_break(code),
+        sentencebreak        = "OTHER",
+    )
+end
+
+unassigned_codes = [code for code in 0x000000:0x10FFFF if !haskey(char_hash, code) &&
+                    (get_line_break(code) != "XX" ||
+                     get_grapheme_boundclass(code) == "EXTENDED_PICTOGRAPHIC")]
+
 # Many character properties are duplicates. Deduplicate them, constructing a
 # per-character array of indicies into the properties array
 sequences = UTF16Sequences()
-char_table_props = [char_table_properties!(sequences, cp) for cp in char_props]
+table_codes = vcat([char.code for char in char_props], unassigned_codes)
+char_table_props = vcat([char_table_properties!(sequences, cp) for cp in char_props],
+                        [unassigned_table_properties(code) for code in unassigned_codes])
 
 deduplicated_props = Origin(0)(Vector{eltype(char_table_props)}())
 char_property_indices = Origin(0)(zeros(Int, 0x00110000))
 let index_map = Dict{eltype(char_table_props),Int}()
-    for (char, table_props) in zip(char_props, char_table_props)
+    for (code, table_props) in zip(table_codes, char_table_props)
         entry_idx = get!(index_map, table_props) do
             idx = length(deduplicated_props)
             push!(deduplicated_props, table_props)
             idx
         end
-        # Add 1 because unassigned codes occupy slot at index 0
-        char_property_indices[char.code] = entry_idx + 1
+        # Add 1 because the remaining unassigned codes occupy slot at index 0
+        char_property_indices[code] = entry_idx + 1
     end
 end
 
@@ -397,6 +565,26 @@ let
     end
 end
 
+# The confusable prototypes are looked up by binary search on the sorted
+# source codepoints; the prototype of the i-th one is the UTF-16 encoded
+# sequence between the i-th and (i+1)-th confusable indices.
+confusable_codes = sort!(collect(keys(confusables)))
+confusable_indices = Int[]
+confusable_sequences = UInt16[]
+for code in confusable_codes
+    push!(confusable_indices, length(confusable_sequences))
+    append!(confusable_sequences, utf16_encode(confusables[code]))
+end
+push!(confusable_indices, length(confusable_sequences))
+@assert length(confusable_sequences) <= typemax(UInt16)
+
+# The mirroring glyphs are looked up by binary search as well; the bracket
+# type is 1 for opening and 2 for closing paired brackets, whose paired
+# bracket is their mirroring glyph.
+mirroring_codes = sort!(collect(keys(bidi_mirroring)))
+mirroring_glyphs = [bidi_mirroring[code] for code in mirroring_codes]
+mirroring_brackets = [get(bidi_brackets, code, 0) for code in mirroring_codes]
+
 #-------------------------------------------------------------------------------
 function write_c_index_array(io, array, linelen)
     print(io, "{\n  ")
@@ -436,10 +624,15 @@ function print_c_data_tables(io, sequences, prop_page_indices, prop_pages, dedup
     write_c_index_array(io, prop_page_indices, 8)
     print(io, "static const utf8proc_uint16_t utf8proc_stage2table[] = ")
     write_c_index_array(io, prop_pages, 8)
+    # Single-stage index of the BMP, for builds with UTF8PROC_BMP_INDEX
+    print(io, "#ifdef UTF8PROC_BMP_INDEX\n")
+    print(io, "static const utf8proc_uint16_t utf8proc_bmp_index[] = ")
+    write_c_index_array(io, [char_property_indices[code] for code in 0:0xFFFF], 8)
+    print(io, "#endif\n\n")
 
     print(io, """
         static const utf8proc_property_t utf8proc_properties[] = {
-          {0, 0, 0, 0, UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX,  0x3FF,0,false,  false,false,false,false, 1, 0, 0, UTF8PROC_BOUNDCLASS_OTHER, UTF8PROC_INDIC_CONJUNCT_BREAK_NONE},
+          {0, 0, 0, 0, UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX, UINT16_MAX,  0x3FF,0,false,  false,false,false,false, 1, 0, 0, UTF8PROC_BOUNDCLASS_OTHER, UTF8PROC_INDIC_CONJUNCT_BREAK_NONE, UTF8PROC_WORDBREAK_OTHER, UTF8PROC_LINEBREAK_XX, UTF8PROC_SENTENCEBREAK_OTHER},
         """)
     for prop in deduplicated_props
         print(io, "  {",
@@ -463,12 +656,64 @@ function print_c_data_tables(io, sequences, prop_page_indices, prop_pages, dedup
               prop.ambiguous_width, ", ",
               "0, ", # bitfield padding
               c_enum_name("BOUNDCLASS", prop.boundclass), ", ",
-              c_enum_name("INDIC_CONJUNCT_BREAK", prop.indic_conjunct_break),
+              c_enum_name("INDIC_CONJUNCT_BREAK", prop.indic_conjunct_break), ", ",
+              c_enum_name("WORDBREAK", prop.wordbreak), ", ",
+              c_enum_name("LINEBREAK", prop.linebreak), ", ",
+              c_enum_name("SENTENCEBREAK", prop.sentencebreak),
               "},\n"
         )
     end
     print(io, "};\n\n")
 
+    # The fields of each property row read by the normalization and grapheme
+    # break loops, packed into 32 bits per row (utf8proc_hotprop_t).
+    print(io, """
+        static const utf8proc_hotprop_t utf8proc_hot_properties[] = {
+          {0, 0, UTF8PROC_BOUNDCLASS_OTHER, UTF8PROC_INDIC_CONJUNCT_BREAK_NONE, false, false, false, false, false, false},
+        """)
+    for prop in deduplicated_props
+        has_decomp = prop.decomp_seqindex != typemax(UInt16)
+        print(io, "  {",
+              c_enum_name("CATEGORY", prop.category), ", ",
+              prop.combining_class, ", ",
+              c_enum_name("BOUNDCLASS", prop.boundclass), ", ",
+              c_enum_name("INDIC_CONJUNCT_BREAK", prop.indic_conjunct_break), ", ",
+              prop.comb_issecond, ", ",
+              prop.comb_index != 0x3FF, ", ",
+              has_decomp && isnothing(prop.decomp_type), ", ",
+              has_decomp && !isnothing(prop.decomp_type), ", ",
+              prop.casefold_seqindex != typemax(UInt16), ", ",
+              prop.ignorable,
+              "},\n"
+        )
+    end
+    print(io, "};\n\n")
+
+    # The full decompositions of each property row, canonical and then
+    # compatibility, as offsets into utf8proc_decompositions where each
+    # sequence is preceded by its length.
+    decompositions = Int[]
+    decompositions_index = String[c_uint16(typemax(UInt16)), c_uint16(typemax(UInt16))]
+    decomposition_offsets = Dict{Vector{Int},Int}()
+    for prop in deduplicated_props, seq in (prop.canonical_decomp, prop.compat_decomp)
+        if isnothing(seq)
+            push!(decompositions_index, c_uint16(typemax(UInt16)))
+            continue
+        end
+        offset = get!(decomposition_offsets, seq) do
+            o = length(decompositions)
+            push!(decompositions, length(seq))
+            append!(decompositions, seq)
+            o
+        end
+        push!(decompositions_index, c_uint16(offset))
+    end
+    @assert length(decompositions) < typemax(UInt16)
+    print(io, "static const utf8proc_int32_t utf8proc_decompositions[] = ")
+    write_c_index_array(io, decompositions, 8)
+    print(io, "static const utf8proc_uint16_t utf8proc_decompositions_index[] = ")
+    write_c_index_array(io, decompositions_index, 8)
+
     print(io, "static const utf8proc_int32_t utf8proc_combinations_second[] = {\n")
     for dm0 in sort!(collect(keys(comb_mapping)))
         print(io, " ");
@@ -489,6 +734,19 @@ function print_c_data_tables(io, sequences, prop_page_indices, prop_pages, dedup
         print(io, "\n");
     end
     print(io, "};\n\n")
+
+    print(io, "static const utf8proc_int32_t utf8proc_confusables_codes[] = ")
+    write_c_index_array(io, confusable_codes, 8)
+    print(io, "static const utf8proc_uint16_t utf8proc_confusables_indices[] = ")
+    write_c_index_array(io, confusable_indices, 8)
+    print(io, "static const utf8proc_uint16_t utf8proc_confusables_sequences[] = ")
+    write_c_index_array(io, confusable_sequences, 8)
+    print(io, "static const utf8proc_int32_t utf8proc_mirroring_codes[] = ")
+    write_c_index_array(io, mirroring_codes, 8)
+    print(io, "static const utf8proc_int32_t utf8proc_mirroring_glyphs[] = ")
+    write_c_index_array(io, mirroring_glyphs, 8)
+    print(io, "static const utf8proc_uint8_t utf8proc_mirroring_brackets[] = ")
+    write_c_index_array(io, mirroring_brackets, 8)
 end
 
 
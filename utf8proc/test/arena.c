@@ -0,0 +1,56 @@
+#include "tests.h"
+
+static void check_arena_map(utf8proc_arena_t *arena, const char *input, utf8proc_option_t options)
+{
+    const utf8proc_uint8_t *output;
+    utf8proc_uint8_t *correct;
+    utf8proc_ssize_t len = utf8proc_map_arena((const utf8proc_uint8_t *) input, (utf8proc_ssize_t) strlen(input),
+                                              &output, options, NULL, NULL, arena);
+    utf8proc_ssize_t correctlen = utf8proc_map((const utf8proc_uint8_t *) input, (utf8proc_ssize_t) strlen(input),
+                                               &correct, options);
+    check(len == correctlen, "map_arena returned %d instead of %d for \"%s\"", (int) len, (int) correctlen, input);
+    check(!strcmp((const char *) output, (const char *) correct), "incorrect output for \"%s\"", input);
+    free(correct);
+}
+
+int main(void)
+{
+    utf8proc_arena_t arena;
+    const utf8proc_uint8_t *output;
+    char big[4096];
+    void *buffer;
+
+    utf8proc_arena_init(&arena, 1024);
+    check(arena.buffer == NULL && arena.size == 0, "arena not empty after init");
+
+    /* the composed and the decomposed paths, with and without custom options */
+    check_arena_map(&arena, "caf\xc3\xa9!", UTF8PROC_DECOMPOSE);
+    check_arena_map(&arena, "cafe\xcc\x81!", UTF8PROC_COMPOSE);
+    check_arena_map(&arena, "\xef\xac\x81 \xe2\x84\xab", UTF8PROC_COMPOSE | UTF8PROC_COMPAT | UTF8PROC_CASEFOLD);
+    check_arena_map(&arena, "a\r\nb", UTF8PROC_COMPOSE | UTF8PROC_NLF2LS);
+    check_arena_map(&arena, "", UTF8PROC_COMPOSE);
+
+    /* the memory is reused for strings that fit */
+    buffer = arena.buffer;
+    check_arena_map(&arena, "abc", UTF8PROC_COMPOSE);
+    check(arena.buffer == buffer, "arena memory not reused");
+
+    /* memory above the limit is released by the next call */
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    check_arena_map(&arena, big, UTF8PROC_DECOMPOSE);
+    check(arena.size > 1024, "arena not grown to %d bytes", (int) arena.size);
+    check_arena_map(&arena, "abc", UTF8PROC_COMPOSE);
+    check(arena.size <= 1024, "arena memory above the limit not released");
+
+    /* errors leave the arena usable */
+    check(utf8proc_map_arena((const utf8proc_uint8_t *) "\xff", 1, &output, UTF8PROC_COMPOSE,
+                             NULL, NULL, &arena) == UTF8PROC_ERROR_INVALIDUTF8 && output == NULL,
+          "invalid UTF-8 not rejected");
+    check_arena_map(&arena, "abc", UTF8PROC_COMPOSE);
+
+    utf8proc_arena_release(&arena);
+    check(arena.buffer == NULL && arena.size == 0, "arena not empty after release");
+    printf("Arena tests SUCCEEDED.\n");
+    return 0;
+}
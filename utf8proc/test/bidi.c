@@ -0,0 +1,60 @@
+#include "tests.h"
+
+static void check_levels(int level, const char *expected, utf8proc_ssize_t n, ...)
+{
+    utf8proc_int32_t buffer[16];
+    utf8proc_uint8_t levels[16];
+    char got[64];
+    utf8proc_ssize_t i, ret;
+    va_list ap;
+
+    va_start(ap, n);
+    for (i = 0; i < n; i++) buffer[i] = va_arg(ap, utf8proc_int32_t);
+    va_end(ap);
+    ret = utf8proc_bidi_levels(buffer, n, level, levels);
+    check(ret == 0, "bidi_levels failed: %s", utf8proc_errmsg(ret));
+    for (i = 0; i < n; i++) sprintf(got + 2 * i, "%d ", levels[i]);
+    got[n > 0 ? 2 * n - 1 : 0] = 0;
+    check(!strcmp(got, expected), "levels \"%s\" instead of \"%s\"", got, expected);
+}
+
+int main(void)
+{
+    utf8proc_int32_t buffer[] = { 'a', 'b', ' ', 0x05D0, 0x05D1 };
+    utf8proc_uint8_t levels[5];
+    utf8proc_ssize_t order[5];
+
+    /* mixed text and numbers, P2/P3 and explicit paragraph levels */
+    check_levels(-1, "0 0 0 0 1 1 1 1 2 2", 10,
+                 'a', 'b', 'c', ' ', 0x05D0, 0x05D1, 0x05D2, ' ', '1', '2');
+    check_levels(1, "2 2 2 1 1 1 1 1 2 2", 10,
+                 'a', 'b', 'c', ' ', 0x05D0, 0x05D1, 0x05D2, ' ', '1', '2');
+    check_levels(-1, "1 1 2 2", 4, 0x0628, ' ', '1', '2');
+    check_levels(0, "0 0 0 0 1 1 2 2", 8, '1', '.', '2', ' ', 0x05D0, ' ', '3', '%');
+    /* paired brackets (N0) */
+    check_levels(0, "1 0 0 0 1", 5, 0x05D0, '(', 'b', ')', 0x05D2);
+    check_levels(-1, "0 0 0 1 0", 5, 'a', ' ', '(', 0x05D0, ')');
+    /* embeddings and isolates */
+    check_levels(0, "0 2 2 0", 4, 0x202B, 'a', 0x202C, 'b');
+    check_levels(1, "1 1 1 2 2 2 1 1 1", 9,
+                 0x05D0, ' ', 0x2066, 'b', ' ', 'c', 0x2069, ' ', 0x05D2);
+    /* paragraphs are resolved separately */
+    check_levels(-1, "1 1 0", 3, 0x05D0, 0x2029, 'a');
+    check_levels(-1, "", 0);
+
+    check(utf8proc_bidi_levels(buffer, 5, 2, levels) == UTF8PROC_ERROR_INVALIDOPTS,
+          "no error for invalid paragraph level");
+
+    check(!utf8proc_bidi_levels(buffer, 5, 0, levels), "bidi_levels failed");
+    utf8proc_bidi_reorder(buffer, levels, 5, order);
+    check(order[0] == 0 && order[1] == 1 && order[2] == 2 && order[3] == 4 && order[4] == 3,
+          "wrong visual order");
+
+    check(utf8proc_bidi_mirror('(') == ')' && utf8proc_bidi_mirror(')') == '(',
+          "wrong mirror of parentheses");
+    check(utf8proc_bidi_mirror(0x2329) == 0x232A, "wrong mirror of U+2329");
+    check(utf8proc_bidi_mirror('a') == 'a', "wrong mirror of 'a'");
+
+    printf("Bidi tests SUCCEEDED.\n");
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "tests.h"
+
+static void check_skeleton(const char *a, const char *b, int confusable)
+{
+    utf8proc_uint8_t *sa, *sb;
+    utf8proc_ssize_t la = utf8proc_skeleton((const utf8proc_uint8_t *) a, (utf8proc_ssize_t) strlen(a), &sa);
+    utf8proc_ssize_t lb = utf8proc_skeleton((const utf8proc_uint8_t *) b, (utf8proc_ssize_t) strlen(b), &sb);
+    check(la >= 0, "skeleton failed for \"%s\": %s", a, utf8proc_errmsg(la));
+    check(lb >= 0, "skeleton failed for \"%s\": %s", b, utf8proc_errmsg(lb));
+    check((la == lb && !memcmp(sa, sb, (size_t) la)) == confusable,
+          "\"%s\" and \"%s\" %s confusable", a, b, confusable ? "not" : "wrongly");
+    free(sa);
+    free(sb);
+}
+
+int main(void)
+{
+    utf8proc_uint8_t *s;
+
+    /* Latin vs Cyrillic/Greek lookalikes */
+    check_skeleton("paypal", "\xd1\x80\xd0\xb0y\xd1\x80\xd0\xb0l", 1);
+    check_skeleton("scope", "\xd1\x95\xd1\x81\xce\xbf\xd1\x80\xd0\xb5", 1);
+    /* digits and letters */
+    check_skeleton("l0l", "1OI", 1);
+    check_skeleton("rn", "m", 1);
+    /* decomposed and precomposed forms */
+    check_skeleton("caf\xc3\xa9", "cafe\xcc\x81", 1);
+    check_skeleton("hello", "world", 0);
+    check_skeleton("", "", 1);
+
+    /* the skeleton of an ASCII letter is itself */
+    check(utf8proc_skeleton((const utf8proc_uint8_t *) "a", 1, &s) == 1 && !strcmp((char *) s, "a"),
+          "wrong skeleton for \"a\"");
+    free(s);
+
+    check(utf8proc_skeleton((const utf8proc_uint8_t *) "\xff", 1, &s) == UTF8PROC_ERROR_INVALIDUTF8,
+          "no error for invalid UTF-8");
+
+    /* skeletons in an arena match the allocated ones, including ones
+       growing the arena beyond twice the length of the string */
+    {
+        static const char *strings[] = {
+            "paypal", "\xef\xb7\xba\xef\xb7\xba\xef\xb7\xba", "a", "",
+            "\xea\xb0\x80\xcc\x81\xcc\x96 caf\xc3\xa9"
+        };
+        utf8proc_arena_t arena;
+        const utf8proc_uint8_t *sa;
+        utf8proc_ssize_t la, l;
+        size_t i;
+        utf8proc_arena_init(&arena, 0);
+        for (i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+            l = utf8proc_skeleton((const utf8proc_uint8_t *) strings[i], (utf8proc_ssize_t) strlen(strings[i]), &s);
+            la = utf8proc_skeleton_arena((const utf8proc_uint8_t *) strings[i],
+                                         (utf8proc_ssize_t) strlen(strings[i]), &sa, &arena);
+            check(l >= 0 && la == l && !memcmp(s, sa, (size_t) l + 1),
+                  "arena skeleton differs for string %d", (int) i);
+            free(s);
+        }
+        check(utf8proc_skeleton_arena((const utf8proc_uint8_t *) "\xff", 1, &sa, &arena) == UTF8PROC_ERROR_INVALIDUTF8,
+              "no error for invalid UTF-8 in arena");
+        utf8proc_arena_release(&arena);
+    }
+
+    printf("Confusables tests SUCCEEDED.\n");
+    return 0;
+}
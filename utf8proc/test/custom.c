@@ -12,6 +12,12 @@ static utf8proc_int32_t custom(utf8proc_int32_t codepoint, void *thunk)
     return codepoint;
 }
 
+static utf8proc_int32_t remove_zwsp(utf8proc_int32_t codepoint, void *thunk)
+{
+    (void) thunk; /* unused */
+    return codepoint == 0x200b ? UTF8PROC_CUSTOM_REMOVE : codepoint;
+}
+
 int main(void)
 {
     utf8proc_uint8_t input[] = {0x41,0x61,0x53,0x62,0xef,0xbd,0x81,0x00}; /* "AaSb\uff41" */
@@ -23,6 +29,18 @@ int main(void)
     check(strlen((char*) output) == 6, "incorrect output length");
     check(!memcmp(correct, output, 7), "incorrect output data");
     free(output);
+    {
+        /* "e\u200b\u0301x\u200b" with the ZWSPs removed before composition */
+        utf8proc_uint8_t input2[] = {0x65,0xe2,0x80,0x8b,0xcc,0x81,0x78,0xe2,0x80,0x8b,0x00};
+        utf8proc_uint8_t correct2[] = {0xc3,0xa9,0x78,0x00};
+        utf8proc_ssize_t len;
+        len = utf8proc_map_custom(input2, 0, &output, UTF8PROC_COMPOSE | UTF8PROC_NULLTERM, remove_zwsp, NULL);
+        check(len == 3 && !memcmp(correct2, output, 4), "incorrect output with removed codepoints");
+        free(output);
+        len = utf8proc_map_custom(input2, 0, &output, UTF8PROC_DECOMPOSE | UTF8PROC_NULLTERM, remove_zwsp, NULL);
+        check(len == 4 && !memcmp("e\xcc\x81x", output, 5), "incorrect decomposed output with removed codepoints");
+        free(output);
+    }
     printf("map_custom tests SUCCEEDED.\n");
     return 0;
 }
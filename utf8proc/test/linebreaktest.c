@@ -0,0 +1,103 @@
+#include "tests.h"
+
+/* check one line in the format of LineBreakTest.txt */
+void checkline(const char *_buf, bool verbose) {
+    size_t bi = 0, si = 0, nbreaks = 0, i;
+    utf8proc_uint8_t src[1024]; /* more than long enough for all of our tests */
+    utf8proc_ssize_t breaks[256], pos;
+    const unsigned char *buf = (const unsigned char *) _buf;
+
+    while (buf[bi]) {
+        bi = skipspaces(buf, bi);
+        if (buf[bi] == 0xc3 && buf[bi+1] == 0xb7) { /* U+00f7 = break opportunity */
+            breaks[nbreaks++] = (utf8proc_ssize_t) si;
+            bi += 2;
+        }
+        else if (buf[bi] == 0xc3 && buf[bi+1] == 0x97) { /* U+00d7 = no break */
+            bi += 2;
+        }
+        else if (buf[bi] == '#') { /* start of comments */
+            break;
+        }
+        else if (buf[bi] == '/') { /* for convenience, also accept / as break opportunity */
+            breaks[nbreaks++] = (utf8proc_ssize_t) si;
+            bi += 1;
+        }
+        else { /* hex-encoded codepoint */
+            size_t len = encode((unsigned char*) (src + si), buf + bi) - 1;
+            while (src[si]) ++si; /* advance to NUL termination */
+            bi += len;
+        }
+    }
+    if (!si) return;
+
+    /* the test file contains surrogate codepoints, which are only for UTF-16 */
+    for (i = 0; i < si; i++) {
+        if (src[i] == 0xed && src[i+1] >= 0xa0) {
+            printf("line %zd: ignoring invalid UTF-8 codepoints\n", lineno);
+            return;
+        }
+    }
+
+    /* the first break, at the start of the string, is implied */
+    pos = 0;
+    for (i = 1; i < nbreaks; i++) {
+        pos = utf8proc_line_break_next(src, (utf8proc_ssize_t) si, pos, NULL);
+        check(pos == breaks[i], "line break mismatch: %zd instead of %zd in line %zd",
+              (size_t) pos, (size_t) breaks[i], lineno);
+    }
+    check(utf8proc_line_break_next(src, (utf8proc_ssize_t) si, pos, NULL) == (utf8proc_ssize_t) si,
+          "line break past end of string in line %zd", lineno);
+
+    if (verbose)
+        printf("passed line break test: \"%s\"\n", (char*) src);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char buf[8192];
+    FILE *f = argc > 1 ? fopen(argv[1], "r") : NULL;
+
+    check(f != NULL, "error opening LineBreakTest.txt");
+    while (simple_getline(buf, f) > 0) {
+        if ((++lineno) % 100 == 0)
+            printf("checking line %zd...\n", lineno);
+        if (buf[0] == '#') continue;
+        checkline((char *) buf, false);
+    }
+    fclose(f);
+    printf("Passed tests after %zd lines!\n", lineno);
+
+    printf("Performing regression tests...\n");
+
+    checkline("/ 0061 0020 / 0062 /", true); /* break after spaces */
+    checkline("/ 0078 0020 / 00ab 0020 0061 0020 00bb /", true); /* x << a >> */
+    checkline("/ 0061 0020 / 002e 0035 /", true); /* a .5 */
+    checkline("/ 0061 002d / 0062 0020 / 002d 0063 /", true); /* word-initial hyphen */
+    checkline("/ 0061 0301 0020 / 0301 0062 /", true); /* combining mark after space */
+    checkline("/ 0024 0028 0031 0029 /", true); /* $(1) */
+    checkline("/ 1f1f8 1f1ea / 1f1f8 1f1ea / 1f1f8 /", true); /* regional indicator pairs */
+    checkline("/ 11003 11013 0020 / 11013 /", true); /* LB28a: AP x AK */
+    checkline("/ 1b18 1b44 1b13 / 1b18 /", true); /* LB28a: AK x VI x AK */
+    checkline("/ 1bc0 1bc2 1bf2 / 1bc0 / 1bc2 /", true); /* LB28a: AS x AS VF */
+    checkline("/ 25cc 1b44 25cc / 1b13 /", true); /* LB28a: dotted circle */
+    checkline("/ 002d / 05d0 /", true); /* LB20a applies to AL only */
+    checkline("/ 2a6e0 / 201c 4e00 /", true); /* LB19a: reserved CJK is East Asian */
+
+    {
+        utf8proc_bool mandatory;
+        const utf8proc_uint8_t *s = (const utf8proc_uint8_t *) "a\r\nb c";
+        check(utf8proc_line_break_next(s, 6, 0, &mandatory) == 3 && mandatory,
+              "failed mandatory break after CR LF");
+        check(utf8proc_line_break_next(s, 6, 3, &mandatory) == 5 && !mandatory,
+              "failed break opportunity after space");
+        check(utf8proc_line_break_next(s, 6, 5, &mandatory) == 6 && mandatory,
+              "failed mandatory break at end of string");
+    }
+    check(utf8proc_line_break_next((const utf8proc_uint8_t *) "a\xff", 2, 0, NULL) == UTF8PROC_ERROR_INVALIDUTF8,
+          "failed invalid UTF-8 test");
+
+    printf("Passed regression tests!\n");
+
+    return 0;
+}
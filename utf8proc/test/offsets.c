@@ -0,0 +1,92 @@
+#include "tests.h"
+
+typedef struct {
+    utf8proc_ssize_t dst, dstlen, src, srclen;
+} expected_offset;
+
+static void check_offsets(const char *input, utf8proc_option_t options,
+                          const char *correct, const expected_offset *expected, utf8proc_ssize_t nexpected)
+{
+    utf8proc_uint8_t *output;
+    utf8proc_offset_t *offsets;
+    utf8proc_ssize_t noffsets, i;
+    utf8proc_ssize_t len = utf8proc_map_offsets((const utf8proc_uint8_t *) input, (utf8proc_ssize_t) strlen(input),
+                                                &output, options, NULL, NULL, &offsets, &noffsets);
+    check(len >= 0, "map_offsets failed for \"%s\": %s", input, utf8proc_errmsg(len));
+    check(!strcmp((char *) output, correct), "incorrect output for \"%s\"", input);
+    check(noffsets == nexpected, "got %d offsets instead of %d for \"%s\"", (int) noffsets, (int) nexpected, input);
+    for (i = 0; i < noffsets; i++) {
+        check(offsets[i].dst == expected[i].dst && offsets[i].dstlen == expected[i].dstlen &&
+              offsets[i].src == expected[i].src && offsets[i].srclen == expected[i].srclen,
+              "offset %d for \"%s\" is {%d %d %d %d}", (int) i, input,
+              (int) offsets[i].dst, (int) offsets[i].dstlen, (int) offsets[i].src, (int) offsets[i].srclen);
+    }
+    free(output);
+    free(offsets);
+}
+
+int main(void)
+{
+    /* unchanged text is a single run */
+    {
+        expected_offset e[] = {{0, 5, 0, 5}};
+        check_offsets("hello", UTF8PROC_COMPOSE, "hello", e, 1);
+    }
+    /* decomposition: "café!" */
+    {
+        expected_offset e[] = {{0, 3, 0, 3}, {3, 2, 3, 1}, {5, 1, 4, 1}};
+        check_offsets("caf\xc3\xa9!", UTF8PROC_DECOMPOSE, "cafe\xcc\x81!", e, 3);
+    }
+    /* composition: "café!" */
+    {
+        expected_offset e[] = {{0, 3, 0, 3}, {3, 1, 3, 2}, {4, 1, 5, 1}};
+        check_offsets("cafe\xcc\x81!", UTF8PROC_COMPOSE, "caf\xc3\xa9!", e, 3);
+    }
+    /* reordering: "ạ́b" */
+    {
+        expected_offset e[] = {{0, 3, 0, 3}, {3, 1, 3, 1}};
+        check_offsets("a\xcc\x81\xcc\xa3" "b", UTF8PROC_DECOMPOSE, "a\xcc\xa3\xcc\x81" "b", e, 2);
+    }
+    /* removed codepoints: "­ab­c" with IGNORE */
+    {
+        expected_offset e[] = {{0, 1, 0, 2}, {1, 1, 2, 2}, {2, 1, 4, 1}};
+        check_offsets("\xc2\xad" "ab\xc2\xad" "c", UTF8PROC_COMPOSE | UTF8PROC_IGNORE, "abc", e, 3);
+    }
+    /* everything removed */
+    {
+        expected_offset e[] = {{0, 0, 0, 1}};
+        check_offsets("\xc2\xad", UTF8PROC_COMPOSE | UTF8PROC_IGNORE, "", e, 1);
+    }
+    /* empty input */
+    check_offsets("", UTF8PROC_COMPOSE, "", NULL, 0);
+    /* CRLF to LF */
+    {
+        expected_offset e[] = {{0, 1, 0, 1}, {1, 1, 1, 2}, {2, 1, 3, 1}};
+        check_offsets("a\r\nb", UTF8PROC_COMPOSE | UTF8PROC_NLF2LF, "a\nb", e, 3);
+    }
+    /* byte offsets of "é\xe1\x80b" decomposed, the maximal subpart of the
+       ill-formed sequence being replaced by a single U+FFFD */
+    {
+        static const char input[] = "\xc3\xa9\xe1\x80" "b";
+        static const expected_offset e[] = {{0, 3, 0, 2}, {3, 4, 2, 3}};
+        utf8proc_option_t options = UTF8PROC_DECOMPOSE | UTF8PROC_REPLACE_INVALID;
+        utf8proc_uint8_t *output;
+        utf8proc_offset_t *offsets;
+        utf8proc_ssize_t noffsets, i;
+        utf8proc_ssize_t len = utf8proc_map_offsets((const utf8proc_uint8_t *) input, 5, &output, options,
+                                                    NULL, NULL, &offsets, &noffsets);
+        check(len == 7 && noffsets == 2, "map_offsets failed for invalid UTF-8");
+        utf8proc_offsets_bytes((const utf8proc_uint8_t *) input, 5, output, offsets, noffsets, options);
+        for (i = 0; i < noffsets; i++) {
+            check(offsets[i].dst == e[i].dst && offsets[i].dstlen == e[i].dstlen &&
+                  offsets[i].src == e[i].src && offsets[i].srclen == e[i].srclen,
+                  "byte offset %d is {%d %d %d %d}", (int) i,
+                  (int) offsets[i].dst, (int) offsets[i].dstlen, (int) offsets[i].src, (int) offsets[i].srclen);
+        }
+        free(output);
+        free(offsets);
+    }
+
+    printf("map_offsets tests SUCCEEDED.\n");
+    return 0;
+}
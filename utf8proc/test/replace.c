@@ -0,0 +1,47 @@
+#include "tests.h"
+
+/* U+FFFD in UTF-8 */
+#define R "\xef\xbf\xbd"
+
+static void check_replace(const char *input, utf8proc_ssize_t inputlen, const char *correct, utf8proc_option_t options)
+{
+    utf8proc_uint8_t *output;
+    utf8proc_ssize_t len = utf8proc_map((const utf8proc_uint8_t *) input, inputlen, &output,
+                                        options | UTF8PROC_REPLACE_INVALID);
+    check(len >= 0, "error %d for input of %d bytes", (int) len, (int) inputlen);
+    check(len == (utf8proc_ssize_t) strlen(correct) && !memcmp(output, correct, (size_t) len),
+          "incorrect output \"%s\" instead of \"%s\" with options %d", (char *) output, correct, (int) options);
+    free(output);
+    /* without the option the input is rejected */
+    len = utf8proc_map((const utf8proc_uint8_t *) input, inputlen, &output, options);
+    check(len == UTF8PROC_ERROR_INVALIDUTF8, "invalid UTF-8 not rejected with options %d", (int) options);
+}
+
+static void check_all(const char *input, utf8proc_ssize_t inputlen, const char *correct)
+{
+    check_replace(input, inputlen, correct, UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    check_replace(input, inputlen, correct, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE);
+    check_replace(input, inputlen, correct, UTF8PROC_STABLE | UTF8PROC_COMPOSE | UTF8PROC_COMPAT | UTF8PROC_CASEFOLD);
+    check_replace(input, -1, correct, UTF8PROC_NULLTERM | UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    check_replace(input, -1, correct, UTF8PROC_NULLTERM | UTF8PROC_STABLE | UTF8PROC_DECOMPOSE);
+}
+
+int main(void)
+{
+    /* the example of table 3-8 of the Unicode standard */
+    check_all("a\xf1\x80\x80\xe1\x80\xc2" "b\x80" "c\x80\xbf" "d", 13, "a" R R R "b" R "c" R R "d");
+    /* overlong forms, surrogates and codepoints above U+10FFFF */
+    check_all("\xc0\xaf", 2, R R);
+    check_all("\xe0\x80\xaf", 3, R R R);
+    check_all("\xed\xa0\x80", 3, R R R);
+    check_all("\xf4\x90\x80\x80", 4, R R R R);
+    check_all("\xf5\x80", 2, R R);
+    /* truncated sequences, at the end and before a valid character */
+    check_all("x\xe2\x82", 3, "x" R);
+    check_all("\xf0\x9f\x98" "ab", 5, R "ab");
+    check_replace("\xf0\x9f\x98" "e\xcc\x81", 6, R "\xc3\xa9", UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    /* replacements do not combine with the marks that follow them */
+    check_replace("\xff\xcc\x81", 3, R "\xcc\x81", UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    printf("Replacement tests SUCCEEDED.\n");
+    return 0;
+}
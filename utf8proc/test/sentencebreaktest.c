@@ -0,0 +1,90 @@
+#include "tests.h"
+
+/* check one line in the format of SentenceBreakTest.txt */
+void checkline(const char *_buf, bool verbose) {
+    size_t bi = 0, si = 0, nbreaks = 0, i;
+    utf8proc_uint8_t src[1024]; /* more than long enough for all of our tests */
+    utf8proc_ssize_t breaks[256], pos;
+    const unsigned char *buf = (const unsigned char *) _buf;
+
+    while (buf[bi]) {
+        bi = skipspaces(buf, bi);
+        if (buf[bi] == 0xc3 && buf[bi+1] == 0xb7) { /* U+00f7 = sentence break */
+            breaks[nbreaks++] = (utf8proc_ssize_t) si;
+            bi += 2;
+        }
+        else if (buf[bi] == 0xc3 && buf[bi+1] == 0x97) { /* U+00d7 = no break */
+            bi += 2;
+        }
+        else if (buf[bi] == '#') { /* start of comments */
+            break;
+        }
+        else if (buf[bi] == '/') { /* for convenience, also accept / as sentence break */
+            breaks[nbreaks++] = (utf8proc_ssize_t) si;
+            bi += 1;
+        }
+        else { /* hex-encoded codepoint */
+            size_t len = encode((unsigned char*) (src + si), buf + bi) - 1;
+            while (src[si]) ++si; /* advance to NUL termination */
+            bi += len;
+        }
+    }
+    if (!si) return;
+
+    /* the test file contains surrogate codepoints, which are only for UTF-16 */
+    for (i = 0; i < si; i++) {
+        if (src[i] == 0xed && src[i+1] >= 0xa0) {
+            printf("line %zd: ignoring invalid UTF-8 codepoints\n", lineno);
+            return;
+        }
+    }
+
+    /* the first break, at the start of the string, is implied */
+    pos = 0;
+    for (i = 1; i < nbreaks; i++) {
+        pos = utf8proc_sentence_break_next(src, (utf8proc_ssize_t) si, pos);
+        check(pos == breaks[i], "sentence break mismatch: %zd instead of %zd in line %zd",
+              (size_t) pos, (size_t) breaks[i], lineno);
+    }
+    check(utf8proc_sentence_break_next(src, (utf8proc_ssize_t) si, pos) == (utf8proc_ssize_t) si,
+          "sentence break past end of string in line %zd", lineno);
+
+    if (verbose)
+        printf("passed sentence break test: \"%s\"\n", (char*) src);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char buf[8192];
+    FILE *f = argc > 1 ? fopen(argv[1], "r") : NULL;
+
+    check(f != NULL, "error opening SentenceBreakTest.txt");
+    while (simple_getline(buf, f) > 0) {
+        if ((++lineno) % 100 == 0)
+            printf("checking line %zd...\n", lineno);
+        if (buf[0] == '#') continue;
+        checkline((char *) buf, false);
+    }
+    fclose(f);
+    printf("Passed tests after %zd lines!\n", lineno);
+
+    printf("Performing regression tests...\n");
+
+    checkline("/ 0048 0069 002e 0020 / 0042 0079 0065 002e /", true); /* Hi. Bye. */
+    checkline("/ 0065 002e 0067 002e 0020 0061 0020 0062 002e /", true); /* e.g. a b. */
+    checkline("/ 0055 002e 0053 002e 0041 0020 0069 0073 002e /", true); /* U.S.A is. */
+    checkline("/ 0033 002e 0031 0034 002e /", true); /* 3.14. */
+    checkline("/ 0057 0068 0079 003f 0029 0020 0020 / 004f 006b 0021 /", true); /* Why?)  Ok! */
+    checkline("/ 0061 000d 000a / 0062 2029 / 0063 /", true); /* paragraph separators */
+    checkline("/ 0061 002e 0301 0020 / 0042 /", true); /* SB5 after a full stop */
+    checkline("/ 0061 002e 003b 0020 0042 /", true); /* semicolon is SContinue */
+    checkline("/ 1780 17d4 0020 / 1781 /", true); /* Khmer khan is STerm */
+
+    check(utf8proc_sentence_break_next((const utf8proc_uint8_t *) "ab", 2, 2) == 2, "failed break at end of string");
+    check(utf8proc_sentence_break_next((const utf8proc_uint8_t *) "a\xff", 2, 0) == UTF8PROC_ERROR_INVALIDUTF8,
+          "failed invalid UTF-8 test");
+
+    printf("Passed regression tests!\n");
+
+    return 0;
+}
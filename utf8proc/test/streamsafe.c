@@ -0,0 +1,98 @@
+#include "tests.h"
+
+/* reference canonical ordering: insertion sort of each run of non-starters */
+static void reference_reorder(utf8proc_int32_t *buffer, utf8proc_ssize_t length)
+{
+    utf8proc_ssize_t i, j;
+    for (i = 1; i < length; i++) {
+        utf8proc_int32_t uc = buffer[i];
+        int ccc = utf8proc_get_property(uc)->combining_class;
+        if (ccc == 0) continue;
+        for (j = i; j > 0 && utf8proc_get_property(buffer[j-1])->combining_class > ccc; j--)
+            buffer[j] = buffer[j-1];
+        buffer[j] = uc;
+    }
+}
+
+static void check_map(const char *input, const char *correct, utf8proc_option_t options)
+{
+    utf8proc_uint8_t *output;
+    utf8proc_ssize_t len = utf8proc_map((const utf8proc_uint8_t *) input, (utf8proc_ssize_t) strlen(input),
+                                        &output, options);
+    check(len >= 0, "error %d with options %d", (int) len, (int) options);
+    check(len == (utf8proc_ssize_t) strlen(correct) && !memcmp(output, correct, (size_t) len),
+          "incorrect output of %d bytes instead of %d with options %d", (int) len, (int) strlen(correct), (int) options);
+    free(output);
+}
+
+/* appends n copies of the UTF-8 string s to the string ending at buf,
+   returning its new end */
+static char *repeat(char *buf, const char *s, int n)
+{
+    while (n-- > 0) {
+        strcpy(buf, s);
+        buf += strlen(s);
+    }
+    return buf;
+}
+
+int main(void)
+{
+    static char input[4096], correct[4096];
+    static utf8proc_int32_t buffer[2000], expected[2000];
+    utf8proc_ssize_t i, n;
+    const utf8proc_int32_t marks[] = { 0x345, 0x301, 0x323, 0x328, 0x5b0, 0x94d, 0x3099 };
+
+    /* runs of up to 30 non-starters are left alone */
+    repeat(strcpy(input, "a") + 1, "\xcc\x81", 30);
+    check_map(input, input, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | UTF8PROC_STREAMSAFE);
+
+    /* a CGJ precedes the 31st non-starter, before composition */
+    repeat(strcpy(input, "a") + 1, "\xcc\x81", 31);
+    repeat(repeat(strcpy(correct, "a") + 1, "\xcc\x81", 30), "\xcd\x8f\xcc\x81", 1);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | UTF8PROC_STREAMSAFE);
+    repeat(repeat(strcpy(correct, "\xc3\xa1") + 2, "\xcc\x81", 29), "\xcd\x8f\xcc\x81", 1);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_COMPOSE | UTF8PROC_STREAMSAFE);
+    check_map(input, input, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE);
+
+    /* decompositions are not split: U+0344 is two non-starters */
+    repeat(repeat(strcpy(input, "a") + 1, "\xcc\x81", 29), "\xcd\x84", 1);
+    repeat(repeat(strcpy(correct, "a") + 1, "\xcc\x81", 29), "\xcd\x8f\xcc\x88\xcc\x81", 1);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | UTF8PROC_STREAMSAFE);
+
+    /* non-starters are counted in NFKD: U+FF9E HALFWIDTH KATAKANA VOICED
+       SOUND MARK is a starter but its compatibility decomposition is not */
+    repeat(repeat(strcpy(input, "a") + 1, "\xcc\x81", 30), "\xef\xbe\x9e", 1);
+    repeat(repeat(strcpy(correct, "a") + 1, "\xcc\x81", 30), "\xcd\x8f\xef\xbe\x9e", 1);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | UTF8PROC_STREAMSAFE);
+    repeat(repeat(strcpy(correct, "a") + 1, "\xcc\x81", 30), "\xcd\x8f\xe3\x82\x99", 1);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE | UTF8PROC_COMPAT | UTF8PROC_STREAMSAFE);
+
+    /* the option needs a normalization form */
+    n = utf8proc_decompose((const utf8proc_uint8_t *) "a", 1, buffer, 2000, UTF8PROC_STREAMSAFE);
+    check(n == UTF8PROC_ERROR_INVALIDOPTS, "UTF8PROC_STREAMSAFE accepted without a normalization form");
+
+    /* long runs in reverse canonical order are sorted as by the reference */
+    buffer[0] = 'a';
+    for (i = 1; i < 1990; i++) buffer[i] = marks[(1990 - i) % 7];
+    buffer[1990] = 'b';
+    for (i = 1991; i < 2000; i++) buffer[i] = marks[i % 7];
+    for (i = 0; i < 2000; i++) expected[i] = buffer[i];
+    reference_reorder(expected, 2000);
+    utf8proc_canonical_reorder(buffer, 2000);
+    for (i = 0; i < 2000; i++)
+        check(buffer[i] == expected[i], "U+%04X instead of U+%04X at %d", buffer[i], expected[i], (int) i);
+
+    /* and normalized the same way by all code paths */
+    repeat(strcpy(input, "a") + 1, "\xcc\x81\xcc\xa3", 500);
+    repeat(repeat(strcpy(correct, "a") + 1, "\xcc\xa3", 500), "\xcc\x81", 500);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_DECOMPOSE);
+    repeat(repeat(strcpy(correct, "\xe1\xba\xa1") + 3, "\xcc\xa3", 499), "\xcc\x81", 500);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_COMPOSE);
+    /* the whole string is one grapheme cluster, preceded by a 0xFF byte */
+    repeat(repeat(strcpy(correct, "\xff\xe1\xba\xa1") + 4, "\xcc\xa3", 499), "\xcc\x81", 500);
+    check_map(input, correct, UTF8PROC_STABLE | UTF8PROC_COMPOSE | UTF8PROC_CHARBOUND);
+
+    printf("Stream-safe tests SUCCEEDED.\n");
+    return 0;
+}
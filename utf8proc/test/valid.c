@@ -35,6 +35,30 @@ int main(int argc, char **argv)
         }
      }
      check(!error, "utf8proc_codepoint_valid FAILED %d tests.", error);
+
+     /* utf8proc_valid_length stops at the first invalid byte, also after
+        runs of ASCII checked 8 bytes at a time */
+     {
+        static const struct { const char *str; int len, valid; } cases[] = {
+           {"", 0, 0},
+           {"abc", 3, 3},
+           {"abcdefghijklmnopq\xc3\xa9", 19, 19},
+           {"abcdefghijklmnop\xff", 17, 16},
+           {"abcdefgh\xe2\x82\xacxyz\xed\xa0\x80", 17, 14},
+           {"\xf0\x9f\x98\x80\xf0\x9f\x98", 7, 4},
+           {"\xc0\xaf", 2, 0},
+           {"abcdefg\x80", 8, 7},
+        };
+        size_t i;
+        for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+           utf8proc_ssize_t n = utf8proc_valid_length((const utf8proc_uint8_t *) cases[i].str, cases[i].len);
+           if (n != cases[i].valid) {
+              fprintf(stderr, "Failed: valid_length of case %d -> %d instead of %d\n", (int) i, (int) n, cases[i].valid);
+              error++;
+           }
+        }
+     }
+     check(!error, "utf8proc_valid_length FAILED %d tests.", error);
      printf("Validity tests SUCCEEDED.\n");
 
      return 0;
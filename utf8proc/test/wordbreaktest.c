@@ -0,0 +1,86 @@
+#include "tests.h"
+
+/* check one line in the format of WordBreakTest.txt */
+void checkline(const char *_buf, bool verbose) {
+    size_t bi = 0, si = 0, nbreaks = 0, i;
+    utf8proc_uint8_t src[1024]; /* more than long enough for all of our tests */
+    utf8proc_ssize_t breaks[256], pos;
+    const unsigned char *buf = (const unsigned char *) _buf;
+
+    while (buf[bi]) {
+        bi = skipspaces(buf, bi);
+        if (buf[bi] == 0xc3 && buf[bi+1] == 0xb7) { /* U+00f7 = word break */
+            breaks[nbreaks++] = (utf8proc_ssize_t) si;
+            bi += 2;
+        }
+        else if (buf[bi] == 0xc3 && buf[bi+1] == 0x97) { /* U+00d7 = no break */
+            bi += 2;
+        }
+        else if (buf[bi] == '#') { /* start of comments */
+            break;
+        }
+        else if (buf[bi] == '/') { /* for convenience, also accept / as word break */
+            breaks[nbreaks++] = (utf8proc_ssize_t) si;
+            bi += 1;
+        }
+        else { /* hex-encoded codepoint */
+            size_t len = encode((unsigned char*) (src + si), buf + bi) - 1;
+            while (src[si]) ++si; /* advance to NUL termination */
+            bi += len;
+        }
+    }
+    if (!si) return;
+
+    /* the test file contains surrogate codepoints, which are only for UTF-16 */
+    for (i = 0; i < si; i++) {
+        if (src[i] == 0xed && src[i+1] >= 0xa0) {
+            printf("line %zd: ignoring invalid UTF-8 codepoints\n", lineno);
+            return;
+        }
+    }
+
+    /* the first break, at the start of the string, is implied */
+    pos = 0;
+    for (i = 1; i < nbreaks; i++) {
+        pos = utf8proc_word_break_next(src, (utf8proc_ssize_t) si, pos);
+        check(pos == breaks[i], "word break mismatch: %zd instead of %zd in line %zd",
+              (size_t) pos, (size_t) breaks[i], lineno);
+    }
+    check(utf8proc_word_break_next(src, (utf8proc_ssize_t) si, pos) == (utf8proc_ssize_t) si,
+          "word break past end of string in line %zd", lineno);
+
+    if (verbose)
+        printf("passed word break test: \"%s\"\n", (char*) src);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char buf[8192];
+    FILE *f = argc > 1 ? fopen(argv[1], "r") : NULL;
+
+    check(f != NULL, "error opening WordBreakTest.txt");
+    while (simple_getline(buf, f) > 0) {
+        if ((++lineno) % 100 == 0)
+            printf("checking line %zd...\n", lineno);
+        if (buf[0] == '#') continue;
+        checkline((char *) buf, false);
+    }
+    fclose(f);
+    printf("Passed tests after %zd lines!\n", lineno);
+
+    printf("Performing regression tests...\n");
+
+    checkline("/ 0063 0061 006e 0027 0074 / 0020 / 0064 006f /", true); /* can't do */
+    checkline("/ 0033 002e 0031 0034 / 002e /", true); /* 3.14. */
+    checkline("/ 0061 0308 0062 / 0020 0020 / 0063 /", true); /* a + diaeresis b, two spaces, c */
+    checkline("/ 1f1f8 1f1ea / 1f1f8 1f1ea / 1f1f8 /", true); /* regional indicator pairs */
+    checkline("/ 0061 / 000d 000a / 0308 / 0062 /", true); /* no WB4 after newlines */
+
+    check(utf8proc_word_break_next((const utf8proc_uint8_t *) "ab", 2, 2) == 2, "failed break at end of string");
+    check(utf8proc_word_break_next((const utf8proc_uint8_t *) "a\xff", 2, 0) == UTF8PROC_ERROR_INVALIDUTF8,
+          "failed invalid UTF-8 test");
+
+    printf("Passed regression tests!\n");
+
+    return 0;
+}
@@ -50,8 +50,71 @@
 #  define UINT16_MAX 65535U
 #endif
 
+/* The fields of a utf8proc_property_t row that the normalization and
+   grapheme break loops need, packed into 32 bits. utf8proc_hot_properties
+   has one entry for each row of utf8proc_properties, so that these loops
+   touch 4 bytes per distinct row instead of a whole utf8proc_property_t,
+   and only look up the full row for a decomposition or composition. */
+typedef struct utf8proc_hotprop_struct {
+  unsigned category:5;
+  unsigned combining_class:8;
+  unsigned boundclass:6;
+  unsigned indic_conjunct_break:2;
+  unsigned comb_issecond:1;
+  /* comb_index != 0x3FF */
+  unsigned comb_isfirst:1;
+  /* has a canonical, or a compatibility, decomposition */
+  unsigned canonical_decomp:1;
+  unsigned compat_decomp:1;
+  /* casefold_seqindex != UINT16_MAX */
+  unsigned casefold:1;
+  unsigned ignorable:1;
+} utf8proc_hotprop_t;
+
 #include "utf8proc_data.c"
 
+/* static tracepoints for perf, bpftrace or SystemTap, at the entry and
+   return of the main functions, with the input length, the result and the
+   options as arguments */
+#ifdef UTF8PROC_PROBES
+#  include <sys/sdt.h>
+#  define PROBE2(name, a, b) DTRACE_PROBE2(utf8proc, name, a, b)
+#  define PROBE3(name, a, b, c) DTRACE_PROBE3(utf8proc, name, a, b, c)
+#else
+#  define PROBE2(name, a, b) ((void)0)
+#  define PROBE3(name, a, b, c) ((void)0)
+#endif
+
+/* counters returned by utf8proc_get_stats, updated with relaxed atomic
+   additions; the Interlocked functions of MSVC are the size of
+   utf8proc_size_t */
+#ifdef UTF8PROC_STATS
+static utf8proc_stats_t stats;
+#  if defined(__GNUC__)
+#    define STATS_ADD(field, n) ((void)__atomic_fetch_add(&stats.field, (utf8proc_size_t)(n), __ATOMIC_RELAXED))
+#    define STATS_GET(field) __atomic_load_n(&stats.field, __ATOMIC_RELAXED)
+#    define STATS_RESET(field) __atomic_store_n(&stats.field, 0, __ATOMIC_RELAXED)
+#  elif defined(_MSC_VER)
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#    ifdef _WIN64
+#      define STATS_PTR(field) ((volatile LONG64 *)&stats.field)
+#      define STATS_ADD(field, n) ((void)InterlockedExchangeAdd64(STATS_PTR(field), (LONG64)(n)))
+#      define STATS_GET(field) ((utf8proc_size_t)InterlockedCompareExchange64(STATS_PTR(field), 0, 0))
+#      define STATS_RESET(field) ((void)InterlockedExchange64(STATS_PTR(field), 0))
+#    else
+#      define STATS_PTR(field) ((volatile LONG *)&stats.field)
+#      define STATS_ADD(field, n) ((void)InterlockedExchangeAdd(STATS_PTR(field), (LONG)(n)))
+#      define STATS_GET(field) ((utf8proc_size_t)InterlockedCompareExchange(STATS_PTR(field), 0, 0))
+#      define STATS_RESET(field) ((void)InterlockedExchange(STATS_PTR(field), 0))
+#    endif
+#  else
+#    error "UTF8PROC_STATS requires atomic operations, which are only implemented for GCC, Clang and MSVC"
+#  endif
+#else
+#  define STATS_ADD(field, n) ((void)0)
+#endif
+
 
 UTF8PROC_DLLEXPORT const utf8proc_int8_t utf8proc_utf8class[256] = {
   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -170,10 +233,71 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_iterate(
   return 4;
 }
 
+/* length of the maximal subpart of the ill-formed UTF-8 sequence at str,
+   of at most strlen bytes or 4 if strlen is negative: the lead byte and
+   the continuation bytes that could follow it in a well-formed sequence,
+   as defined in chapter 3 of the Unicode standard */
+static utf8proc_ssize_t invalid_utf8_length(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen) {
+  utf8proc_ssize_t length, n;
+  utf8proc_uint8_t lo = 0x80, hi = 0xbf;
+  if (strlen < 0 || strlen > 4) strlen = 4;
+  if (str[0] >= 0xc2 && str[0] <= 0xdf) length = 2;
+  else if (str[0] >= 0xe0 && str[0] <= 0xef) length = 3;
+  else if (str[0] >= 0xf0 && str[0] <= 0xf4) length = 4;
+  else return 1;
+  /* the ranges of the second byte excluding overlong forms, surrogates
+     and codepoints above U+10FFFF */
+  if (str[0] == 0xe0) lo = 0xa0;
+  else if (str[0] == 0xed) hi = 0x9f;
+  else if (str[0] == 0xf0) lo = 0x90;
+  else if (str[0] == 0xf4) hi = 0x8f;
+  for (n = 1; n < length && n < strlen; n++) {
+    if (str[n] < lo || str[n] > hi) break;
+    lo = 0x80;
+    hi = 0xbf;
+  }
+  return n;
+}
+
+/* utf8proc_iterate for the mapping functions, decoding a maximal subpart
+   of an ill-formed sequence as U+FFFD with UTF8PROC_REPLACE_INVALID */
+static utf8proc_ssize_t iterate_option(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_int32_t *dst,
+  utf8proc_option_t options
+) {
+  utf8proc_ssize_t n = utf8proc_iterate(str, strlen, dst);
+  if (*dst >= 0 || !(options & UTF8PROC_REPLACE_INVALID) || strlen == 0) return n;
+  *dst = 0xFFFD;
+  return invalid_utf8_length(str, strlen);
+}
+
 UTF8PROC_DLLEXPORT utf8proc_bool utf8proc_codepoint_valid(utf8proc_int32_t uc) {
     return (((utf8proc_uint32_t)uc)-0xd800 > 0x07ff) && ((utf8proc_uint32_t)uc < 0x110000);
 }
 
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_valid_length(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen) {
+  utf8proc_ssize_t pos = 0, n;
+  utf8proc_int32_t uc;
+  while (pos < strlen) {
+    /* the bytes are or'ed together so that the compiler can check 8 bytes
+       with a single load */
+    while (strlen - pos >= 8 &&
+           !((str[pos] | str[pos+1] | str[pos+2] | str[pos+3] |
+              str[pos+4] | str[pos+5] | str[pos+6] | str[pos+7]) & 0x80)) {
+      pos += 8;
+    }
+    if (pos >= strlen) break;
+    if (str[pos] < 0x80) {
+      pos++;
+      continue;
+    }
+    n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+    if (uc < 0) break;
+    pos += n;
+  }
+  return pos;
+}
+
 UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_encode_char(utf8proc_int32_t uc, utf8proc_uint8_t *dst) {
   if (uc < 0x00) {
     return 0;
@@ -229,14 +353,27 @@ static utf8proc_ssize_t charbound_encode_char(utf8proc_int32_t uc, utf8proc_uint
    } else return 0;
 }
 
-/* internal "unsafe" version that does not check whether uc is in range */
-static const utf8proc_property_t *unsafe_get_property(utf8proc_int32_t uc) {
+/* internal "unsafe" versions that do not check whether uc is in range */
+static utf8proc_uint16_t unsafe_property_index(utf8proc_int32_t uc) {
   /* ASSERT: uc >= 0 && uc < 0x110000 */
-  return utf8proc_properties + (
-    utf8proc_stage2table[
-      utf8proc_stage1table[uc >> 8] + (uc & 0xFF)
-    ]
-  );
+#ifdef UTF8PROC_BMP_INDEX
+  if (uc < 0x10000) return utf8proc_bmp_index[uc];
+#endif
+  return utf8proc_stage2table[
+    utf8proc_stage1table[uc >> 8] + (uc & 0xFF)
+  ];
+}
+
+static const utf8proc_property_t *unsafe_get_property(utf8proc_int32_t uc) {
+  return utf8proc_properties + unsafe_property_index(uc);
+}
+
+static const utf8proc_hotprop_t *unsafe_get_hotprop(utf8proc_int32_t uc) {
+  return utf8proc_hot_properties + unsafe_property_index(uc);
+}
+
+static const utf8proc_hotprop_t *get_hotprop(utf8proc_int32_t uc) {
+  return uc < 0 || uc >= 0x110000 ? utf8proc_hot_properties : unsafe_get_hotprop(uc);
 }
 
 UTF8PROC_DLLEXPORT const utf8proc_property_t *utf8proc_get_property(utf8proc_int32_t uc) {
@@ -345,8 +482,8 @@ static utf8proc_bool grapheme_break_extended(int lbc, int tbc, int licb, int tic
 UTF8PROC_DLLEXPORT utf8proc_bool utf8proc_grapheme_break_stateful(
     utf8proc_int32_t c1, utf8proc_int32_t c2, utf8proc_int32_t *state) {
 
-  const utf8proc_property_t *p1 = utf8proc_get_property(c1);
-  const utf8proc_property_t *p2 = utf8proc_get_property(c2);
+  const utf8proc_hotprop_t *p1 = get_hotprop(c1);
+  const utf8proc_hotprop_t *p2 = get_hotprop(c2);
   return grapheme_break_extended(p1->boundclass,
                                  p2->boundclass,
                                  p1->indic_conjunct_break,
@@ -360,6 +497,491 @@ UTF8PROC_DLLEXPORT utf8proc_bool utf8proc_grapheme_break(
   return utf8proc_grapheme_break_stateful(c1, c2, NULL);
 }
 
+#define WB_AHLETTER(wbc) \
+  ((wbc) == UTF8PROC_WORDBREAK_ALETTER || (wbc) == UTF8PROC_WORDBREAK_HEBREW_LETTER)
+#define WB_MIDNUMLETQ(wbc) \
+  ((wbc) == UTF8PROC_WORDBREAK_MIDNUMLET || (wbc) == UTF8PROC_WORDBREAK_SINGLE_QUOTE)
+#define WB_IGNORED(wbc) \
+  ((wbc) == UTF8PROC_WORDBREAK_EXTEND || (wbc) == UTF8PROC_WORDBREAK_FORMAT || \
+   (wbc) == UTF8PROC_WORDBREAK_ZWJ)
+
+/* Word_Break class of the first codepoint at or after str+pos that is not
+   ignored by WB4, or -1 at the end of the string or on invalid UTF-8 */
+static int word_break_lookahead(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos) {
+  utf8proc_int32_t uc;
+  utf8proc_ssize_t n;
+  int wbc;
+  while (pos < strlen) {
+    n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+    if (uc < 0) return -1;
+    wbc = unsafe_get_property(uc)->wordbreak;
+    if (!WB_IGNORED(wbc)) return wbc;
+    pos += n;
+  }
+  return -1;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_word_break_next(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos
+) {
+  const utf8proc_property_t *property;
+  utf8proc_int32_t uc;
+  utf8proc_ssize_t n, ri;
+  int last, prev, prevprev, wbc;
+  utf8proc_bool nobreak;
+
+  if (pos >= strlen) return strlen;
+  n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+  if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+  pos += n;
+  /* last is the class of the preceding codepoint, prev and prevprev those
+     of the preceding codepoints not ignored by WB4, and ri the number of
+     regional indicators immediately preceding */
+  last = prev = unsafe_get_property(uc)->wordbreak;
+  prevprev = -1;
+  ri = prev == UTF8PROC_WORDBREAK_REGIONAL_INDICATOR;
+  while (pos < strlen) {
+    n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+    if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+    property = unsafe_get_property(uc);
+    wbc = property->wordbreak;
+    if (last == UTF8PROC_WORDBREAK_CR && wbc == UTF8PROC_WORDBREAK_LF) {
+      nobreak = true;                                           // WB3
+    } else if (last == UTF8PROC_WORDBREAK_CR || last == UTF8PROC_WORDBREAK_LF ||
+               last == UTF8PROC_WORDBREAK_NEWLINE ||            // WB3a
+               wbc == UTF8PROC_WORDBREAK_CR || wbc == UTF8PROC_WORDBREAK_LF ||
+               wbc == UTF8PROC_WORDBREAK_NEWLINE) {             // WB3b
+      nobreak = false;
+    } else if (last == UTF8PROC_WORDBREAK_ZWJ &&                // WB3c
+               property->boundclass == UTF8PROC_BOUNDCLASS_EXTENDED_PICTOGRAPHIC) {
+      nobreak = true;
+    } else if (last == UTF8PROC_WORDBREAK_WSEGSPACE &&          // WB3d
+               wbc == UTF8PROC_WORDBREAK_WSEGSPACE) {
+      nobreak = true;
+    } else if (WB_IGNORED(wbc)) {                               // WB4
+      last = wbc;
+      pos += n;
+      continue;
+    } else {
+      nobreak =
+        (WB_AHLETTER(prev) && WB_AHLETTER(wbc)) ||              // WB5
+        (WB_AHLETTER(prev) &&                                   // WB6
+         (wbc == UTF8PROC_WORDBREAK_MIDLETTER || WB_MIDNUMLETQ(wbc)) &&
+         WB_AHLETTER(word_break_lookahead(str, strlen, pos + n))) ||
+        (WB_AHLETTER(prevprev) &&                               // WB7
+         (prev == UTF8PROC_WORDBREAK_MIDLETTER || WB_MIDNUMLETQ(prev)) &&
+         WB_AHLETTER(wbc)) ||
+        (prev == UTF8PROC_WORDBREAK_HEBREW_LETTER &&            // WB7a
+         wbc == UTF8PROC_WORDBREAK_SINGLE_QUOTE) ||
+        (prev == UTF8PROC_WORDBREAK_HEBREW_LETTER &&            // WB7b
+         wbc == UTF8PROC_WORDBREAK_DOUBLE_QUOTE &&
+         word_break_lookahead(str, strlen, pos + n) == UTF8PROC_WORDBREAK_HEBREW_LETTER) ||
+        (prevprev == UTF8PROC_WORDBREAK_HEBREW_LETTER &&        // WB7c
+         prev == UTF8PROC_WORDBREAK_DOUBLE_QUOTE &&
+         wbc == UTF8PROC_WORDBREAK_HEBREW_LETTER) ||
+        (prev == UTF8PROC_WORDBREAK_NUMERIC &&                  // WB8
+         wbc == UTF8PROC_WORDBREAK_NUMERIC) ||
+        (WB_AHLETTER(prev) && wbc == UTF8PROC_WORDBREAK_NUMERIC) || // WB9
+        (prev == UTF8PROC_WORDBREAK_NUMERIC && WB_AHLETTER(wbc)) || // WB10
+        (prevprev == UTF8PROC_WORDBREAK_NUMERIC &&              // WB11
+         (prev == UTF8PROC_WORDBREAK_MIDNUM || WB_MIDNUMLETQ(prev)) &&
+         wbc == UTF8PROC_WORDBREAK_NUMERIC) ||
+        (prev == UTF8PROC_WORDBREAK_NUMERIC &&                  // WB12
+         (wbc == UTF8PROC_WORDBREAK_MIDNUM || WB_MIDNUMLETQ(wbc)) &&
+         word_break_lookahead(str, strlen, pos + n) == UTF8PROC_WORDBREAK_NUMERIC) ||
+        (prev == UTF8PROC_WORDBREAK_KATAKANA &&                 // WB13
+         wbc == UTF8PROC_WORDBREAK_KATAKANA) ||
+        ((WB_AHLETTER(prev) || prev == UTF8PROC_WORDBREAK_NUMERIC || // WB13a
+          prev == UTF8PROC_WORDBREAK_KATAKANA ||
+          prev == UTF8PROC_WORDBREAK_EXTENDNUMLET) &&
+         wbc == UTF8PROC_WORDBREAK_EXTENDNUMLET) ||
+        (prev == UTF8PROC_WORDBREAK_EXTENDNUMLET &&             // WB13b
+         (WB_AHLETTER(wbc) || wbc == UTF8PROC_WORDBREAK_NUMERIC ||
+          wbc == UTF8PROC_WORDBREAK_KATAKANA)) ||
+        (prev == UTF8PROC_WORDBREAK_REGIONAL_INDICATOR &&       // WB15/16
+         wbc == UTF8PROC_WORDBREAK_REGIONAL_INDICATOR && ri % 2 == 1);
+    }
+    if (!nobreak) return pos;                                   // WB999
+    prevprev = prev;
+    prev = last = wbc;
+    ri = wbc == UTF8PROC_WORDBREAK_REGIONAL_INDICATOR ? ri + 1 : 0;
+    pos += n;
+  }
+  return strlen;                                                // WB2
+}
+
+#define LBC(c) UTF8PROC_LINEBREAK_##c
+#define LB_HANGUL(lbc) \
+  ((lbc) == LBC(JL) || (lbc) == LBC(JV) || (lbc) == LBC(JT) || \
+   (lbc) == LBC(H2) || (lbc) == LBC(H3))
+#define LB_AKSARA(lbc, uc) \
+  ((lbc) == LBC(AK) || (lbc) == LBC(AS) || (uc) == 0x25CC)
+
+/* Line_Break class of a codepoint with AI, SG, XX, SA and CJ resolved (LB1) */
+static int line_break_class(const utf8proc_property_t *property) {
+  switch (property->linebreak) {
+  case LBC(AI): case LBC(SG): case LBC(XX):
+    return LBC(AL);
+  case LBC(SA):
+    return property->category == UTF8PROC_CATEGORY_MN ||
+      property->category == UTF8PROC_CATEGORY_MC ? LBC(CM) : LBC(AL);
+  case LBC(CJ):
+    return LBC(NS);
+  default:
+    return property->linebreak;
+  }
+}
+
+/* whether uc is in $EastAsian, i.e. has East_Asian_Width F, W or H; the
+   tables only record the resulting width, so the halfwidth forms are
+   listed explicitly, as are the reserved CJK ideographs (unassigned ID
+   that is not pictographic), which are W but have width 1 */
+static utf8proc_bool line_break_eastasian(utf8proc_int32_t uc) {
+  const utf8proc_property_t *property;
+  if (uc < 0) return false;
+  property = unsafe_get_property(uc);
+  return property->charwidth == 2 || uc == 0x20A9 ||
+    (uc >= 0xFF61 && uc <= 0xFFDC) || (uc >= 0xFFE8 && uc <= 0xFFEE) ||
+    (property->category == UTF8PROC_CATEGORY_CN && property->linebreak == LBC(ID) &&
+     property->boundclass != UTF8PROC_BOUNDCLASS_EXTENDED_PICTOGRAPHIC);
+}
+
+/* resolved class of the first codepoint at or after str+*pos that is not
+   a CM or ZWJ absorbed by LB9, storing the codepoint in *uc and advancing
+   *pos past it, or -1 at the end of the string or on invalid UTF-8 */
+static int line_break_lookahead(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen,
+                                utf8proc_ssize_t *pos, utf8proc_int32_t *uc) {
+  utf8proc_ssize_t n;
+  int lbc;
+  while (*pos < strlen) {
+    n = utf8proc_iterate(str + *pos, strlen - *pos, uc);
+    if (*uc < 0) break;
+    *pos += n;
+    lbc = line_break_class(unsafe_get_property(*uc));
+    if (lbc != LBC(CM) && lbc != LBC(ZWJ)) return lbc;
+  }
+  *uc = -1;
+  return -1;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_line_break_next(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos,
+  utf8proc_bool *mandatory
+) {
+  const utf8proc_property_t *property;
+  utf8proc_int32_t uc, prevuc, prevprevuc, nextuc;
+  utf8proc_ssize_t n, start, ri, next;
+  int raw, lbc, last, prev, prevprev, nonsp, nu, la, la2;
+  utf8proc_bool nobreak, quote;
+
+  if (mandatory) *mandatory = true;
+  if (pos >= strlen) return strlen;                             // LB3
+  /* last is the class of the preceding codepoint, prev and prevprev those
+     of the preceding codepoints not absorbed by LB9 (-1 for the start of
+     the string), nonsp that of the last one that is not a space, quote
+     whether that was an initial quotation mark as in LB15a, nu is 1 after
+     NU (SY | IS)* and 2 after NU (SY | IS)* (CL | CP) for LB25, and ri
+     the number of regional indicators immediately preceding */
+  last = prev = prevprev = nonsp = -1;
+  prevuc = prevprevuc = -1;
+  nu = 0;
+  ri = 0;
+  quote = false;
+  if (pos > 0) {
+    /* the rules only look one codepoint (and its combining marks) behind
+       a break opportunity, so there is no need for state between calls */
+    utf8proc_ssize_t back = pos, end;
+    do {
+      end = back;
+      do back--; while (back > 0 && (str[back] & 0xC0) == 0x80);
+      utf8proc_iterate(str + back, end - back, &uc);
+      if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+      raw = line_break_class(unsafe_get_property(uc));
+      if (last < 0) {
+        last = raw;
+        prevuc = uc;
+      }
+    } while ((raw == LBC(CM) || raw == LBC(ZWJ)) && back > 0);
+    if (raw == LBC(CM) || raw == LBC(ZWJ) ||
+        ((last == LBC(CM) || last == LBC(ZWJ)) && (raw == LBC(BK) || raw == LBC(CR) || raw == LBC(LF) ||
+                         raw == LBC(NL) || raw == LBC(SP) || raw == LBC(ZW)))) {
+      prev = LBC(AL);                                           // LB10
+    } else {
+      prev = raw;
+      prevuc = uc;
+    }
+  }
+  start = pos;
+  while (pos < strlen) {
+    n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+    if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+    property = unsafe_get_property(uc);
+    lbc = raw = line_break_class(property);
+    if (lbc == LBC(CM) || lbc == LBC(ZWJ)) {
+      if (prev >= 0 && prev != LBC(BK) && prev != LBC(CR) && prev != LBC(LF) &&
+          prev != LBC(NL) && prev != LBC(SP) && prev != LBC(ZW)) {
+        last = raw;                                             // LB9
+        pos += n;
+        continue;
+      }
+      lbc = LBC(AL);                                            // LB10
+    }
+    if (pos > start) {
+      /* classes of the codepoints following uc, for the rules that look
+         ahead */
+      la = la2 = -1;
+      nextuc = -1;
+      if (lbc == LBC(QU) || lbc == LBC(IS) || lbc == LBC(OP) || LB_AKSARA(lbc, uc)) {
+        next = pos + n;
+        la = line_break_lookahead(str, strlen, &next, &nextuc);
+        if (lbc == LBC(OP) && la == LBC(IS)) {
+          utf8proc_int32_t uc2;
+          la2 = line_break_lookahead(str, strlen, &next, &uc2);
+        }
+      }
+      if (prev == LBC(CR) && lbc == LBC(LF)) {
+        nobreak = true;                                         // LB5
+      } else if (prev == LBC(BK) || prev == LBC(CR) ||          // LB4
+                 prev == LBC(LF) || prev == LBC(NL)) {          // LB5
+        return pos;
+      } else if (lbc == LBC(BK) || lbc == LBC(CR) ||            // LB6
+                 lbc == LBC(LF) || lbc == LBC(NL)) {
+        nobreak = true;
+      } else if (lbc == LBC(SP) || lbc == LBC(ZW)) {            // LB7
+        nobreak = true;
+      } else if (nonsp == LBC(ZW)) {                            // LB8
+        nobreak = false;
+      } else if (last == LBC(ZWJ)) {                            // LB8a
+        nobreak = true;
+      } else if (lbc == LBC(WJ) || prev == LBC(WJ)) {           // LB11
+        nobreak = true;
+      } else if (prev == LBC(GL)) {                             // LB12
+        nobreak = true;
+      } else if (lbc == LBC(GL) && prev != LBC(SP) &&           // LB12a
+                 prev != LBC(BA) && prev != LBC(HY)) {
+        nobreak = true;
+      } else if (lbc == LBC(CL) || lbc == LBC(CP) ||            // LB13
+                 lbc == LBC(EX) || lbc == LBC(SY)) {
+        nobreak = true;
+      } else if (nonsp == LBC(OP)) {                            // LB14
+        nobreak = true;
+      } else if (quote) {                                       // LB15a
+        nobreak = true;
+      } else if (lbc == LBC(QU) &&                              // LB15b
+                 property->category == UTF8PROC_CATEGORY_PF &&
+                 (la < 0 || la == LBC(SP) || la == LBC(GL) || la == LBC(WJ) ||
+                  la == LBC(CL) || la == LBC(QU) || la == LBC(CP) ||
+                  la == LBC(EX) || la == LBC(IS) || la == LBC(SY) ||
+                  la == LBC(BK) || la == LBC(CR) || la == LBC(LF) ||
+                  la == LBC(NL) || la == LBC(ZW))) {
+        nobreak = true;
+      } else if (prev == LBC(SP) && lbc == LBC(IS) &&           // LB15c
+                 la == LBC(NU)) {
+        nobreak = false;
+      } else if (lbc == LBC(IS)) {                              // LB15d
+        nobreak = true;
+      } else if ((nonsp == LBC(CL) || nonsp == LBC(CP)) &&      // LB16
+                 lbc == LBC(NS)) {
+        nobreak = true;
+      } else if (nonsp == LBC(B2) && lbc == LBC(B2)) {          // LB17
+        nobreak = true;
+      } else if (prev == LBC(SP)) {                             // LB18
+        nobreak = false;
+      } else if ((lbc == LBC(QU) &&                             // LB19
+                  property->category != UTF8PROC_CATEGORY_PI) ||
+                 (prev == LBC(QU) &&
+                  unsafe_get_property(prevuc)->category != UTF8PROC_CATEGORY_PF)) {
+        nobreak = true;
+      } else if ((lbc == LBC(QU) && !line_break_eastasian(prevuc)) || // LB19a
+                 (lbc == LBC(QU) && !line_break_eastasian(nextuc)) ||
+                 (prev == LBC(QU) && !line_break_eastasian(uc)) ||
+                 (prev == LBC(QU) && !line_break_eastasian(prevprevuc))) {
+        nobreak = true;
+      } else if (lbc == LBC(CB) || prev == LBC(CB)) {           // LB20
+        nobreak = false;
+      } else {
+        nobreak =
+          ((prevprev < 0 || prevprev == LBC(BK) || prevprev == LBC(CR) || // LB20a
+            prevprev == LBC(LF) || prevprev == LBC(NL) || prevprev == LBC(SP) ||
+            prevprev == LBC(ZW) || prevprev == LBC(CB) || prevprev == LBC(GL)) &&
+           (prev == LBC(HY) || prevuc == 0x2010) && lbc == LBC(AL)) ||
+          (lbc == LBC(BA) || lbc == LBC(HY) || lbc == LBC(NS) || // LB21
+           prev == LBC(BB)) ||
+          (prevprev == LBC(HL) &&                               // LB21a
+           (prev == LBC(HY) || (prev == LBC(BA) && !line_break_eastasian(prevuc))) &&
+           lbc != LBC(HL)) ||
+          (prev == LBC(SY) && lbc == LBC(HL)) ||                // LB21b
+          (lbc == LBC(IN)) ||                                   // LB22
+          ((prev == LBC(AL) || prev == LBC(HL)) && lbc == LBC(NU)) || // LB23
+          (prev == LBC(NU) && (lbc == LBC(AL) || lbc == LBC(HL))) ||
+          (prev == LBC(PR) &&                                   // LB23a
+           (lbc == LBC(ID) || lbc == LBC(EB) || lbc == LBC(EM))) ||
+          ((prev == LBC(ID) || prev == LBC(EB) || prev == LBC(EM)) &&
+           lbc == LBC(PO)) ||
+          ((prev == LBC(PR) || prev == LBC(PO)) &&              // LB24
+           (lbc == LBC(AL) || lbc == LBC(HL))) ||
+          ((prev == LBC(AL) || prev == LBC(HL)) &&
+           (lbc == LBC(PR) || lbc == LBC(PO))) ||
+          (nu == 1 &&                                           // LB25
+           (lbc == LBC(PO) || lbc == LBC(PR) || lbc == LBC(NU))) ||
+          (nu == 2 && (lbc == LBC(PO) || lbc == LBC(PR))) ||
+          ((prev == LBC(PO) || prev == LBC(PR)) && lbc == LBC(OP) &&
+           (la == LBC(NU) || (la == LBC(IS) && la2 == LBC(NU)))) ||
+          ((prev == LBC(PO) || prev == LBC(PR) || prev == LBC(HY) ||
+            prev == LBC(IS)) && lbc == LBC(NU)) ||
+          (prev == LBC(JL) &&                                   // LB26
+           (lbc == LBC(JL) || lbc == LBC(JV) || lbc == LBC(H2) || lbc == LBC(H3))) ||
+          ((prev == LBC(JV) || prev == LBC(H2)) &&
+           (lbc == LBC(JV) || lbc == LBC(JT))) ||
+          ((prev == LBC(JT) || prev == LBC(H3)) && lbc == LBC(JT)) ||
+          (LB_HANGUL(prev) && lbc == LBC(PO)) ||                // LB27
+          (prev == LBC(PR) && LB_HANGUL(lbc)) ||
+          ((prev == LBC(AL) || prev == LBC(HL)) &&              // LB28
+           (lbc == LBC(AL) || lbc == LBC(HL))) ||
+          (prev == LBC(AP) && LB_AKSARA(lbc, uc)) ||            // LB28a
+          (LB_AKSARA(prev, prevuc) && (lbc == LBC(VF) || lbc == LBC(VI))) ||
+          (LB_AKSARA(prevprev, prevprevuc) && prev == LBC(VI) &&
+           (lbc == LBC(AK) || uc == 0x25CC)) ||
+          (LB_AKSARA(prev, prevuc) && LB_AKSARA(lbc, uc) && la == LBC(VF)) ||
+          (prev == LBC(IS) && (lbc == LBC(AL) || lbc == LBC(HL))) || // LB29
+          ((prev == LBC(AL) || prev == LBC(HL) || prev == LBC(NU)) && // LB30
+           lbc == LBC(OP) && !line_break_eastasian(uc)) ||
+          (prev == LBC(CP) && !line_break_eastasian(prevuc) &&
+           (lbc == LBC(AL) || lbc == LBC(HL) || lbc == LBC(NU))) ||
+          (prev == LBC(RI) && lbc == LBC(RI) && ri % 2 == 1) || // LB30a
+          (prev == LBC(EB) && lbc == LBC(EM)) ||                // LB30b
+          (lbc == LBC(EM) &&
+           unsafe_get_property(prevuc)->category == UTF8PROC_CATEGORY_CN &&
+           unsafe_get_property(prevuc)->boundclass == UTF8PROC_BOUNDCLASS_EXTENDED_PICTOGRAPHIC);
+      }
+      if (!nobreak) {
+        if (mandatory) *mandatory = false;
+        return pos;                                             // LB31
+      }
+    }
+    if (lbc != LBC(SP)) {
+      quote = lbc == LBC(QU) && property->category == UTF8PROC_CATEGORY_PI &&
+        (prev < 0 || prev == LBC(BK) || prev == LBC(CR) || prev == LBC(LF) ||
+         prev == LBC(NL) || prev == LBC(OP) || prev == LBC(QU) ||
+         prev == LBC(GL) || prev == LBC(SP) || prev == LBC(ZW));
+      nonsp = lbc;
+    }
+    if (lbc == LBC(NU)) {
+      nu = 1;
+    } else if (nu == 1 && (lbc == LBC(SY) || lbc == LBC(IS))) {
+      nu = 1;
+    } else if (nu == 1 && (lbc == LBC(CL) || lbc == LBC(CP))) {
+      nu = 2;
+    } else {
+      nu = 0;
+    }
+    ri = lbc == LBC(RI) ? ri + 1 : 0;
+    prevprev = prev;
+    prevprevuc = prevuc;
+    prev = lbc;
+    prevuc = uc;
+    last = raw;
+    pos += n;
+  }
+  return strlen;                                                // LB3
+}
+
+#define SB_PARASEP(sbc) \
+  ((sbc) == UTF8PROC_SENTENCEBREAK_SEP || (sbc) == UTF8PROC_SENTENCEBREAK_CR || \
+   (sbc) == UTF8PROC_SENTENCEBREAK_LF)
+#define SB_SATERM(sbc) \
+  ((sbc) == UTF8PROC_SENTENCEBREAK_ATERM || (sbc) == UTF8PROC_SENTENCEBREAK_STERM)
+#define SB_IGNORED(sbc) \
+  ((sbc) == UTF8PROC_SENTENCEBREAK_EXTEND || (sbc) == UTF8PROC_SENTENCEBREAK_FORMAT)
+
+/* whether the first codepoint at or after str+pos that is a letter, a
+   paragraph separator or a sentence terminator is lowercase (SB8) */
+static utf8proc_bool sentence_break_lookahead_lower(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos) {
+  utf8proc_int32_t uc;
+  utf8proc_ssize_t n;
+  int sbc;
+  while (pos < strlen) {
+    n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+    if (uc < 0) return false;
+    sbc = unsafe_get_property(uc)->sentencebreak;
+    if (sbc == UTF8PROC_SENTENCEBREAK_OLETTER || sbc == UTF8PROC_SENTENCEBREAK_UPPER ||
+        sbc == UTF8PROC_SENTENCEBREAK_LOWER || SB_PARASEP(sbc) || SB_SATERM(sbc))
+      return sbc == UTF8PROC_SENTENCEBREAK_LOWER;
+    pos += n;
+  }
+  return false;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_sentence_break_next(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos
+) {
+  utf8proc_int32_t uc;
+  utf8proc_ssize_t n;
+  int last, prev, prevprev, sbc, term;
+  utf8proc_bool nobreak, sp;
+
+  if (pos >= strlen) return strlen;
+  n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+  if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+  pos += n;
+  /* last is the class of the preceding codepoint, prev and prevprev those
+     of the preceding codepoints not ignored by SB5, term the class of the
+     terminator if they end in SATerm Close* Sp* (or 0), and sp whether any
+     Sp follows it */
+  last = prev = unsafe_get_property(uc)->sentencebreak;
+  prevprev = -1;
+  term = SB_SATERM(prev) ? prev : 0;
+  sp = false;
+  while (pos < strlen) {
+    n = utf8proc_iterate(str + pos, strlen - pos, &uc);
+    if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+    sbc = unsafe_get_property(uc)->sentencebreak;
+    if (last == UTF8PROC_SENTENCEBREAK_CR && sbc == UTF8PROC_SENTENCEBREAK_LF) {
+      nobreak = true;                                           // SB3
+    } else if (SB_PARASEP(last)) {                              // SB4
+      nobreak = false;
+    } else if (SB_IGNORED(sbc)) {                               // SB5
+      last = sbc;
+      pos += n;
+      continue;
+    } else if (prev == UTF8PROC_SENTENCEBREAK_ATERM &&          // SB6
+               sbc == UTF8PROC_SENTENCEBREAK_NUMERIC) {
+      nobreak = true;
+    } else if ((prevprev == UTF8PROC_SENTENCEBREAK_UPPER ||     // SB7
+                prevprev == UTF8PROC_SENTENCEBREAK_LOWER) &&
+               prev == UTF8PROC_SENTENCEBREAK_ATERM &&
+               sbc == UTF8PROC_SENTENCEBREAK_UPPER) {
+      nobreak = true;
+    } else if (!term) {                                         // SB998
+      nobreak = true;
+    } else {
+      /* SB8 is checked last, so that it only looks ahead once per
+         terminator */
+      nobreak =
+        (sbc == UTF8PROC_SENTENCEBREAK_SCONTINUE || SB_SATERM(sbc)) || // SB8a
+        (!sp && sbc == UTF8PROC_SENTENCEBREAK_CLOSE) ||         // SB9
+        (sbc == UTF8PROC_SENTENCEBREAK_SP || SB_PARASEP(sbc)) || // SB9, SB10
+        (term == UTF8PROC_SENTENCEBREAK_ATERM &&                // SB8
+         sentence_break_lookahead_lower(str, strlen, pos));
+    }
+    if (!nobreak) return pos;                                   // SB11
+    if (SB_SATERM(sbc)) {
+      term = sbc;
+      sp = false;
+    } else if (term && sbc == UTF8PROC_SENTENCEBREAK_CLOSE && !sp) {
+      /* still SATerm Close* */
+    } else if (term && sbc == UTF8PROC_SENTENCEBREAK_SP) {
+      sp = true;
+    } else {
+      term = 0;
+    }
+    prevprev = prev;
+    prev = last = sbc;
+    pos += n;
+  }
+  return strlen;                                                // SB2
+}
+
 static utf8proc_int32_t seqindex_decode_entry(const utf8proc_uint16_t **entry)
 {
   utf8proc_int32_t entry_cp = **entry;
@@ -396,6 +1018,18 @@ static utf8proc_ssize_t seqindex_write_char_decomposed(utf8proc_uint16_t seqinde
   return written;
 }
 
+/* write the precomputed full decomposition of a property row, already in
+   canonical order, in the manner of seqindex_write_char_decomposed */
+static utf8proc_ssize_t write_full_decomposition(utf8proc_uint16_t index, utf8proc_bool compat, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize) {
+  const utf8proc_int32_t *seq = utf8proc_decompositions +
+    utf8proc_decompositions_index[2 * index + (compat ? 1 : 0)];
+  utf8proc_ssize_t len = seq[0], i;
+  if (bufsize >= len) {
+    for (i = 0; i < len; i++) dst[i] = seq[i + 1];
+  }
+  return len;
+}
+
 UTF8PROC_DLLEXPORT utf8proc_int32_t utf8proc_tolower(utf8proc_int32_t c)
 {
   utf8proc_int32_t cl = utf8proc_get_property(c)->lowercase_seqindex;
@@ -437,7 +1071,7 @@ UTF8PROC_DLLEXPORT utf8proc_bool utf8proc_charwidth_ambiguous(utf8proc_int32_t c
 }
 
 UTF8PROC_DLLEXPORT utf8proc_category_t utf8proc_category(utf8proc_int32_t c) {
-  return (utf8proc_category_t) utf8proc_get_property(c)->category;
+  return (utf8proc_category_t) get_hotprop(c)->category;
 }
 
 UTF8PROC_DLLEXPORT const char *utf8proc_category_string(utf8proc_int32_t c) {
@@ -449,12 +1083,16 @@ UTF8PROC_DLLEXPORT const char *utf8proc_category_string(utf8proc_int32_t c) {
   return utf8proc_decompose_char((replacement_uc), dst, bufsize, \
   options & ~(unsigned int)UTF8PROC_LUMP, last_boundclass)
 
-UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_char(utf8proc_int32_t uc, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize, utf8proc_option_t options, int *last_boundclass) {
-  const utf8proc_property_t *property;
+/* utf8proc_decompose_char which, if combining_class is not NULL and uc is
+   written unchanged as a single codepoint, also stores its combining class */
+static utf8proc_ssize_t decompose_char_class(utf8proc_int32_t uc, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize, utf8proc_option_t options, int *last_boundclass, int *combining_class) {
+  utf8proc_uint16_t index;
+  const utf8proc_hotprop_t *property;
   utf8proc_propval_t category;
   utf8proc_int32_t hangul_sindex;
   if (uc < 0 || uc >= 0x110000) return UTF8PROC_ERROR_NOTASSIGNED;
-  property = unsafe_get_property(uc);
+  index = unsafe_property_index(uc);
+  property = utf8proc_hot_properties + index;
   category = property->category;
   hangul_sindex = uc - UTF8PROC_HANGUL_SBASE;
   if (options & (UTF8PROC_COMPOSE|UTF8PROC_DECOMPOSE)) {
@@ -513,14 +1151,19 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_char(utf8proc_int32_t uc,
       category == UTF8PROC_CATEGORY_ME) return 0;
   }
   if (options & UTF8PROC_CASEFOLD) {
-    if (property->casefold_seqindex != UINT16_MAX) {
-      return seqindex_write_char_decomposed(property->casefold_seqindex, dst, bufsize, options, last_boundclass);
+    if (property->casefold) {
+      return seqindex_write_char_decomposed(utf8proc_properties[index].casefold_seqindex, dst, bufsize, options, last_boundclass);
     }
   }
   if (options & (UTF8PROC_COMPOSE|UTF8PROC_DECOMPOSE)) {
-    if (property->decomp_seqindex != UINT16_MAX &&
-        (!property->decomp_type || (options & UTF8PROC_COMPAT))) {
-      return seqindex_write_char_decomposed(property->decomp_seqindex, dst, bufsize, options, last_boundclass);
+    if (property->canonical_decomp ||
+        (property->compat_decomp && (options & UTF8PROC_COMPAT))) {
+      /* none of the other options affect the characters of the
+         decomposition, which then needs no recursion */
+      if (!(options & (UTF8PROC_CASEFOLD|UTF8PROC_LUMP|UTF8PROC_STRIPMARK|
+                       UTF8PROC_IGNORE|UTF8PROC_CHARBOUND)))
+        return write_full_decomposition(index, (options & UTF8PROC_COMPAT) != 0, dst, bufsize);
+      return seqindex_write_char_decomposed(utf8proc_properties[index].decomp_seqindex, dst, bufsize, options, last_boundclass);
     }
   }
   if (options & UTF8PROC_CHARBOUND) {
@@ -534,9 +1177,14 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_char(utf8proc_int32_t uc,
     }
   }
   if (bufsize >= 1) *dst = uc;
+  if (combining_class) *combining_class = property->combining_class;
   return 1;
 }
 
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_char(utf8proc_int32_t uc, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize, utf8proc_option_t options, int *last_boundclass) {
+  return decompose_char_class(uc, dst, bufsize, options, last_boundclass, NULL);
+}
+
 UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose(
   const utf8proc_uint8_t *str, utf8proc_ssize_t strlen,
   utf8proc_int32_t *buffer, utf8proc_ssize_t bufsize, utf8proc_option_t options
@@ -544,16 +1192,168 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose(
     return utf8proc_decompose_custom(str, strlen, buffer, bufsize, options, NULL, NULL);
 }
 
-UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_custom(
+/* maximum length of a run of combining characters that decompose_srcmap
+   reorders as it is written; longer runs, which cannot occur in stream-safe
+   text, are left to canonical_reorder */
+#define REORDER_RUN_MAX 32
+
+/* combining class of a decomposed codepoint, or of the -1 grapheme
+   boundaries of UTF8PROC_CHARBOUND */
+static int reorder_class(utf8proc_int32_t uc) {
+  /* no character below U+0300 is a combining character */
+  return uc < 0x300 ? 0 : unsafe_get_hotprop(uc)->combining_class;
+}
+
+/* stably sort the length combining characters of a run by combining
+   class, keeping srcmap, if not NULL, in step: runs longer than
+   REORDER_RUN_MAX are counting sorted through a temporary copy, so that the
+   time is linear however long the run, and shorter ones, or all if the
+   copy cannot be allocated, insertion sorted */
+static void sort_run(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_ssize_t *srcmap) {
+  utf8proc_ssize_t i, j;
+  void *tmp = NULL;
+  if (length > REORDER_RUN_MAX) {
+    STATS_ADD(allocations, 1);
+    tmp = malloc((size_t)length * (sizeof(utf8proc_ssize_t) +
+      sizeof(utf8proc_int32_t) + sizeof(utf8proc_uint8_t)));
+  }
+  if (tmp) {
+    utf8proc_ssize_t *tmpmap = (utf8proc_ssize_t *)tmp;
+    utf8proc_int32_t *tmpbuf = (utf8proc_int32_t *)(tmpmap + length);
+    utf8proc_uint8_t *classes = (utf8proc_uint8_t *)(tmpbuf + length);
+    utf8proc_ssize_t count[256];
+    for (i = 0; i < 256; i++) count[i] = 0;
+    for (i = 0; i < length; i++) {
+      classes[i] = (utf8proc_uint8_t)reorder_class(buffer[i]);
+      count[classes[i]]++;
+    }
+    for (i = 0, j = 0; i < 256; i++) {
+      utf8proc_ssize_t n = count[i];
+      count[i] = j;
+      j += n;
+    }
+    for (i = 0; i < length; i++) {
+      j = count[classes[i]]++;
+      tmpbuf[j] = buffer[i];
+      if (srcmap) tmpmap[j] = srcmap[i];
+    }
+    for (i = 0; i < length; i++) {
+      buffer[i] = tmpbuf[i];
+      if (srcmap) srcmap[i] = tmpmap[i];
+    }
+    free(tmp);
+    return;
+  }
+  for (i = 1; i < length; i++) {
+    utf8proc_int32_t uc = buffer[i];
+    utf8proc_ssize_t src = srcmap ? srcmap[i] : 0;
+    int combining_class = reorder_class(uc);
+    for (j = i; j > 0 && reorder_class(buffer[j-1]) > combining_class; j--) {
+      buffer[j] = buffer[j-1];
+      if (srcmap) srcmap[j] = srcmap[j-1];
+    }
+    buffer[j] = uc;
+    if (srcmap) srcmap[j] = src;
+  }
+}
+
+/* sort runs of combining characters in buffer by combining class, keeping
+   srcmap, if not NULL, in step */
+static void canonical_reorder(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_ssize_t *srcmap) {
+  utf8proc_ssize_t start = 0, end;
+  while (start < length) {
+    if (reorder_class(buffer[start]) == 0) {
+      start++;
+      continue;
+    }
+    for (end = start + 1; end < length && reorder_class(buffer[end]) != 0; end++) ;
+    if (end - start > 1)
+      sort_run(buffer + start, end - start, srcmap ? srcmap + start : NULL);
+    start = end;
+  }
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_canonical_reorder(utf8proc_int32_t *buffer, utf8proc_ssize_t length) {
+  canonical_reorder(buffer, length, NULL);
+}
+
+/* size of the buffer a codepoint is decomposed into by decompose_streamsafe,
+   well above the 18 codepoints of the longest decomposition, U+FDFA */
+#define STREAMSAFE_DECOMPOSE_SIZE 64
+
+/* maximum number of consecutive non-starters in stream-safe text */
+#define STREAMSAFE_NONSTARTERS_MAX 30
+
+/* decompose_char_class for UTF8PROC_STREAMSAFE, preceding the decomposition
+   with U+034F COMBINING GRAPHEME JOINER if it would extend the trailing
+   non-starters, whose number is in *nonstarters, beyond
+   STREAMSAFE_NONSTARTERS_MAX, as in the algorithm of UAX #15. As required
+   there, the non-starters are those of the compatibility decomposition
+   whatever the normalization form, so that the result stays stream-safe
+   once converted to NFKD or NFKC */
+static utf8proc_ssize_t decompose_streamsafe(utf8proc_int32_t uc, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize,
+  utf8proc_option_t options, int *last_boundclass, utf8proc_ssize_t *nonstarters) {
+  utf8proc_int32_t decomposed[STREAMSAFE_DECOMPOSE_SIZE];
+  utf8proc_int32_t compat[STREAMSAFE_DECOMPOSE_SIZE];
+  const utf8proc_int32_t *counted = decomposed;
+  utf8proc_ssize_t n, ncounted, i, leading = 0, trailing = 0, cgj;
+  n = decompose_char_class(uc, decomposed, STREAMSAFE_DECOMPOSE_SIZE, options,
+    last_boundclass, NULL);
+  if (n < 0) return n;
+  if (n > STREAMSAFE_DECOMPOSE_SIZE) return UTF8PROC_ERROR_OVERFLOW;
+  ncounted = n;
+  if (!(options & UTF8PROC_COMPAT)) {
+    int boundclass = UTF8PROC_BOUNDCLASS_START;
+    ncounted = utf8proc_decompose_char(uc, compat, STREAMSAFE_DECOMPOSE_SIZE,
+      UTF8PROC_DECOMPOSE | UTF8PROC_COMPAT, &boundclass);
+    if (ncounted < 0) return ncounted;
+    if (ncounted > STREAMSAFE_DECOMPOSE_SIZE) return UTF8PROC_ERROR_OVERFLOW;
+    counted = compat;
+  }
+  while (leading < ncounted && reorder_class(counted[leading]) != 0) leading++;
+  while (trailing < ncounted - leading && reorder_class(counted[ncounted-1-trailing]) != 0) trailing++;
+  cgj = *nonstarters + leading > STREAMSAFE_NONSTARTERS_MAX;
+  if (cgj) *nonstarters = 0;
+  *nonstarters = leading == ncounted ? *nonstarters + ncounted : trailing;
+  if (n + cgj <= bufsize) {
+    if (cgj) dst[0] = 0x034F;
+    for (i = 0; i < n; i++) dst[cgj + i] = decomposed[i];
+  }
+  return n + cgj;
+}
+
+/* decompose_char_class, or decompose_streamsafe if UTF8PROC_STREAMSAFE is
+   set in options, in which case *combining_class is left alone */
+static utf8proc_ssize_t decompose_option(utf8proc_int32_t uc, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize,
+  utf8proc_option_t options, int *last_boundclass, int *combining_class, utf8proc_ssize_t *nonstarters) {
+  if (options & UTF8PROC_STREAMSAFE)
+    return decompose_streamsafe(uc, dst, bufsize, options, last_boundclass, nonstarters);
+  return decompose_char_class(uc, dst, bufsize, options, last_boundclass, combining_class);
+}
+
+/* internal version of utf8proc_decompose_custom which, if srcmap is not NULL,
+   also stores the index of the source codepoint each written codepoint was
+   derived from, and the number of source codepoints in *srccount */
+static utf8proc_ssize_t decompose_srcmap(
   const utf8proc_uint8_t *str, utf8proc_ssize_t strlen,
   utf8proc_int32_t *buffer, utf8proc_ssize_t bufsize, utf8proc_option_t options,
-  utf8proc_custom_func custom_func, void *custom_data
+  utf8proc_custom_func custom_func, void *custom_data,
+  utf8proc_ssize_t *srcmap, utf8proc_ssize_t *srccount
 ) {
   /* strlen will be ignored, if UTF8PROC_NULLTERM is set in options */
   utf8proc_ssize_t wpos = 0;
+  utf8proc_ssize_t srcpos = 0;
+  /* the run of combining characters at the end of buffer, already in
+     canonical order, and their combining classes; reorder is 1 while runs
+     are reordered as they are written and 2 once one got too long */
+  utf8proc_ssize_t run_start = 0, run_length = 0;
+  utf8proc_uint8_t run_classes[REORDER_RUN_MAX];
+  int reorder = (options & (UTF8PROC_COMPOSE|UTF8PROC_DECOMPOSE)) != 0;
+  /* trailing non-starters of the result, for UTF8PROC_STREAMSAFE */
+  utf8proc_ssize_t nonstarters = 0;
   if ((options & UTF8PROC_COMPOSE) && (options & UTF8PROC_DECOMPOSE))
     return UTF8PROC_ERROR_INVALIDOPTS;
-  if ((options & UTF8PROC_STRIPMARK) &&
+  if ((options & (UTF8PROC_STRIPMARK|UTF8PROC_STREAMSAFE)) &&
       !(options & UTF8PROC_COMPOSE) && !(options & UTF8PROC_DECOMPOSE))
     return UTF8PROC_ERROR_INVALIDOPTS;
   {
@@ -561,9 +1361,10 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_custom(
     utf8proc_ssize_t rpos = 0;
     utf8proc_ssize_t decomp_result;
     int boundclass = UTF8PROC_BOUNDCLASS_START;
+    int uc_class;
     while (1) {
       if (options & UTF8PROC_NULLTERM) {
-        rpos += utf8proc_iterate(str + rpos, -1, &uc);
+        rpos += iterate_option(str + rpos, -1, &uc, options);
         /* checking of return value is not necessary,
            as 'uc' is < 0 in case of error */
         if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
@@ -571,17 +1372,55 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_custom(
         if (uc == 0) break;
       } else {
         if (rpos >= strlen) break;
-        rpos += utf8proc_iterate(str + rpos, strlen - rpos, &uc);
+        rpos += iterate_option(str + rpos, strlen - rpos, &uc, options);
         if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
       }
       if (custom_func != NULL) {
         uc = custom_func(uc, custom_data);   /* user-specified custom mapping */
+        if (uc == UTF8PROC_CUSTOM_REMOVE) {
+          srcpos++;
+          continue;
+        }
       }
-      decomp_result = utf8proc_decompose_char(
+      uc_class = -1;
+      decomp_result = decompose_option(
         uc, buffer + wpos, (bufsize > wpos) ? (bufsize - wpos) : 0, options,
-        &boundclass
+        &boundclass, &uc_class, &nonstarters
       );
       if (decomp_result < 0) return decomp_result;
+      if (srcmap) {
+        utf8proc_ssize_t i;
+        for (i = wpos; i < wpos + decomp_result && i < bufsize; i++)
+          srcmap[i] = srcpos;
+      }
+      if (reorder == 1 && wpos + decomp_result <= bufsize) {
+        utf8proc_ssize_t i, j;
+        for (i = wpos; i < wpos + decomp_result; i++) {
+          utf8proc_int32_t uc2 = buffer[i];
+          /* no character below U+0300 is a combining character */
+          int combining_class = uc_class >= 0 ? uc_class : uc2 < 0x300 ? 0 :
+            unsafe_get_hotprop(uc2)->combining_class;
+          if (combining_class == 0) {
+            run_start = i + 1;
+            run_length = 0;
+            continue;
+          }
+          if (run_length == REORDER_RUN_MAX) {
+            reorder = 2;
+            break;
+          }
+          for (j = i; j > run_start && run_classes[j-1-run_start] > combining_class; j--) {
+            buffer[j] = buffer[j-1];
+            run_classes[j-run_start] = run_classes[j-1-run_start];
+            if (srcmap) srcmap[j] = srcmap[j-1];
+          }
+          buffer[j] = uc2;
+          run_classes[j-run_start] = (utf8proc_uint8_t)combining_class;
+          if (srcmap) srcmap[j] = srcpos;
+          run_length++;
+        }
+      }
+      srcpos++;
       wpos += decomp_result;
       /* prohibiting integer overflows due to too long strings: */
       if (wpos < 0 ||
@@ -589,35 +1428,35 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_custom(
         return UTF8PROC_ERROR_OVERFLOW;
     }
   }
-  if ((options & (UTF8PROC_COMPOSE|UTF8PROC_DECOMPOSE)) && bufsize >= wpos) {
-    utf8proc_ssize_t pos = 0;
-    while (pos < wpos-1) {
-      utf8proc_int32_t uc1, uc2;
-      const utf8proc_property_t *property1, *property2;
-      uc1 = buffer[pos];
-      uc2 = buffer[pos+1];
-      property1 = unsafe_get_property(uc1);
-      property2 = unsafe_get_property(uc2);
-      if (property1->combining_class > property2->combining_class &&
-          property2->combining_class > 0) {
-        buffer[pos] = uc2;
-        buffer[pos+1] = uc1;
-        if (pos > 0) pos--; else pos++;
-      } else {
-        pos++;
-      }
-    }
+  if (reorder == 2 && bufsize >= wpos) {
+    canonical_reorder(buffer, wpos, srcmap);
   }
+  if (srccount) *srccount = srcpos;
   return wpos;
 }
 
-UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options) {
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_custom(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen,
+  utf8proc_int32_t *buffer, utf8proc_ssize_t bufsize, utf8proc_option_t options,
+  utf8proc_custom_func custom_func, void *custom_data
+) {
+  utf8proc_ssize_t result;
+  PROBE2(decompose__entry, strlen, options);
+  result = decompose_srcmap(str, strlen, buffer, bufsize, options, custom_func, custom_data, NULL, NULL);
+  PROBE3(decompose__return, strlen, result, options);
+  return result;
+}
+
+/* internal version of utf8proc_normalize_utf32 which keeps srcmap, if not NULL,
+   in step with the codepoints in buffer */
+static utf8proc_ssize_t normalize_utf32_srcmap(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options, utf8proc_ssize_t *srcmap) {
   /* UTF8PROC_NULLTERM option will be ignored, 'length' is never ignored */
   if (options & (UTF8PROC_NLF2LS | UTF8PROC_NLF2PS | UTF8PROC_STRIPCC)) {
     utf8proc_ssize_t rpos;
     utf8proc_ssize_t wpos = 0;
     utf8proc_int32_t uc;
     for (rpos = 0; rpos < length; rpos++) {
+      utf8proc_ssize_t src_rpos = rpos, src_wpos = wpos;
       uc = buffer[rpos];
       if (uc == 0x000D && rpos < length-1 && buffer[rpos+1] == 0x000A) rpos++;
       if (uc == 0x000A || uc == 0x000D || uc == 0x0085 ||
@@ -641,6 +1480,7 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *b
       } else {
         buffer[wpos++] = uc;
       }
+      if (srcmap && wpos > src_wpos) srcmap[src_wpos] = srcmap[src_rpos];
     }
     length = wpos;
   }
@@ -652,7 +1492,7 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *b
     utf8proc_ssize_t wpos = 0;
     for (rpos = 0; rpos < length; rpos++) {
       utf8proc_int32_t current_char = buffer[rpos];
-      const utf8proc_property_t *current_property = unsafe_get_property(current_char);
+      const utf8proc_hotprop_t *current_property = unsafe_get_hotprop(current_char);
       if (starter && current_property->combining_class > max_combining_class) {
         /* combination perhaps possible */
         utf8proc_int32_t hangul_lindex;
@@ -680,11 +1520,11 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *b
             continue;
           }
         }
-        if (!starter_property) {
+        if (current_property->comb_issecond && !starter_property) {
           starter_property = unsafe_get_property(*starter);
         }
-        int idx = starter_property->comb_index;
-        if (idx < 0x3FF && current_property->comb_issecond) {
+        if (current_property->comb_issecond && starter_property->comb_index < 0x3FF) {
+          int idx = starter_property->comb_index;
           int len = starter_property->comb_length;
           utf8proc_int32_t max_second = utf8proc_combinations_second[idx + len - 1];
           if (current_char <= max_second) {
@@ -711,6 +1551,7 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *b
         }
       }
       buffer[wpos] = current_char;
+      if (srcmap) srcmap[wpos] = srcmap[rpos];
       if (current_property->combining_class) {
         if (current_property->combining_class > max_combining_class) {
           max_combining_class = current_property->combining_class;
@@ -727,11 +1568,20 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *b
   return length;
 }
 
-UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_reencode(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options) {
-  /* UTF8PROC_NULLTERM option will be ignored, 'length' is never ignored
-     ASSERT: 'buffer' has one spare byte of free space at the end! */
-  length = utf8proc_normalize_utf32(buffer, length, options);
-  if (length < 0) return length;
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options) {
+  return utf8proc_normalize_utf32_srcmap(buffer, length, options, NULL);
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32_srcmap(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options, utf8proc_ssize_t *srcmap) {
+  utf8proc_ssize_t result;
+  PROBE2(normalize__entry, length, options);
+  result = normalize_utf32_srcmap(buffer, length, options, srcmap);
+  PROBE3(normalize__return, length, result, options);
+  return result;
+}
+
+/* UTF-8 encoding step of utf8proc_reencode, without the normalization */
+static utf8proc_ssize_t encode_utf32(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options) {
   {
     utf8proc_ssize_t rpos, wpos = 0;
     utf8proc_int32_t uc;
@@ -751,42 +1601,985 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_reencode(utf8proc_int32_t *buffer,
   }
 }
 
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_reencode(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options) {
+  /* UTF8PROC_NULLTERM option will be ignored, 'length' is never ignored
+     ASSERT: 'buffer' has one spare byte of free space at the end! */
+  utf8proc_ssize_t result;
+  PROBE2(reencode__entry, length, options);
+  result = utf8proc_normalize_utf32(buffer, length, options);
+  if (result >= 0) result = encode_utf32(buffer, result, options);
+  PROBE3(reencode__return, length, result, options);
+  return result;
+}
+
 UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map(
   const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr, utf8proc_option_t options
 ) {
     return utf8proc_map_custom(str, strlen, dstptr, options, NULL, NULL);
 }
 
+/* make the malloc'ed *buffer, of size *size, at least needed bytes, keeping
+   its contents if keep is nonzero */
+static int grow_buffer(void **buffer, utf8proc_ssize_t *size, utf8proc_ssize_t needed, int keep) {
+  void *newptr;
+  if (needed <= *size) return 0;
+  STATS_ADD(allocations, 1);
+  if (keep) {
+    newptr = realloc(*buffer, (size_t)needed);
+    if (!newptr) return 1;
+  } else {
+    free(*buffer);
+    newptr = malloc((size_t)needed);
+    if (!newptr) {
+      *buffer = NULL;
+      *size = 0;
+      return 1;
+    }
+  }
+  *buffer = newptr;
+  *size = needed;
+  return 0;
+}
+
+/* size of the stack buffer holding the decomposed segment in map_composed */
+#define COMPOSE_SEGMENT_SIZE 64
+
+/* compose the length codepoints of segment and append their UTF-8 encoding
+   to the malloc'ed *dst, of size *dstsize, at *dstlen, growing it as needed */
+static utf8proc_ssize_t compose_segment(utf8proc_int32_t *segment, utf8proc_ssize_t length, utf8proc_option_t options,
+  void **dst, utf8proc_ssize_t *dstsize, utf8proc_ssize_t *dstlen) {
+  utf8proc_ssize_t i, needed;
+  length = normalize_utf32_srcmap(segment, length, options, NULL);
+  needed = *dstlen + 1;
+  for (i = 0; i < length; i++) {
+    needed += segment[i] < 0x80 ? 1 : segment[i] < 0x800 ? 2 :
+      segment[i] < 0x10000 ? 3 : 4;
+  }
+  if (needed > (utf8proc_ssize_t)(SSIZE_MAX/2)) return UTF8PROC_ERROR_OVERFLOW;
+  if (needed > *dstsize &&
+      grow_buffer(dst, dstsize, needed < 2 * *dstsize ? 2 * *dstsize : needed, 1))
+    return UTF8PROC_ERROR_NOMEM;
+  for (i = 0; i < length; i++) {
+    *dstlen += utf8proc_encode_char(segment[i], (utf8proc_uint8_t *)*dst + *dstlen);
+  }
+  return 0;
+}
+
+/* utf8proc_map_custom for the composed forms without line break or control
+   character options, storing the result in the malloc'ed *dstptr of size
+   *dstsize: the decomposition is composed and encoded segment by
+   segment, each ending before a starter that cannot combine with what
+   precedes it, so that the decomposition of the whole string is never
+   held in memory */
+static utf8proc_ssize_t map_composed(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, void **dstptr, utf8proc_ssize_t *dstsize,
+  utf8proc_option_t options, utf8proc_custom_func custom_func, void *custom_data
+) {
+  utf8proc_int32_t static_segment[COMPOSE_SEGMENT_SIZE];
+  utf8proc_int32_t *segment = static_segment;
+  utf8proc_ssize_t segsize = COMPOSE_SEGMENT_SIZE, seglen = 0;
+  /* the run of combining characters at the end of segment, as in
+     decompose_srcmap */
+  utf8proc_ssize_t run_start = 0, run_length = 0;
+  utf8proc_uint8_t run_classes[REORDER_RUN_MAX];
+  int reorder = 1;
+  utf8proc_ssize_t nonstarters = 0, last_nonstarters;
+  utf8proc_ssize_t dstlen = 0;
+  utf8proc_ssize_t rpos = 0, result = 0;
+  int boundclass = UTF8PROC_BOUNDCLASS_START;
+  utf8proc_int32_t uc;
+  if (grow_buffer(dstptr, dstsize,
+      ((options & UTF8PROC_NULLTERM) ? COMPOSE_SEGMENT_SIZE : strlen) + 1, 0))
+    return UTF8PROC_ERROR_NOMEM;
+  while (1) {
+    utf8proc_ssize_t i, j, n;
+    if (options & UTF8PROC_NULLTERM) {
+      rpos += iterate_option(str + rpos, -1, &uc, options);
+      if (uc < 0) { result = UTF8PROC_ERROR_INVALIDUTF8; break; }
+      if (rpos < 0) { result = UTF8PROC_ERROR_OVERFLOW; break; }
+      if (uc == 0) break;
+    } else {
+      if (rpos >= strlen) break;
+      rpos += iterate_option(str + rpos, strlen - rpos, &uc, options);
+      if (uc < 0) { result = UTF8PROC_ERROR_INVALIDUTF8; break; }
+    }
+    if (custom_func != NULL) {
+      uc = custom_func(uc, custom_data);   /* user-specified custom mapping */
+      if (uc == UTF8PROC_CUSTOM_REMOVE) continue;
+    }
+    last_nonstarters = nonstarters;
+    n = decompose_option(uc, segment + seglen, segsize - seglen, options,
+      &boundclass, NULL, &nonstarters);
+    if (n < 0) { result = n; break; }
+    if (n > segsize - seglen) {
+      utf8proc_int32_t *newptr;
+      utf8proc_ssize_t newsize = 2 * segsize;
+      if (newsize < seglen + n) newsize = seglen + n;
+      STATS_ADD(allocations, 1);
+      newptr = (utf8proc_int32_t *) malloc((size_t)newsize * sizeof(utf8proc_int32_t));
+      if (!newptr) { result = UTF8PROC_ERROR_NOMEM; break; }
+      for (i = 0; i < seglen; i++) newptr[i] = segment[i];
+      if (segment != static_segment) free(segment);
+      segment = newptr;
+      segsize = newsize;
+      nonstarters = last_nonstarters;
+      decompose_option(uc, segment + seglen, n, options, &boundclass, NULL, &nonstarters);
+    }
+    for (i = seglen, seglen += n; i < seglen; i++) {
+      utf8proc_int32_t uc2 = segment[i];
+      int combining_class = 0, boundary = 1;
+      /* no character below U+0300 combines with what precedes it */
+      if (uc2 >= 0x300) {
+        const utf8proc_hotprop_t *property = unsafe_get_hotprop(uc2);
+        combining_class = property->combining_class;
+        boundary = combining_class == 0 && !property->comb_issecond &&
+          !(uc2 >= UTF8PROC_HANGUL_VBASE && uc2 < UTF8PROC_HANGUL_VBASE + UTF8PROC_HANGUL_VCOUNT) &&
+          !(uc2 > UTF8PROC_HANGUL_TBASE && uc2 < UTF8PROC_HANGUL_TBASE + UTF8PROC_HANGUL_TCOUNT);
+      }
+      if (boundary && i > 0) {
+        if (reorder == 2) canonical_reorder(segment, i, NULL);
+        result = compose_segment(segment, i, options, dstptr, dstsize, &dstlen);
+        if (result < 0) break;
+        for (j = i; j < seglen; j++) segment[j - i] = segment[j];
+        seglen -= i;
+        i = 0;
+        reorder = 1;
+      }
+      if (combining_class == 0) {
+        run_start = i + 1;
+        run_length = 0;
+        continue;
+      }
+      if (reorder == 2) continue;
+      if (run_length == REORDER_RUN_MAX) {
+        reorder = 2;
+        continue;
+      }
+      for (j = i; j > run_start && run_classes[j-1-run_start] > combining_class; j--) {
+        segment[j] = segment[j-1];
+        run_classes[j-run_start] = run_classes[j-1-run_start];
+      }
+      segment[j] = uc2;
+      run_classes[j-run_start] = (utf8proc_uint8_t)combining_class;
+      run_length++;
+    }
+    if (result < 0) break;
+  }
+  if (result == 0 && seglen > 0) {
+    if (reorder == 2) canonical_reorder(segment, seglen, NULL);
+    result = compose_segment(segment, seglen, options, dstptr, dstsize, &dstlen);
+  }
+  if (segment != static_segment) free(segment);
+  if (result < 0) return result;
+  ((utf8proc_uint8_t *)*dstptr)[dstlen] = 0;
+  return dstlen;
+}
+
+/* utf8proc_map_custom storing the result in the malloc'ed *dstptr of size
+   *dstsize, which is grown as needed */
+static utf8proc_ssize_t map_buffer(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, void **dstptr, utf8proc_ssize_t *dstsize,
+  utf8proc_option_t options, utf8proc_custom_func custom_func, void *custom_data
+) {
+  utf8proc_ssize_t result;
+  PROBE2(map__entry, strlen, options);
+  STATS_ADD(map_calls, 1);
+  if (!(options & UTF8PROC_NULLTERM)) STATS_ADD(bytes_in, strlen);
+  if ((options & UTF8PROC_COMPOSE) &&
+      !(options & (UTF8PROC_DECOMPOSE|UTF8PROC_NLF2LS|UTF8PROC_NLF2PS|
+                   UTF8PROC_STRIPCC|UTF8PROC_CHARBOUND))) {
+    STATS_ADD(composed_path, 1);
+    result = map_composed(str, strlen, dstptr, dstsize, options, custom_func, custom_data);
+  } else {
+    STATS_ADD(decomposed_path, 1);
+    result = utf8proc_decompose_custom(str, strlen, NULL, 0, options, custom_func, custom_data);
+    if (result >= 0 &&
+        grow_buffer(dstptr, dstsize, result * (utf8proc_ssize_t)sizeof(utf8proc_int32_t) + 1, 0))
+      result = UTF8PROC_ERROR_NOMEM;
+    if (result >= 0)
+      result = utf8proc_decompose_custom(str, strlen, (utf8proc_int32_t *)*dstptr, result, options, custom_func, custom_data);
+    if (result >= 0)
+      result = utf8proc_reencode((utf8proc_int32_t *)*dstptr, result, options);
+  }
+  if (result > 0) STATS_ADD(bytes_out, result);
+  PROBE3(map__return, strlen, result, options);
+  return result;
+}
+
 UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map_custom(
   const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr, utf8proc_option_t options,
   utf8proc_custom_func custom_func, void *custom_data
 ) {
-  utf8proc_int32_t *buffer;
+  void *buffer = NULL;
+  utf8proc_ssize_t size = 0, result;
+  *dstptr = NULL;
+  result = map_buffer(str, strlen, &buffer, &size, options, custom_func, custom_data);
+  if (result < 0) {
+    free(buffer);
+    return result;
+  }
+  if (size > result + 1) {
+    void *newptr;
+    STATS_ADD(allocations, 1);
+    newptr = realloc(buffer, (size_t)result+1);
+    if (newptr) buffer = newptr;
+  }
+  *dstptr = (utf8proc_uint8_t *)buffer;
+  return result;
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_arena_init(utf8proc_arena_t *arena, utf8proc_ssize_t limit) {
+  arena->buffer = NULL;
+  arena->size = 0;
+  arena->limit = limit;
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_arena_release(utf8proc_arena_t *arena) {
+  free(arena->buffer);
+  arena->buffer = NULL;
+  arena->size = 0;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map_arena(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, const utf8proc_uint8_t **dstptr, utf8proc_option_t options,
+  utf8proc_custom_func custom_func, void *custom_data, utf8proc_arena_t *arena
+) {
   utf8proc_ssize_t result;
   *dstptr = NULL;
+  /* the memory needed for the previous string is no longer in use */
+  if (arena->limit > 0 && arena->size > arena->limit) {
+    utf8proc_arena_release(arena);
+  }
+  result = map_buffer(str, strlen, &arena->buffer, &arena->size, options, custom_func, custom_data);
+  if (result < 0) return result;
+  *dstptr = (const utf8proc_uint8_t *)arena->buffer;
+  return result;
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_get_stats(utf8proc_stats_t *dst) {
+#ifdef UTF8PROC_STATS
+  dst->map_calls = STATS_GET(map_calls);
+  dst->composed_path = STATS_GET(composed_path);
+  dst->decomposed_path = STATS_GET(decomposed_path);
+  dst->bytes_in = STATS_GET(bytes_in);
+  dst->bytes_out = STATS_GET(bytes_out);
+  dst->allocations = STATS_GET(allocations);
+#else
+  dst->map_calls = dst->composed_path = dst->decomposed_path = 0;
+  dst->bytes_in = dst->bytes_out = dst->allocations = 0;
+#endif
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_reset_stats(void) {
+#ifdef UTF8PROC_STATS
+  STATS_RESET(map_calls);
+  STATS_RESET(composed_path);
+  STATS_RESET(decomposed_path);
+  STATS_RESET(bytes_in);
+  STATS_RESET(bytes_out);
+  STATS_RESET(allocations);
+#endif
+}
+
+/* close the last entry of the offsets being built, at source index srcend,
+   merging it into the preceding entry if both are one-to-one */
+static void close_offset(utf8proc_offset_t *offsets, utf8proc_ssize_t *n,
+  utf8proc_bool *run, utf8proc_ssize_t srcend
+) {
+  utf8proc_offset_t *last = &offsets[*n-1];
+  last->srclen = srcend - last->src;
+  if (last->dstlen == 1 && last->srclen == 1) {
+    if (*run) {
+      /* extend the preceding run of one-to-one codepoints */
+      offsets[*n-2].dstlen++;
+      offsets[*n-2].srclen++;
+      (*n)--;
+    }
+    *run = true;
+  } else {
+    *run = false;
+  }
+}
+
+/* run-length encode the codepoint source map of a normalized string of
+   length dstlen, derived from srccount source codepoints, into offsets */
+static utf8proc_ssize_t build_offsets(const utf8proc_ssize_t *srcmap, utf8proc_ssize_t dstlen,
+  utf8proc_ssize_t srccount, utf8proc_offset_t *offsets
+) {
+  utf8proc_ssize_t i, n = 0;
+  utf8proc_bool run = false; /* whether the last closed entry is one-to-one */
+  for (i = 0; i < dstlen; i++) {
+    utf8proc_ssize_t src = srcmap[i];
+    if (n > 0 && src < offsets[n-1].src + offsets[n-1].srclen) {
+      /* derived from a source codepoint already in an entry, as for
+         decompositions and reordered combining marks: merge back */
+      while (n > 1 && src < offsets[n-1].src) {
+        offsets[n-2].dstlen += offsets[n-1].dstlen;
+        offsets[n-2].srclen = offsets[n-1].src + offsets[n-1].srclen - offsets[n-2].src;
+        n--;
+        run = false;
+      }
+      if (src < offsets[n-1].src) {
+        offsets[n-1].srclen += offsets[n-1].src - src;
+        offsets[n-1].src = src;
+      }
+      offsets[n-1].dstlen++;
+      continue;
+    }
+    if (n > 0) {
+      /* source codepoints skipped over were absorbed by the last entry */
+      close_offset(offsets, &n, &run, src);
+      offsets[n].src = src;
+    } else {
+      offsets[n].src = 0; /* includes leading codepoints that were removed */
+    }
+    offsets[n].dst = i;
+    offsets[n].dstlen = 1;
+    offsets[n].srclen = src - offsets[n].src + 1;
+    n++;
+  }
+  if (n > 0) {
+    close_offset(offsets, &n, &run, srccount);
+  } else if (srccount > 0) {
+    offsets[0].dst = offsets[0].dstlen = offsets[0].src = 0;
+    offsets[0].srclen = srccount;
+    n = 1;
+  }
+  return n;
+}
+
+/* the byte position in str after count codepoints from byte position pos,
+   decoded as by the mapping functions with options */
+static utf8proc_ssize_t skip_codepoints(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen,
+  utf8proc_ssize_t pos, utf8proc_ssize_t count, utf8proc_option_t options
+) {
+  utf8proc_int32_t uc;
+  for (; count > 0; count--)
+    pos += iterate_option(str + pos, strlen < 0 ? -1 : strlen - pos, &uc, options);
+  return pos;
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_offsets_bytes(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, const utf8proc_uint8_t *dst,
+  utf8proc_offset_t *offsets, utf8proc_ssize_t noffsets, utf8proc_option_t options
+) {
+  utf8proc_ssize_t i, srcpos = 0, dstpos = 0, end;
+  if (options & UTF8PROC_NULLTERM) strlen = -1;
+  /* the entries are contiguous, so both strings are walked only once */
+  for (i = 0; i < noffsets; i++) {
+    end = skip_codepoints(str, strlen, srcpos, offsets[i].srclen, options);
+    offsets[i].src = srcpos;
+    offsets[i].srclen = end - srcpos;
+    srcpos = end;
+    end = skip_codepoints(dst, -1, dstpos, offsets[i].dstlen, 0);
+    offsets[i].dst = dstpos;
+    offsets[i].dstlen = end - dstpos;
+    dstpos = end;
+  }
+}
+
+/* utf8proc_map_offsets without the counters and probes */
+static utf8proc_ssize_t map_offsets(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr, utf8proc_option_t options,
+  utf8proc_custom_func custom_func, void *custom_data,
+  utf8proc_offset_t **offsetsptr, utf8proc_ssize_t *noffsets
+) {
+  utf8proc_int32_t *buffer;
+  utf8proc_ssize_t *srcmap;
+  utf8proc_offset_t *offsets;
+  utf8proc_ssize_t result, srccount, n;
+  *dstptr = NULL;
+  *offsetsptr = NULL;
+  *noffsets = 0;
+  if (options & UTF8PROC_CHARBOUND) return UTF8PROC_ERROR_INVALIDOPTS;
   result = utf8proc_decompose_custom(str, strlen, NULL, 0, options, custom_func, custom_data);
   if (result < 0) return result;
+  STATS_ADD(allocations, 2);
   buffer = (utf8proc_int32_t *) malloc(((utf8proc_size_t)result) * sizeof(utf8proc_int32_t) + 1);
   if (!buffer) return UTF8PROC_ERROR_NOMEM;
-  result = utf8proc_decompose_custom(str, strlen, buffer, result, options, custom_func, custom_data);
-  if (result < 0) {
+  srcmap = (utf8proc_ssize_t *) malloc(((utf8proc_size_t)result + 1) * sizeof(utf8proc_ssize_t));
+  if (!srcmap) {
     free(buffer);
-    return result;
+    return UTF8PROC_ERROR_NOMEM;
   }
-  result = utf8proc_reencode(buffer, result, options);
+  result = decompose_srcmap(str, strlen, buffer, result, options, custom_func, custom_data, srcmap, &srccount);
+  if (result >= 0) result = normalize_utf32_srcmap(buffer, result, options, srcmap);
   if (result < 0) {
+    free(srcmap);
     free(buffer);
     return result;
   }
+  STATS_ADD(allocations, 1);
+  offsets = (utf8proc_offset_t *) malloc(((utf8proc_size_t)result + 1) * sizeof(utf8proc_offset_t));
+  if (!offsets) {
+    free(srcmap);
+    free(buffer);
+    return UTF8PROC_ERROR_NOMEM;
+  }
+  n = build_offsets(srcmap, result, srccount, offsets);
+  free(srcmap);
+  result = encode_utf32(buffer, result, options);
   {
     utf8proc_int32_t *newptr;
+    utf8proc_offset_t *newoffsets;
+    STATS_ADD(allocations, 1);
     newptr = (utf8proc_int32_t *) realloc(buffer, (size_t)result+1);
     if (newptr) buffer = newptr;
+    if (n > 0) {
+      STATS_ADD(allocations, 1);
+      newoffsets = (utf8proc_offset_t *) realloc(offsets, (size_t)n * sizeof(utf8proc_offset_t));
+      if (newoffsets) offsets = newoffsets;
+    }
   }
   *dstptr = (utf8proc_uint8_t *)buffer;
+  *offsetsptr = offsets;
+  *noffsets = n;
+  return result;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map_offsets(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr, utf8proc_option_t options,
+  utf8proc_custom_func custom_func, void *custom_data,
+  utf8proc_offset_t **offsetsptr, utf8proc_ssize_t *noffsets
+) {
+  utf8proc_ssize_t result;
+  PROBE2(map__entry, strlen, options);
+  STATS_ADD(map_calls, 1);
+  if (!(options & UTF8PROC_NULLTERM)) STATS_ADD(bytes_in, strlen);
+  STATS_ADD(decomposed_path, 1);
+  result = map_offsets(str, strlen, dstptr, options, custom_func, custom_data, offsetsptr, noffsets);
+  if (result > 0) STATS_ADD(bytes_out, result);
+  PROBE3(map__return, strlen, result, options);
   return result;
 }
 
+/* write the canonical decomposition of the UTS #39 prototype of uc, or of uc
+   itself if it is not confusable, to dst in the manner of utf8proc_decompose_char */
+static utf8proc_ssize_t confusable_write_prototype(utf8proc_int32_t uc, utf8proc_int32_t *dst, utf8proc_ssize_t bufsize) {
+  utf8proc_ssize_t written = 0, result;
+  utf8proc_ssize_t lo = 0;
+  utf8proc_ssize_t n = sizeof(utf8proc_confusables_codes) / sizeof(utf8proc_confusables_codes[0]);
+  utf8proc_ssize_t hi = n;
+  const utf8proc_uint16_t *entry, *end;
+  while (lo < hi) {
+    utf8proc_ssize_t mid = lo + (hi - lo) / 2;
+    if (utf8proc_confusables_codes[mid] < uc) lo = mid + 1; else hi = mid;
+  }
+  if (lo == n || utf8proc_confusables_codes[lo] != uc) {
+    return utf8proc_decompose_char(uc, dst, bufsize, UTF8PROC_DECOMPOSE, NULL);
+  }
+  entry = &utf8proc_confusables_sequences[utf8proc_confusables_indices[lo]];
+  end = &utf8proc_confusables_sequences[utf8proc_confusables_indices[lo+1]];
+  for (; entry < end; entry++) {
+    utf8proc_int32_t entry_cp = seqindex_decode_entry(&entry);
+    result = utf8proc_decompose_char(entry_cp, dst+written,
+      (bufsize > written) ? (bufsize - written) : 0, UTF8PROC_DECOMPOSE, NULL);
+    if (result < 0) return result;
+    written += result;
+  }
+  return written;
+}
+
+/* grow *buffer, of *size bytes, to hold at least needed codepoints, keeping
+   its contents */
+static int grow_codepoints(void **buffer, utf8proc_ssize_t *size, utf8proc_ssize_t needed) {
+  utf8proc_ssize_t newsize = 2 * *size;
+  if (newsize < needed * (utf8proc_ssize_t)sizeof(utf8proc_int32_t))
+    newsize = needed * (utf8proc_ssize_t)sizeof(utf8proc_int32_t);
+  return grow_buffer(buffer, size, newsize, 1);
+}
+
+/* compute the skeleton of str into the malloc'ed *buffer of size *size,
+   growing it as needed: str is decomposed once, codepoint by codepoint, to
+   NFD at the start of the buffer, the prototypes are written after it, and
+   the result is encoded to UTF-8 at the start of the buffer */
+static utf8proc_ssize_t skeleton_buffer(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, void **buffer, utf8proc_ssize_t *size
+) {
+  utf8proc_ssize_t rpos = 0, length = 0, wpos, capacity, n, i, result;
+  utf8proc_int32_t uc, *skeleton;
+  if (grow_buffer(buffer, size, (2 * strlen + 1) * (utf8proc_ssize_t)sizeof(utf8proc_int32_t), 0))
+    return UTF8PROC_ERROR_NOMEM;
+  while (rpos < strlen) {
+    rpos += utf8proc_iterate(str + rpos, strlen - rpos, &uc);
+    if (uc < 0) return UTF8PROC_ERROR_INVALIDUTF8;
+    while (1) {
+      capacity = *size / (utf8proc_ssize_t)sizeof(utf8proc_int32_t);
+      n = utf8proc_decompose_char(uc, (utf8proc_int32_t *)*buffer + length,
+        capacity - length, UTF8PROC_DECOMPOSE, NULL);
+      if (n < 0) return n;
+      if (n <= capacity - length) break;
+      if (grow_codepoints(buffer, size, length + n)) return UTF8PROC_ERROR_NOMEM;
+    }
+    length += n;
+  }
+  canonical_reorder((utf8proc_int32_t *)*buffer, length, NULL);
+  for (i = 0, wpos = length; i < length; i++) {
+    while (1) {
+      capacity = *size / (utf8proc_ssize_t)sizeof(utf8proc_int32_t);
+      n = confusable_write_prototype(((utf8proc_int32_t *)*buffer)[i],
+        (utf8proc_int32_t *)*buffer + wpos, capacity - wpos);
+      if (n < 0) return n;
+      if (n <= capacity - wpos) break;
+      if (grow_codepoints(buffer, size, wpos + n)) return UTF8PROC_ERROR_NOMEM;
+    }
+    wpos += n;
+  }
+  /* room for the terminating NUL of an empty skeleton */
+  if (grow_codepoints(buffer, size, wpos + 1)) return UTF8PROC_ERROR_NOMEM;
+  skeleton = (utf8proc_int32_t *)*buffer + length;
+  canonical_reorder(skeleton, wpos - length, NULL);
+  result = encode_utf32(skeleton, wpos - length, 0);
+  for (i = 0; i <= result; i++)
+    ((utf8proc_uint8_t *)*buffer)[i] = ((utf8proc_uint8_t *)skeleton)[i];
+  return result;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_skeleton(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr
+) {
+  void *buffer = NULL;
+  utf8proc_ssize_t size = 0, result;
+  *dstptr = NULL;
+  result = skeleton_buffer(str, strlen, &buffer, &size);
+  if (result < 0) {
+    free(buffer);
+    return result;
+  }
+  if (size > result + 1) {
+    void *newptr;
+    newptr = realloc(buffer, (size_t)result+1);
+    if (newptr) buffer = newptr;
+  }
+  *dstptr = (utf8proc_uint8_t *)buffer;
+  return result;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_skeleton_arena(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, const utf8proc_uint8_t **dstptr,
+  utf8proc_arena_t *arena
+) {
+  utf8proc_ssize_t result;
+  *dstptr = NULL;
+  if (arena->limit > 0 && arena->size > arena->limit) {
+    utf8proc_arena_release(arena);
+  }
+  result = skeleton_buffer(str, strlen, &arena->buffer, &arena->size);
+  if (result < 0) return result;
+  *dstptr = (const utf8proc_uint8_t *)arena->buffer;
+  return result;
+}
+
+/* index of uc in utf8proc_mirroring_codes, or -1 if it has no
+   Bidi_Mirroring_Glyph */
+static utf8proc_ssize_t mirroring_index(utf8proc_int32_t uc) {
+  utf8proc_ssize_t lo = 0;
+  utf8proc_ssize_t n = sizeof(utf8proc_mirroring_codes) / sizeof(utf8proc_mirroring_codes[0]);
+  utf8proc_ssize_t hi = n;
+  while (lo < hi) {
+    utf8proc_ssize_t mid = lo + (hi - lo) / 2;
+    if (utf8proc_mirroring_codes[mid] < uc) lo = mid + 1; else hi = mid;
+  }
+  return lo < n && utf8proc_mirroring_codes[lo] == uc ? lo : -1;
+}
+
+UTF8PROC_DLLEXPORT utf8proc_int32_t utf8proc_bidi_mirror(utf8proc_int32_t c) {
+  utf8proc_ssize_t i = mirroring_index(c);
+  return i < 0 ? c : utf8proc_mirroring_glyphs[i];
+}
+
+#define BIDI_MAX_DEPTH 125
+#define BIDI_MAX_BRACKETS 63
+#define BIDI_REMOVED(bc) \
+  ((bc) == UTF8PROC_BIDI_CLASS_RLE || (bc) == UTF8PROC_BIDI_CLASS_LRE || \
+   (bc) == UTF8PROC_BIDI_CLASS_RLO || (bc) == UTF8PROC_BIDI_CLASS_LRO || \
+   (bc) == UTF8PROC_BIDI_CLASS_PDF || (bc) == UTF8PROC_BIDI_CLASS_BN)
+#define BIDI_INITIATOR(bc) \
+  ((bc) == UTF8PROC_BIDI_CLASS_LRI || (bc) == UTF8PROC_BIDI_CLASS_RLI || \
+   (bc) == UTF8PROC_BIDI_CLASS_FSI)
+#define BIDI_ISOLATE(bc) (BIDI_INITIATOR(bc) || (bc) == UTF8PROC_BIDI_CLASS_PDI)
+#define BIDI_NI(bc) \
+  ((bc) == UTF8PROC_BIDI_CLASS_B || (bc) == UTF8PROC_BIDI_CLASS_S || \
+   (bc) == UTF8PROC_BIDI_CLASS_WS || (bc) == UTF8PROC_BIDI_CLASS_ON || \
+   BIDI_ISOLATE(bc))
+/* direction of a resolved class for N0 and N1, where numbers count as R */
+#define BIDI_STRONG(bc) \
+  ((bc) == UTF8PROC_BIDI_CLASS_L ? UTF8PROC_BIDI_CLASS_L : \
+   (bc) == UTF8PROC_BIDI_CLASS_R || (bc) == UTF8PROC_BIDI_CLASS_EN || \
+   (bc) == UTF8PROC_BIDI_CLASS_AN ? UTF8PROC_BIDI_CLASS_R : 0)
+#define BIDI_DIRECTION(level) \
+  ((level) % 2 ? UTF8PROC_BIDI_CLASS_R : UTF8PROC_BIDI_CLASS_L)
+
+/* the level of the first strong character in [start, end), skipping
+   isolates, or -1 if there is none (P2, P3) */
+static int bidi_first_strong(const utf8proc_uint8_t *classes, const utf8proc_ssize_t *match,
+                             utf8proc_ssize_t start, utf8proc_ssize_t end) {
+  utf8proc_ssize_t i;
+  for (i = start; i < end; i++) {
+    if (classes[i] == UTF8PROC_BIDI_CLASS_L) return 0;
+    if (classes[i] == UTF8PROC_BIDI_CLASS_R || classes[i] == UTF8PROC_BIDI_CLASS_AL) return 1;
+    if (BIDI_INITIATOR(classes[i])) {
+      if (match[i] < 0) break;
+      i = match[i];
+    }
+  }
+  return -1;
+}
+
+/* the bracket uc pairs with, identifying canonically equivalent brackets */
+static utf8proc_int32_t bidi_bracket_key(utf8proc_int32_t uc) {
+  return uc == 0x2329 ? 0x3008 : uc == 0x232A ? 0x3009 : uc;
+}
+
+/* resolve the weak and neutral types of the isolating run sequence of
+   the m characters seq[0..m-1] (W1-W7, N0-N2) */
+static void bidi_resolve_sequence(const utf8proc_int32_t *buffer, const utf8proc_uint8_t *classes,
+                                  utf8proc_uint8_t *types, utf8proc_uint8_t *levels,
+                                  const utf8proc_ssize_t *seq, utf8proc_ssize_t m,
+                                  utf8proc_ssize_t *pairs, int sos, int eos) {
+  utf8proc_ssize_t stack[BIDI_MAX_BRACKETS], k, j, sp = 0;
+  utf8proc_int32_t keys[BIDI_MAX_BRACKETS];
+  int t, strong, e = BIDI_DIRECTION(levels[seq[0]]), before, after;
+
+  /* W1-W3 */
+  strong = before = sos;
+  for (k = 0; k < m; k++) {
+    t = types[seq[k]];
+    if (t == UTF8PROC_BIDI_CLASS_NSM) {
+      t = BIDI_ISOLATE(before) ? UTF8PROC_BIDI_CLASS_ON : before;
+    }
+    before = t;
+    if (t == UTF8PROC_BIDI_CLASS_L || t == UTF8PROC_BIDI_CLASS_R || t == UTF8PROC_BIDI_CLASS_AL) {
+      strong = t;
+    } else if (t == UTF8PROC_BIDI_CLASS_EN && strong == UTF8PROC_BIDI_CLASS_AL) {
+      t = UTF8PROC_BIDI_CLASS_AN;
+    }
+    if (t == UTF8PROC_BIDI_CLASS_AL) t = UTF8PROC_BIDI_CLASS_R;
+    types[seq[k]] = t;
+  }
+  /* W4 */
+  for (k = 1; k + 1 < m; k++) {
+    t = types[seq[k]];
+    before = types[seq[k-1]];
+    after = types[seq[k+1]];
+    if (before == after && ((before == UTF8PROC_BIDI_CLASS_EN &&
+                             (t == UTF8PROC_BIDI_CLASS_ES || t == UTF8PROC_BIDI_CLASS_CS)) ||
+                            (before == UTF8PROC_BIDI_CLASS_AN && t == UTF8PROC_BIDI_CLASS_CS)))
+      types[seq[k]] = before;
+  }
+  /* W5, W6 */
+  for (k = 0; k < m; k = j) {
+    for (j = k; j < m && types[seq[j]] == UTF8PROC_BIDI_CLASS_ET; j++);
+    if (j > k) {
+      t = (k > 0 && types[seq[k-1]] == UTF8PROC_BIDI_CLASS_EN) ||
+        (j < m && types[seq[j]] == UTF8PROC_BIDI_CLASS_EN) ?
+        UTF8PROC_BIDI_CLASS_EN : UTF8PROC_BIDI_CLASS_ON;
+      for (; k < j; k++) types[seq[k]] = t;
+    } else {
+      t = types[seq[k]];
+      if (t == UTF8PROC_BIDI_CLASS_ES || t == UTF8PROC_BIDI_CLASS_CS)
+        types[seq[k]] = UTF8PROC_BIDI_CLASS_ON;
+      j = k + 1;
+    }
+  }
+  /* W7 */
+  strong = sos;
+  for (k = 0; k < m; k++) {
+    t = types[seq[k]];
+    if (t == UTF8PROC_BIDI_CLASS_L || t == UTF8PROC_BIDI_CLASS_R) {
+      strong = t;
+    } else if (t == UTF8PROC_BIDI_CLASS_EN && strong == UTF8PROC_BIDI_CLASS_L) {
+      types[seq[k]] = UTF8PROC_BIDI_CLASS_L;
+    }
+  }
+  /* BD16: pairs[k] is the position of the bracket closing the one at k */
+  for (k = 0; k < m; k++) {
+    pairs[k] = -1;
+    if (sp < 0 || types[seq[k]] != UTF8PROC_BIDI_CLASS_ON) continue;
+    j = mirroring_index(buffer[seq[k]]);
+    if (j < 0 || !utf8proc_mirroring_brackets[j]) continue;
+    if (utf8proc_mirroring_brackets[j] == 1) {
+      if (sp == BIDI_MAX_BRACKETS) {
+        sp = -1; /* stop processing the sequence */
+        continue;
+      }
+      keys[sp] = bidi_bracket_key(utf8proc_mirroring_glyphs[j]);
+      stack[sp++] = k;
+    } else {
+      for (j = sp - 1; j >= 0 && keys[j] != bidi_bracket_key(buffer[seq[k]]); j--);
+      if (j >= 0) {
+        pairs[stack[j]] = k;
+        sp = j;
+      }
+    }
+  }
+  /* N0, with strong holding the last strong type before position j */
+  strong = sos;
+  for (k = j = 0; k < m; k++) {
+    utf8proc_ssize_t close = pairs[k], i;
+    int inside = 0;
+    if (close < 0) continue;
+    for (i = k + 1; i < close && inside != e; i++) {
+      t = BIDI_STRONG(types[seq[i]]);
+      if (t) inside = t;
+    }
+    if (!inside) continue;
+    if (inside != e) {
+      for (; j < k; j++) {
+        t = BIDI_STRONG(types[seq[j]]);
+        if (t) strong = t;
+      }
+      if (strong != inside) inside = e;
+    }
+    types[seq[k]] = types[seq[close]] = inside;
+    for (i = k + 1; i < m && classes[seq[i]] == UTF8PROC_BIDI_CLASS_NSM; i++)
+      types[seq[i]] = inside;
+    for (i = close + 1; i < m && classes[seq[i]] == UTF8PROC_BIDI_CLASS_NSM; i++)
+      types[seq[i]] = inside;
+  }
+  /* N1, N2 */
+  for (k = 0; k < m; k = j) {
+    for (j = k; j < m && BIDI_NI(types[seq[j]]); j++);
+    if (j > k) {
+      before = k > 0 ? BIDI_STRONG(types[seq[k-1]]) : sos;
+      after = j < m ? BIDI_STRONG(types[seq[j]]) : eos;
+      t = before == after ? before : e;
+      for (; k < j; k++) types[seq[k]] = t;
+    } else {
+      j = k + 1;
+    }
+  }
+}
+
+/* resolve the levels of the paragraph [start, end) */
+static void bidi_resolve_paragraph(const utf8proc_int32_t *buffer, const utf8proc_uint8_t *classes,
+                                   utf8proc_uint8_t *types, utf8proc_uint8_t *levels,
+                                   utf8proc_ssize_t *match, utf8proc_ssize_t *links,
+                                   utf8proc_ssize_t *seq, utf8proc_ssize_t start,
+                                   utf8proc_ssize_t end, int level) {
+  struct {
+    utf8proc_uint8_t level, override, isolate;
+  } stack[BIDI_MAX_DEPTH + 2];
+  utf8proc_ssize_t i, j, m, prev, sp, overflow_isolates, overflow_embeddings, valid_isolates;
+  int t, newlevel, sos, eos;
+
+  /* BD9: match isolate initiators and PDIs, using seq as a stack */
+  for (i = start, sp = 0; i < end; i++) {
+    match[i] = -1;
+    if (BIDI_INITIATOR(classes[i])) {
+      seq[sp++] = i;
+    } else if (classes[i] == UTF8PROC_BIDI_CLASS_PDI && sp > 0) {
+      match[i] = seq[--sp];
+      match[seq[sp]] = i;
+    }
+  }
+  if (level < 0) {                                              // P2, P3
+    level = bidi_first_strong(classes, match, start, end);
+    if (level < 0) level = 0;
+  }
+
+  /* X1-X8 */
+  sp = 0;
+  stack[0].level = (utf8proc_uint8_t) level;
+  stack[0].override = 0;
+  stack[0].isolate = 0;
+  overflow_isolates = overflow_embeddings = valid_isolates = 0;
+  for (i = start; i < end; i++) {
+    t = types[i] = classes[i];
+    switch (t) {
+    case UTF8PROC_BIDI_CLASS_RLE: case UTF8PROC_BIDI_CLASS_LRE:
+    case UTF8PROC_BIDI_CLASS_RLO: case UTF8PROC_BIDI_CLASS_LRO: /* X2-X5 */
+      newlevel = t == UTF8PROC_BIDI_CLASS_RLE || t == UTF8PROC_BIDI_CLASS_RLO ?
+        (stack[sp].level + 1) | 1 : (stack[sp].level + 2) & ~1;
+      if (newlevel <= BIDI_MAX_DEPTH && !overflow_isolates && !overflow_embeddings) {
+        sp++;
+        stack[sp].level = (utf8proc_uint8_t) newlevel;
+        stack[sp].override = t == UTF8PROC_BIDI_CLASS_RLO ? UTF8PROC_BIDI_CLASS_R :
+          t == UTF8PROC_BIDI_CLASS_LRO ? UTF8PROC_BIDI_CLASS_L : 0;
+        stack[sp].isolate = 0;
+      } else if (!overflow_isolates) {
+        overflow_embeddings++;
+      }
+      break;
+    case UTF8PROC_BIDI_CLASS_RLI: case UTF8PROC_BIDI_CLASS_LRI:
+    case UTF8PROC_BIDI_CLASS_FSI:                               /* X5a-X5c */
+      levels[i] = stack[sp].level;
+      if (stack[sp].override) types[i] = stack[sp].override;
+      if (t == UTF8PROC_BIDI_CLASS_FSI) {
+        t = bidi_first_strong(classes, match, i + 1, match[i] < 0 ? end : match[i]) == 1 ?
+          UTF8PROC_BIDI_CLASS_RLI : UTF8PROC_BIDI_CLASS_LRI;
+      }
+      newlevel = t == UTF8PROC_BIDI_CLASS_RLI ?
+        (stack[sp].level + 1) | 1 : (stack[sp].level + 2) & ~1;
+      if (newlevel <= BIDI_MAX_DEPTH && !overflow_isolates && !overflow_embeddings) {
+        valid_isolates++;
+        sp++;
+        stack[sp].level = (utf8proc_uint8_t) newlevel;
+        stack[sp].override = 0;
+        stack[sp].isolate = 1;
+      } else {
+        overflow_isolates++;
+      }
+      break;
+    case UTF8PROC_BIDI_CLASS_PDI:                               /* X6a */
+      if (overflow_isolates) {
+        overflow_isolates--;
+      } else if (valid_isolates) {
+        overflow_embeddings = 0;
+        while (!stack[sp].isolate) sp--;
+        sp--;
+        valid_isolates--;
+      }
+      levels[i] = stack[sp].level;
+      if (stack[sp].override) types[i] = stack[sp].override;
+      break;
+    case UTF8PROC_BIDI_CLASS_PDF:                               /* X7 */
+      if (overflow_isolates) {
+        /* nothing */
+      } else if (overflow_embeddings) {
+        overflow_embeddings--;
+      } else if (!stack[sp].isolate && sp > 0) {
+        sp--;
+      }
+      break;
+    case UTF8PROC_BIDI_CLASS_B:                                 /* X8 */
+      levels[i] = (utf8proc_uint8_t) level;
+      break;
+    case UTF8PROC_BIDI_CLASS_BN:                                /* X9 */
+      break;
+    default:                                                    /* X6 */
+      levels[i] = stack[sp].level;
+      if (stack[sp].override) types[i] = stack[sp].override;
+    }
+  }
+
+  /* X10: link each character to the next one of its isolating run
+     sequence, then resolve the sequences starting at each unlinked one */
+  for (i = start, prev = -1; i < end; i++) {
+    if (BIDI_REMOVED(classes[i])) continue;
+    if (prev >= 0) {
+      links[prev] = levels[i] == levels[prev] ? i :
+        BIDI_INITIATOR(classes[prev]) && match[prev] >= 0 ? match[prev] : -1;
+    }
+    prev = i;
+  }
+  if (prev >= 0) links[prev] = -1;
+  for (i = start, prev = -1; i < end; i++) {
+    if (BIDI_REMOVED(classes[i])) continue;
+    if ((prev < 0 || links[prev] != i) &&
+        !(classes[i] == UTF8PROC_BIDI_CLASS_PDI && match[i] >= 0 && links[match[i]] == i)) {
+      for (m = 0, j = i; j >= 0; j = links[j]) seq[m++] = j;
+      /* sos and eos from the neighbouring characters not removed by X9 */
+      t = prev >= 0 && levels[prev] > levels[i] ? levels[prev] : levels[i];
+      sos = BIDI_DIRECTION(prev >= 0 ? t : levels[i] > level ? levels[i] : level);
+      j = seq[m-1];
+      if (BIDI_INITIATOR(classes[j])) {
+        t = level;
+      } else {
+        for (j++; j < end && BIDI_REMOVED(classes[j]); j++);
+        t = j < end ? levels[j] : level;
+      }
+      eos = BIDI_DIRECTION(t > levels[seq[m-1]] ? t : levels[seq[m-1]]);
+      bidi_resolve_sequence(buffer, classes, types, levels, seq, m, seq + m, sos, eos);
+    }
+    prev = i;
+  }
+
+  /* I1, I2, once the embedding levels of all sequences are no longer
+     needed for sos and eos */
+  for (i = start; i < end; i++) {
+    t = types[i];
+    if (BIDI_REMOVED(classes[i])) {
+      continue;
+    } else if (levels[i] % 2 == 0) {
+      if (t == UTF8PROC_BIDI_CLASS_R) levels[i] += 1;
+      else if (t == UTF8PROC_BIDI_CLASS_AN || t == UTF8PROC_BIDI_CLASS_EN) levels[i] += 2;
+    } else if (t == UTF8PROC_BIDI_CLASS_L || t == UTF8PROC_BIDI_CLASS_EN ||
+               t == UTF8PROC_BIDI_CLASS_AN) {
+      levels[i] += 1;
+    }
+  }
+
+  /* characters removed by X9 get the level of the preceding character */
+  for (i = start; i < end; i++) {
+    if (BIDI_REMOVED(classes[i])) levels[i] = (utf8proc_uint8_t) (i > start ? levels[i-1] : level);
+  }
+  /* L1 */
+  for (i = end, t = 1; i-- > start;) {
+    if (classes[i] == UTF8PROC_BIDI_CLASS_B || classes[i] == UTF8PROC_BIDI_CLASS_S) {
+      levels[i] = (utf8proc_uint8_t) level;
+      t = 1;
+    } else if (t && (classes[i] == UTF8PROC_BIDI_CLASS_WS || BIDI_ISOLATE(classes[i]) ||
+                     BIDI_REMOVED(classes[i]))) {
+      levels[i] = (utf8proc_uint8_t) level;
+    } else {
+      t = 0;
+    }
+  }
+}
+
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_bidi_levels(
+  const utf8proc_int32_t *buffer, utf8proc_ssize_t length, int level, utf8proc_uint8_t *levels
+) {
+  utf8proc_uint8_t *classes, *types;
+  utf8proc_ssize_t *match, *links, *seq, start, i;
+  if (level < -1 || level > 1) return UTF8PROC_ERROR_INVALIDOPTS;
+  if (length <= 0) return 0;
+  /* one block for all the scratch arrays: the classes, types, matching
+     isolates, sequence links, and the current sequence and its brackets */
+  match = (utf8proc_ssize_t *) malloc((utf8proc_size_t)length * (4 * sizeof(utf8proc_ssize_t) + 2));
+  if (!match) return UTF8PROC_ERROR_NOMEM;
+  links = match + length;
+  seq = links + length;
+  classes = (utf8proc_uint8_t *) (seq + 2 * length);
+  types = classes + length;
+  for (i = 0; i < length; i++) {
+    classes[i] = (utf8proc_uint8_t) utf8proc_get_property(buffer[i])->bidi_class;
+    if (!classes[i]) classes[i] = UTF8PROC_BIDI_CLASS_L;
+  }
+  /* P1 */
+  for (start = i = 0; i < length; i++) {
+    if (classes[i] == UTF8PROC_BIDI_CLASS_B || i == length - 1) {
+      bidi_resolve_paragraph(buffer, classes, types, levels, match, links, seq, start, i + 1, level);
+      start = i + 1;
+    }
+  }
+  free(match);
+  return 0;
+}
+
+UTF8PROC_DLLEXPORT void utf8proc_bidi_reorder(
+  const utf8proc_int32_t *buffer, const utf8proc_uint8_t *levels, utf8proc_ssize_t length,
+  utf8proc_ssize_t *order
+) {
+  utf8proc_ssize_t start, end, i, j, k, tmp;
+  int level, highest, lowest_odd;
+  for (i = 0; i < length; i++) order[i] = i;
+  for (start = 0; start < length; start = end) {
+    /* each line ends after a paragraph separator */
+    highest = 0;
+    lowest_odd = BIDI_MAX_DEPTH + 2;
+    for (end = start; end < length; ) {
+      level = levels[end];
+      if (level > highest) highest = level;
+      if (level % 2 && level < lowest_odd) lowest_odd = level;
+      if (utf8proc_get_property(buffer[end++])->bidi_class == UTF8PROC_BIDI_CLASS_B) break;
+    }
+    /* L2 */
+    for (level = highest; level >= lowest_odd; level--) {
+      for (i = start; i < end; i = j) {
+        for (; i < end && levels[order[i]] < level; i++);
+        for (j = i; j < end && levels[order[j]] >= level; j++);
+        for (k = j - 1; i < k; i++, k--) {
+          tmp = order[i];
+          order[i] = order[k];
+          order[k] = tmp;
+        }
+      }
+    }
+  }
+}
+
 UTF8PROC_DLLEXPORT utf8proc_uint8_t *utf8proc_NFD(const utf8proc_uint8_t *str) {
   utf8proc_uint8_t *retval;
   utf8proc_map(str, 0, &retval, UTF8PROC_NULLTERM | UTF8PROC_STABLE |
@@ -209,6 +209,23 @@ typedef enum {
    * Strip unassigned codepoints.
    */
   UTF8PROC_STRIPNA    = (1<<14),
+  /**
+   * Replaces each maximal subpart of an ill-formed UTF-8 sequence with
+   * U+FFFD REPLACEMENT CHARACTER instead of failing with
+   * @ref UTF8PROC_ERROR_INVALIDUTF8, following the practice recommended
+   * in chapter 3 of the Unicode standard and the WHATWG Encoding standard.
+   */
+  UTF8PROC_REPLACE_INVALID = (1<<15),
+  /**
+   * Converts the result to the Stream-Safe Text Format of UAX #15 by
+   * inserting U+034F COMBINING GRAPHEME JOINER before a character whose
+   * decomposition would extend a sequence of non-starters beyond 30. The
+   * non-starters are counted in the compatibility decomposition (NFKD) for
+   * all normalization forms, as UAX #15 requires.
+   * @note This option works only with @ref UTF8PROC_COMPOSE or
+   *       @ref UTF8PROC_DECOMPOSE
+   */
+  UTF8PROC_STREAMSAFE = (1<<16),
 } utf8proc_option_t;
 
 /** @name Error codes
@@ -313,6 +330,21 @@ typedef struct utf8proc_property_struct {
    */
   unsigned boundclass:6;
   unsigned indic_conjunct_break:2;
+  /**
+   * Word_Break property.
+   * @see utf8proc_wordbreak_t.
+   */
+  unsigned wordbreak:5;
+  /**
+   * Line_Break property.
+   * @see utf8proc_linebreak_t.
+   */
+  unsigned linebreak:6;
+  /**
+   * Sentence_Break property.
+   * @see utf8proc_sentencebreak_t.
+   */
+  unsigned sentencebreak:4;
 } utf8proc_property_t;
 
 /** Unicode categories. */
@@ -427,6 +459,100 @@ typedef enum {
   UTF8PROC_BOUNDCLASS_E_ZWG = 20, /* UTF8PROC_BOUNDCLASS_EXTENDED_PICTOGRAPHIC + ZWJ */
 } utf8proc_boundclass_t;
 
+/** Word_Break property. (TR29) */
+typedef enum {
+  UTF8PROC_WORDBREAK_OTHER              =  0, /**< Other */
+  UTF8PROC_WORDBREAK_CR                 =  1, /**< CR */
+  UTF8PROC_WORDBREAK_LF                 =  2, /**< LF */
+  UTF8PROC_WORDBREAK_NEWLINE            =  3, /**< Newline */
+  UTF8PROC_WORDBREAK_EXTEND             =  4, /**< Extend */
+  UTF8PROC_WORDBREAK_ZWJ                =  5, /**< ZWJ */
+  UTF8PROC_WORDBREAK_REGIONAL_INDICATOR =  6, /**< Regional_Indicator */
+  UTF8PROC_WORDBREAK_FORMAT             =  7, /**< Format */
+  UTF8PROC_WORDBREAK_KATAKANA           =  8, /**< Katakana */
+  UTF8PROC_WORDBREAK_HEBREW_LETTER      =  9, /**< Hebrew_Letter */
+  UTF8PROC_WORDBREAK_ALETTER            = 10, /**< ALetter */
+  UTF8PROC_WORDBREAK_SINGLE_QUOTE       = 11, /**< Single_Quote */
+  UTF8PROC_WORDBREAK_DOUBLE_QUOTE       = 12, /**< Double_Quote */
+  UTF8PROC_WORDBREAK_MIDNUMLET          = 13, /**< MidNumLet */
+  UTF8PROC_WORDBREAK_MIDLETTER          = 14, /**< MidLetter */
+  UTF8PROC_WORDBREAK_MIDNUM             = 15, /**< MidNum */
+  UTF8PROC_WORDBREAK_NUMERIC            = 16, /**< Numeric */
+  UTF8PROC_WORDBREAK_EXTENDNUMLET       = 17, /**< ExtendNumLet */
+  UTF8PROC_WORDBREAK_WSEGSPACE          = 18, /**< WSegSpace */
+} utf8proc_wordbreak_t;
+
+/** Sentence_Break property. (TR29) */
+typedef enum {
+  UTF8PROC_SENTENCEBREAK_OTHER     =  0, /**< Other */
+  UTF8PROC_SENTENCEBREAK_CR        =  1, /**< CR */
+  UTF8PROC_SENTENCEBREAK_LF        =  2, /**< LF */
+  UTF8PROC_SENTENCEBREAK_EXTEND    =  3, /**< Extend */
+  UTF8PROC_SENTENCEBREAK_SEP       =  4, /**< Sep */
+  UTF8PROC_SENTENCEBREAK_FORMAT    =  5, /**< Format */
+  UTF8PROC_SENTENCEBREAK_SP        =  6, /**< Sp */
+  UTF8PROC_SENTENCEBREAK_LOWER     =  7, /**< Lower */
+  UTF8PROC_SENTENCEBREAK_UPPER     =  8, /**< Upper */
+  UTF8PROC_SENTENCEBREAK_OLETTER   =  9, /**< OLetter */
+  UTF8PROC_SENTENCEBREAK_NUMERIC   = 10, /**< Numeric */
+  UTF8PROC_SENTENCEBREAK_ATERM     = 11, /**< ATerm */
+  UTF8PROC_SENTENCEBREAK_SCONTINUE = 12, /**< SContinue */
+  UTF8PROC_SENTENCEBREAK_STERM     = 13, /**< STerm */
+  UTF8PROC_SENTENCEBREAK_CLOSE     = 14, /**< Close */
+} utf8proc_sentencebreak_t;
+
+/** Line_Break property. (TR14) */
+typedef enum {
+  UTF8PROC_LINEBREAK_XX  =  0, /**< Unknown */
+  UTF8PROC_LINEBREAK_BK  =  1, /**< Mandatory Break */
+  UTF8PROC_LINEBREAK_CR  =  2, /**< Carriage Return */
+  UTF8PROC_LINEBREAK_LF  =  3, /**< Line Feed */
+  UTF8PROC_LINEBREAK_CM  =  4, /**< Combining Mark */
+  UTF8PROC_LINEBREAK_NL  =  5, /**< Next Line */
+  UTF8PROC_LINEBREAK_SG  =  6, /**< Surrogate */
+  UTF8PROC_LINEBREAK_WJ  =  7, /**< Word Joiner */
+  UTF8PROC_LINEBREAK_ZW  =  8, /**< Zero Width Space */
+  UTF8PROC_LINEBREAK_GL  =  9, /**< Non-breaking ("Glue") */
+  UTF8PROC_LINEBREAK_SP  = 10, /**< Space */
+  UTF8PROC_LINEBREAK_ZWJ = 11, /**< Zero Width Joiner */
+  UTF8PROC_LINEBREAK_B2  = 12, /**< Break Opportunity Before and After */
+  UTF8PROC_LINEBREAK_BA  = 13, /**< Break After */
+  UTF8PROC_LINEBREAK_BB  = 14, /**< Break Before */
+  UTF8PROC_LINEBREAK_HY  = 15, /**< Hyphen */
+  UTF8PROC_LINEBREAK_CB  = 16, /**< Contingent Break Opportunity */
+  UTF8PROC_LINEBREAK_CL  = 17, /**< Close Punctuation */
+  UTF8PROC_LINEBREAK_CP  = 18, /**< Close Parenthesis */
+  UTF8PROC_LINEBREAK_EX  = 19, /**< Exclamation/Interrogation */
+  UTF8PROC_LINEBREAK_IN  = 20, /**< Inseparable */
+  UTF8PROC_LINEBREAK_NS  = 21, /**< Nonstarter */
+  UTF8PROC_LINEBREAK_OP  = 22, /**< Open Punctuation */
+  UTF8PROC_LINEBREAK_QU  = 23, /**< Quotation */
+  UTF8PROC_LINEBREAK_IS  = 24, /**< Infix Numeric Separator */
+  UTF8PROC_LINEBREAK_NU  = 25, /**< Numeric */
+  UTF8PROC_LINEBREAK_PO  = 26, /**< Postfix Numeric */
+  UTF8PROC_LINEBREAK_PR  = 27, /**< Prefix Numeric */
+  UTF8PROC_LINEBREAK_SY  = 28, /**< Symbols Allowing Break After */
+  UTF8PROC_LINEBREAK_AI  = 29, /**< Ambiguous (Alphabetic or Ideographic) */
+  UTF8PROC_LINEBREAK_AK  = 30, /**< Aksara */
+  UTF8PROC_LINEBREAK_AL  = 31, /**< Alphabetic */
+  UTF8PROC_LINEBREAK_AP  = 32, /**< Aksara Pre-Base */
+  UTF8PROC_LINEBREAK_AS  = 33, /**< Aksara Start */
+  UTF8PROC_LINEBREAK_CJ  = 34, /**< Conditional Japanese Starter */
+  UTF8PROC_LINEBREAK_EB  = 35, /**< Emoji Base */
+  UTF8PROC_LINEBREAK_EM  = 36, /**< Emoji Modifier */
+  UTF8PROC_LINEBREAK_H2  = 37, /**< Hangul LV Syllable */
+  UTF8PROC_LINEBREAK_H3  = 38, /**< Hangul LVT Syllable */
+  UTF8PROC_LINEBREAK_HL  = 39, /**< Hebrew Letter */
+  UTF8PROC_LINEBREAK_ID  = 40, /**< Ideographic */
+  UTF8PROC_LINEBREAK_JL  = 41, /**< Hangul L Jamo */
+  UTF8PROC_LINEBREAK_JV  = 42, /**< Hangul V Jamo */
+  UTF8PROC_LINEBREAK_JT  = 43, /**< Hangul T Jamo */
+  UTF8PROC_LINEBREAK_RI  = 44, /**< Regional Indicator */
+  UTF8PROC_LINEBREAK_SA  = 45, /**< Complex Context Dependent (South East Asian) */
+  UTF8PROC_LINEBREAK_VF  = 46, /**< Virama Final */
+  UTF8PROC_LINEBREAK_VI  = 47, /**< Virama */
+} utf8proc_linebreak_t;
+
 /** Indic_Conjunct_Break property. (TR44) */
 typedef enum {
   UTF8PROC_INDIC_CONJUNCT_BREAK_NONE = 0,
@@ -435,13 +561,65 @@ typedef enum {
   UTF8PROC_INDIC_CONJUNCT_BREAK_EXTEND = 3,
 } utf8proc_indic_conjunct_break_t;
 
+/**
+ * Entry of the offset map returned by utf8proc_map_offsets(), relating a
+ * range of codepoints in the output to the range of input codepoints it was
+ * derived from. Positions are counted in codepoints, not bytes.
+ *
+ * Entries are ordered and contiguous in both the output and the input.
+ * Runs of codepoints that each map to exactly one input codepoint are
+ * combined into a single entry with `dstlen == srclen`, so an unchanged
+ * string has a single entry. Otherwise, an entry covers a unit such as a
+ * decomposed or composed character and the ranges only correspond as a
+ * whole.
+ */
+typedef struct utf8proc_offset_struct {
+  utf8proc_ssize_t dst;    /**< Index of the first output codepoint */
+  utf8proc_ssize_t dstlen; /**< Number of output codepoints */
+  utf8proc_ssize_t src;    /**< Index of the first input codepoint */
+  utf8proc_ssize_t srclen; /**< Number of input codepoints */
+} utf8proc_offset_t;
+
+/**
+ * Scratch memory reused by utf8proc_map_arena() across calls, so that mapping
+ * many strings does not allocate memory for each of them. The memory grows to
+ * the largest size needed and is kept until the arena is released, unless it
+ * exceeds `limit`. An arena must not be used by several threads at once; use
+ * one arena per thread.
+ */
+typedef struct utf8proc_arena_struct {
+  void *buffer;            /**< Scratch memory, allocated with `malloc` */
+  utf8proc_ssize_t size;   /**< Size of `buffer` in bytes */
+  utf8proc_ssize_t limit;  /**< Size in bytes above which `buffer` is not kept, or 0 */
+} utf8proc_arena_t;
+
+/**
+ * Counters of the work done by utf8proc_map(), utf8proc_map_custom(),
+ * utf8proc_map_arena() and utf8proc_map_offsets() since the start of the
+ * program or the last call of utf8proc_reset_stats(). They are only maintained if the library is
+ * compiled with `UTF8PROC_STATS` defined, and are otherwise always zero.
+ */
+typedef struct utf8proc_stats_struct {
+  utf8proc_size_t map_calls;       /**< Number of calls */
+  utf8proc_size_t composed_path;   /**< Calls composing the string segment by segment */
+  utf8proc_size_t decomposed_path; /**< Calls decomposing the whole string first */
+  utf8proc_size_t bytes_in;        /**< Bytes of input, except for `UTF8PROC_NULLTERM` strings */
+  utf8proc_size_t bytes_out;       /**< Bytes of output */
+  utf8proc_size_t allocations;     /**< Calls of `malloc` or `realloc` */
+} utf8proc_stats_t;
+
 /**
  * Function pointer type passed to utf8proc_map_custom() and
  * utf8proc_decompose_custom(), which is used to specify a user-defined
  * mapping of codepoints to be applied in conjunction with other mappings.
+ * The function returns the codepoint replacing the passed one, or
+ * @ref UTF8PROC_CUSTOM_REMOVE to remove it.
  */
 typedef utf8proc_int32_t (*utf8proc_custom_func)(utf8proc_int32_t codepoint, void *data);
 
+/** Value returned by a @ref utf8proc_custom_func to remove the codepoint. */
+#define UTF8PROC_CUSTOM_REMOVE (-1)
+
 /**
  * Array containing the byte lengths of a UTF-8 encoded codepoint based
  * on the first byte.
@@ -486,6 +664,14 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_iterate(const utf8proc_uint8_t *str
  */
 UTF8PROC_DLLEXPORT utf8proc_bool utf8proc_codepoint_valid(utf8proc_int32_t codepoint);
 
+/**
+ * Returns the length in bytes of the longest prefix of the `strlen` bytes
+ * of `str` that is well-formed UTF-8, which is `strlen` if the whole string
+ * is valid. Runs of ASCII are checked several bytes at a time, so this is
+ * faster than decoding the string with utf8proc_iterate().
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_valid_length(const utf8proc_uint8_t *str, utf8proc_ssize_t strlen);
+
 /**
  * Encodes the codepoint as an UTF-8 string in the byte array pointed
  * to by `dst`. This array must be at least 4 bytes long.
@@ -604,6 +790,26 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_decompose_custom(
  */
 UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options);
 
+/**
+ * Like utf8proc_normalize_utf32(), but also keeps the `length` entries of
+ * `srcmap`, if not `NULL`, in step with the codepoints in `buffer`: the entry
+ * of each codepoint in the result is that of the codepoint it was derived
+ * from, such as the starter of a composition, and the entries of removed or
+ * composed codepoints are dropped.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_normalize_utf32_srcmap(utf8proc_int32_t *buffer, utf8proc_ssize_t length, utf8proc_option_t options, utf8proc_ssize_t *srcmap);
+
+/**
+ * Sorts each sequence of non-starters in the `length` codepoints pointed
+ * to by `buffer` in-place by canonical combining class, as the canonical
+ * ordering algorithm of the Unicode standard. The sort is stable and takes
+ * linear time, however long the sequences are.
+ *
+ * @warning The entries of the array pointed to by `buffer` have to be in the
+ *          range `0x0000` to `0x10FFFF`. Otherwise, the program might crash!
+ */
+UTF8PROC_DLLEXPORT void utf8proc_canonical_reorder(utf8proc_int32_t *buffer, utf8proc_ssize_t length);
+
 /**
  * Reencodes the sequence of `length` codepoints pointed to by `buffer`
  * UTF-8 data in-place (i.e., the result is also stored in `buffer`).
@@ -662,6 +868,78 @@ UTF8PROC_DLLEXPORT utf8proc_bool utf8proc_grapheme_break(
     utf8proc_int32_t codepoint1, utf8proc_int32_t codepoint2);
 
 
+/**
+ * Given a UTF-8 string `str` of length `strlen` bytes and the byte offset
+ * `pos` of a word boundary in it, return the offset of the next word
+ * boundary as defined by the word boundary rules of UAX#29. The start of
+ * the string is a word boundary, so a string can be split into words by
+ * calling this function repeatedly, starting at 0, until `strlen` is
+ * returned.
+ *
+ * Unlike grapheme breaking, some word boundary rules look ahead past the
+ * next codepoint, so the function scans the string itself instead of
+ * deciding on pairs of codepoints. Each codepoint is looked at no more than
+ * twice, so splitting a string takes time linear in its length.
+ *
+ * @return
+ * The offset of the next word boundary, which is `strlen` if `pos` is at
+ * or past the end of the string, or a negative error code
+ * (@ref UTF8PROC_ERROR_INVALIDUTF8) if the string is not valid UTF-8.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_word_break_next(
+    const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos);
+
+/**
+ * Given a UTF-8 string `str` of length `strlen` bytes and the byte offset
+ * `pos` of a sentence boundary in it, return the offset of the next sentence
+ * boundary as defined by the sentence boundary rules of UAX#29. The start of
+ * the string is a sentence boundary, so a string can be split into sentences
+ * by calling this function repeatedly, starting at 0, until `strlen` is
+ * returned.
+ *
+ * As with utf8proc_word_break_next(), the state needed by the rules is kept
+ * while scanning the string and no rule looks behind a boundary, so splitting
+ * a string takes time linear in its length.
+ *
+ * @return
+ * The offset of the next sentence boundary, which is `strlen` if `pos` is at
+ * or past the end of the string, or a negative error code
+ * (@ref UTF8PROC_ERROR_INVALIDUTF8) if the string is not valid UTF-8.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_sentence_break_next(
+    const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos);
+
+/**
+ * Given a UTF-8 string `str` of length `strlen` bytes and the byte offset
+ * `pos` of a line break opportunity in it, return the offset of the next
+ * line break opportunity as defined by the line breaking algorithm of
+ * UAX#14. The start of the string counts as a break opportunity, so the
+ * opportunities can be enumerated by calling this function repeatedly,
+ * starting at 0, until `strlen` is returned.
+ *
+ * Like utf8proc_word_break_next(), the function scans the string itself.
+ * It also looks back at the codepoint preceding `pos`, so no state has to
+ * be carried from one call to the next, and splitting a string takes time
+ * linear in its length.
+ *
+ * Complex-context characters (Line_Break class SA) are resolved as
+ * specified by rule LB1, i.e. no dictionary-based breaking is done for
+ * Thai and similar scripts.
+ *
+ * @param mandatory if not null, set to true if the returned offset is a
+ *                  mandatory break (after a line terminator, or at the end
+ *                  of the string) and to false if it is merely a break
+ *                  opportunity.
+ *
+ * @return
+ * The offset of the next line break opportunity, which is `strlen` if `pos`
+ * is at or past the end of the string, or a negative error code
+ * (@ref UTF8PROC_ERROR_INVALIDUTF8) if the string is not valid UTF-8.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_line_break_next(
+    const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_ssize_t pos,
+    utf8proc_bool *mandatory);
+
 /**
  * Given a codepoint `c`, return the codepoint of the corresponding
  * lower-case character, if any; otherwise (if there is no lower-case
@@ -759,6 +1037,142 @@ UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map_custom(
   utf8proc_custom_func custom_func, void *custom_data
 );
 
+/**
+ * Like utf8proc_map_custom(), but also returns a map from the codepoints in
+ * the result back to the codepoints in `str` from which they were derived.
+ * The map is allocated with `malloc`, returned via `offsetsptr` and must be
+ * deallocated with `free`. The number of entries is stored in `noffsets`.
+ * See @ref utf8proc_offset_t for the format of the entries.
+ *
+ * The @ref UTF8PROC_CHARBOUND option is not supported and results in
+ * @ref UTF8PROC_ERROR_INVALIDOPTS.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map_offsets(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr, utf8proc_option_t options,
+  utf8proc_custom_func custom_func, void *custom_data,
+  utf8proc_offset_t **offsetsptr, utf8proc_ssize_t *noffsets
+);
+
+/**
+ * Converts the `noffsets` entries of `offsets`, as returned by
+ * utf8proc_map_offsets() for `str` of length `strlen` and the result `dst`,
+ * from codepoints to bytes. `options` must be those passed to
+ * utf8proc_map_offsets(), so that ill-formed sequences replaced with
+ * @ref UTF8PROC_REPLACE_INVALID are counted alike.
+ */
+UTF8PROC_DLLEXPORT void utf8proc_offsets_bytes(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, const utf8proc_uint8_t *dst,
+  utf8proc_offset_t *offsets, utf8proc_ssize_t noffsets, utf8proc_option_t options
+);
+
+/**
+ * Initializes `arena` with no memory allocated. If `limit` is positive,
+ * memory of more than `limit` bytes, needed for a long string, is released
+ * by the next call of utf8proc_map_arena() rather than kept for later calls.
+ */
+UTF8PROC_DLLEXPORT void utf8proc_arena_init(utf8proc_arena_t *arena, utf8proc_ssize_t limit);
+
+/**
+ * Releases the memory of `arena`, which can then be used again.
+ */
+UTF8PROC_DLLEXPORT void utf8proc_arena_release(utf8proc_arena_t *arena);
+
+/**
+ * Like utf8proc_map_custom(), but the result is stored in the memory of
+ * `arena` rather than allocated for each call. The string returned via
+ * `dstptr` remains valid until the next call with the same arena or its
+ * release, and must not be deallocated by the caller.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_map_arena(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, const utf8proc_uint8_t **dstptr, utf8proc_option_t options,
+  utf8proc_custom_func custom_func, void *custom_data, utf8proc_arena_t *arena
+);
+
+/**
+ * Stores the current counters of utf8proc_stats_t in `stats`. The counters
+ * are updated without locking, so that they may be slightly inconsistent
+ * with each other while other threads are mapping strings.
+ */
+UTF8PROC_DLLEXPORT void utf8proc_get_stats(utf8proc_stats_t *stats);
+
+/**
+ * Resets the counters of utf8proc_stats_t to zero.
+ */
+UTF8PROC_DLLEXPORT void utf8proc_reset_stats(void);
+
+/**
+ * Computes the confusable skeleton of the UTF-8 string `str` of length
+ * `strlen` bytes, as defined by
+ * [UTS #39: Unicode Security Mechanisms](https://www.unicode.org/reports/tr39/):
+ * the string is converted to NFD, each codepoint is replaced by its prototype
+ * from the confusables data, and the result converted to NFD again. Two
+ * strings are confusable if their skeletons are identical.
+ *
+ * The skeleton is allocated with `malloc` and returned via `dstptr`; it must
+ * be deallocated with `free`.
+ *
+ * @return
+ * In case of success, the length (in bytes) of the skeleton is returned,
+ * otherwise a negative error code is returned (utf8proc_errmsg()).
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_skeleton(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, utf8proc_uint8_t **dstptr
+);
+
+/**
+ * Like utf8proc_skeleton(), but the skeleton is stored in the memory of
+ * `arena` rather than allocated for each call. The string returned via
+ * `dstptr` remains valid until the next call with the same arena or its
+ * release, and must not be deallocated by the caller.
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_skeleton_arena(
+  const utf8proc_uint8_t *str, utf8proc_ssize_t strlen, const utf8proc_uint8_t **dstptr,
+  utf8proc_arena_t *arena
+);
+
+/**
+ * Given a codepoint `c`, return its Bidi_Mirroring_Glyph, i.e. the codepoint
+ * whose glyph is the mirror image of that of `c`, such as `)` for `(`. If
+ * there is no such codepoint, `c` is returned.
+ */
+UTF8PROC_DLLEXPORT utf8proc_int32_t utf8proc_bidi_mirror(utf8proc_int32_t c);
+
+/**
+ * Resolves the embedding levels of the `length` codepoints in `buffer` with
+ * the Unicode Bidirectional Algorithm of
+ * [UAX #9](https://www.unicode.org/reports/tr9/) and stores them in the
+ * caller-provided array `levels`, which must hold `length` entries. Each
+ * paragraph, ending after a paragraph separator, is resolved on its own,
+ * and the whole paragraph is taken to be a single line for rule L1.
+ * Characters removed by rule X9, such as embedding controls, are given the
+ * level of the preceding character. The function runs in time linear in
+ * `length`, with a single allocation for its scratch arrays.
+ *
+ * @param level the paragraph embedding level: 0 for left-to-right and 1 for
+ *              right-to-left paragraphs, or -1 to determine the level of each
+ *              paragraph from its first strong character (rules P2 and P3).
+ *
+ * @return
+ * 0 on success, otherwise a negative error code (@ref UTF8PROC_ERROR_NOMEM,
+ * or @ref UTF8PROC_ERROR_INVALIDOPTS if `level` is invalid).
+ */
+UTF8PROC_DLLEXPORT utf8proc_ssize_t utf8proc_bidi_levels(
+  const utf8proc_int32_t *buffer, utf8proc_ssize_t length, int level, utf8proc_uint8_t *levels
+);
+
+/**
+ * Given the `length` codepoints in `buffer` and their embedding levels as
+ * resolved by utf8proc_bidi_levels(), stores the indices of the codepoints in
+ * visual order in `order`, which must hold `length` entries. Lines end after
+ * paragraph separators, and each line is reordered on its own as specified by
+ * rule L2 of UAX #9. Mirroring (rule L4) is left to the caller, see
+ * utf8proc_bidi_mirror().
+ */
+UTF8PROC_DLLEXPORT void utf8proc_bidi_reorder(
+  const utf8proc_int32_t *buffer, const utf8proc_uint8_t *levels, utf8proc_ssize_t length,
+  utf8proc_ssize_t *order
+);
+
 /** @name Unicode normalization
  *
  * Returns a pointer to newly allocated memory of a NFD, NFC, NFKD, NFKC or